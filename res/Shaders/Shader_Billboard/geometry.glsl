@@ -7,8 +7,12 @@ layout(location = 0) in vec3 g_midPoint[1];
 
 layout(location = 0) out vec2 f_uv;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
 uniform int lockHorizontal;
@@ -4,8 +4,12 @@ layout(location = 0) in vec3 v_position;
 
 layout(location = 0) out vec3 texCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 
 void main() {
     mat4 rot_view = mat4(mat3(view));
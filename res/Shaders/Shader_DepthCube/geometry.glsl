@@ -0,0 +1,32 @@
+#version 450
+layout (triangles, invocations = 6) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+uniform mat4 lightSpaceMatrices[6];
+// Cube of the shadow cube array to render into, its faces are layers cubeLayer * 6 to cubeLayer * 6 + 5
+uniform int cubeLayer;
+
+// One invocation per cube face, gl_Layer picks the face
+void main()
+{
+    vec4 positions[3];
+    for (int i = 0; i < 3; i++)
+        positions[i] = lightSpaceMatrices[gl_InvocationID] * gl_in[i].gl_Position;
+
+    // Triangles entirely outside one side of this face's frustum are dropped before rasterization
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (positions[0][axis] > positions[0].w && positions[1][axis] > positions[1].w && positions[2][axis] > positions[2].w)
+            return;
+        if (positions[0][axis] < -positions[0].w && positions[1][axis] < -positions[1].w && positions[2][axis] < -positions[2].w)
+            return;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        gl_Layer = cubeLayer * 6 + gl_InvocationID;
+        gl_Position = positions[i];
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,10 @@
+#version 450
+layout (location = 0) in vec3 v_position;
+
+uniform mat4 model;
+
+// World space, the geometry shader projects it once per face
+void main()
+{
+    gl_Position = model * vec4(v_position, 1.0);
+}
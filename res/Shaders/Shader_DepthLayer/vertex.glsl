@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+layout (location = 0) in vec3 v_position;
+
+uniform mat4 lightSpaceMatrices[6];
+// Cube of the shadow cube array to render into
+uniform int cubeLayer;
+uniform mat4 model;
+
+// Drawn with six instances, instance i goes to cube face i
+void main()
+{
+    gl_Layer = cubeLayer * 6 + gl_InstanceID;
+    gl_Position = lightSpaceMatrices[gl_InstanceID] * model * vec4(v_position, 1.0);
+}
@@ -2,6 +2,11 @@
 
 #define MAX_POINT_LIGHTS 4
 #define MAX_SPOT_LIGHTS 4
+#define MAX_SHADOW_CASCADES 4
+// Has to match LightClusters.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
 
 struct LightColor {
     vec3 ambient, diffuse, specular;
@@ -14,7 +19,7 @@ struct LightAttenuation {
 // 3 locations
 
 struct LightCutOff {
-    float inner, outer;
+    float inner, outer; // Cosines of the half angles
 };
 // 2 locations
 
@@ -23,9 +28,10 @@ struct DirectionalLight {
     vec3 up; // 3 locations
     LightColor color; // 9 locations
     // sampler2D shadowMap; // 1 locations
-    mat4 lightSpaceMatrix; // 4 x 4 = 16 locations
+    mat4 lightSpaceMatrix[MAX_SHADOW_CASCADES]; // One per cascade
+    vec4 cascadeSplits; // View depth where each cascade ends
+    int cascadeCount;
 };
-// 3 + 3 + 9 + 1 + 16 = 32 locations
 
 struct PointLight {
     vec3 position; // 3 locations
@@ -33,8 +39,8 @@ struct PointLight {
     LightAttenuation attenuation; // 3 locations
     // samplerCube shadowMap; // 1 locations
     mat4 lightSpaceMatrix[6]; // 6 x 4 x 4 = 96 locations
+    int shadowLayer; // Cube of the shadow cube array, -1 without one
 };
-// 3 + 9 + 3 + 1 + 96 = 112 locations
 
 struct SpotLight {
     vec3 position; // 3 locations
@@ -45,8 +51,18 @@ struct SpotLight {
     LightCutOff cutOff; // 2 locations
     // sampler2D shadowMap; // 1 locations
     mat4 lightSpaceMatrix; // 4 x 4 = 16 locations
+    vec4 shadowRect; // Tile of the shadow atlas in texture coordinates, zero without one
+};
+
+// Point or spot light from the cluster buffers, see ClusterLight in LightClusters.h
+struct ClusterLight {
+    vec4 position; // w is the range
+    vec4 direction; // w is the cosine of the outer cutoff, -2 for point lights
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 attenuation;
 };
-// 3 + 3 + 3 + 9 + 3 + 2 + 1 + 16 = 40 locations
 
 // uniform DirectionalLight dirLight;
 // uniform PointLight pointLights[MAX_POINT_LIGHTS];
@@ -61,35 +77,68 @@ struct Material {
     vec3 diffuse; // 3 locations
     vec3 specular; // 3 locations
     float shininess; // 1 locations
+    float dissolve; // 1 locations
 };
-// 1 + 1 + 1 + 1 + 1 + 3 + 3 + 1 = 12 locations
+// 1 + 1 + 1 + 1 + 1 + 3 + 3 + 1 + 1 = 13 locations
 
 uniform Material material;
 
-// uniform vec3 viewPos;
+// Variants get these as #defines, the generic build checks the material and runs every light slot at runtime
+#ifndef SHADER_VARIANT
+#define HAS_DIFFUSE_MAP (material.diffuseIndex != -1)
+#define HAS_SPECULAR_MAP (material.specularIndex != -1)
+#define HAS_NORMAL_MAP (material.normalIndex != -1)
+#define HAS_DIR_LIGHT true
+#define HAS_SHADOWS true
+#define POINT_LIGHT_COUNT MAX_POINT_LIGHTS
+#define SPOT_LIGHT_COUNT MAX_SPOT_LIGHTS
+#define HAS_CLUSTERED_LIGHTS false
+#endif
 
 layout(location = 0) in vec3 f_fragPos;
 layout(location = 1) in vec2 f_texCoords;
 layout(location = 2) in mat3 f_TBN; // 2, 3, 4
 layout(location = 5) in vec3 f_fragNormal;
 
-layout(std140, binding = 1) uniform LightingUniforms
+layout(std140, binding = 0) uniform CameraUniforms
 {
+    mat4 view;
+    mat4 projection;
     vec3 viewPos;
+};
+
+layout(std140, binding = 1) uniform LightingUniforms
+{
     DirectionalLight dirLight;
     PointLight pointLights[MAX_POINT_LIGHTS];
     SpotLight spotLights[MAX_SPOT_LIGHTS];
 };
 
+// Filled by LightClusters, only read by HAS_CLUSTERED_LIGHTS variants
+layout(std430, binding = 2) readonly buffer ClusterLights
+{
+    ClusterLight clusterLights[];
+};
+layout(std430, binding = 3) readonly buffer LightClusterRanges
+{
+    vec4 clusterScale; // x and y are clusters per pixel, slice = log(depth) * z + w
+    vec4 clusterAmbient; // Every clustered light's ambient summed
+    uvec2 clusterRanges[]; // Offset and count into clusterIndices
+};
+layout(std430, binding = 4) readonly buffer ClusterIndices
+{
+    uint clusterIndices[];
+};
+
 layout(location = 0) out vec4 FragColor;  // Output color
 
 vec4 diffuseTexture() {
-    if (material.diffuseIndex == -1)
+    if (!HAS_DIFFUSE_MAP)
     return vec4(material.diffuse, 1.0);
     return texture(material.textures, vec3(f_texCoords, float(material.diffuseIndex)));
 }
 vec4 specularTexture() {
-    if (material.specularIndex == -1)
+    if (!HAS_SPECULAR_MAP)
     return vec4(material.specular, 1.0);
     return texture(material.textures, vec3(f_texCoords, float(material.specularIndex)));
 }
@@ -98,7 +147,7 @@ vec3 normalMap() {
 }
 
 vec3 getLightDir(vec3 direction) {
-    if (material.normalIndex == -1) {
+    if (!HAS_NORMAL_MAP) {
         return normalize(-direction);
     }
     else {
@@ -133,7 +182,7 @@ vec4 calcDiffusePoint(vec3 normal, float shadow, int i) {
 }
 
 vec4 calcDiffuseSpot(vec3 normal, float shadow, int i) {
-    if (dot(f_fragPos - spotLights[i].position, spotLights[i].direction) < cos(spotLights[i].cutOff.outer))
+    if (dot(normalize(f_fragPos - spotLights[i].position), normalize(spotLights[i].direction)) < spotLights[i].cutOff.outer)
         return vec4(0.0);
     if (spotLights[i].color.ambient == vec3(0.0) && spotLights[i].color.diffuse == vec3(0.0) && spotLights[i].color.specular == vec3(0.0))
         return vec4(0.0);
@@ -175,7 +224,7 @@ vec4 calcSpecularPoint(vec3 normal, vec3 viewDir, float shadow, int i)
 }
 vec4 calcSpecularSpot(vec3 normal, vec3 viewDir, float shadow, int i)
 {
-    if (dot(f_fragPos - spotLights[i].position, spotLights[i].direction) < cos(spotLights[i].cutOff.outer))
+    if (dot(normalize(f_fragPos - spotLights[i].position), normalize(spotLights[i].direction)) < spotLights[i].cutOff.outer)
         return vec4(0.0);
     if (spotLights[i].color.ambient == vec3(0.0) && spotLights[i].color.diffuse == vec3(0.0) && spotLights[i].color.specular == vec3(0.0))
         return vec4(0.0);
@@ -193,6 +242,34 @@ vec4 calcSpecularSpot(vec3 normal, vec3 viewDir, float shadow, int i)
 }
 #pragma endregion
 
+// Diffuse and specular of the lights in this fragment's cluster, ambient comes from clusterAmbient
+void calcClusteredLights(vec3 normal, vec3 viewDir, inout vec4 diffuse, inout vec4 specular) {
+    float depth = -(view * vec4(f_fragPos, 1.0)).z;
+    uvec3 cluster = uvec3(gl_FragCoord.xy * clusterScale.xy, max(log(depth) * clusterScale.z + clusterScale.w, 0.0));
+    cluster = min(cluster, uvec3(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1, CLUSTER_GRID_Z - 1));
+    uvec2 range = clusterRanges[(cluster.z * CLUSTER_GRID_Y + cluster.y) * CLUSTER_GRID_X + cluster.x];
+    float energyConservation = (8.0 + material.shininess) / (8.0 * kPi);
+    for (uint i = range.x; i < range.x + range.y; i++)
+    {
+        ClusterLight light = clusterLights[clusterIndices[i]];
+        vec3 toFrag = f_fragPos - light.position.xyz;
+        float distance = length(toFrag);
+        if (distance > light.position.w)
+            continue;
+        if (dot(toFrag / distance, light.direction.xyz) < light.direction.w)
+            continue;
+        float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
+        vec3 lightDir = getLightDir(toFrag);
+        float diff = max(dot(normal, lightDir), 0.0);
+        diffuse += vec4(material.diffuse * light.diffuse.rgb * diff, 1.0) * attenuation;
+        if (HAS_SPECULAR_MAP)
+        {
+            float spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), material.shininess);
+            specular += vec4(energyConservation * 0.5 * material.specular * light.specular.rgb * spec, 1.0) * attenuation;
+        }
+    }
+}
+
 // float calcDirShadow(vec4 fragPosLightSpace)
 // {
 //     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
@@ -225,7 +302,7 @@ vec4 calcSpecularSpot(vec3 normal, vec3 viewDir, float shadow, int i)
 void main() {
     vec3 norm = vec3(0.0);
     vec3 viewDir = normalize(viewPos - f_fragPos);
-    if (material.normalIndex == -1) {
+    if (!HAS_NORMAL_MAP) {
         norm = f_fragNormal;
     }
     else {
@@ -238,9 +315,9 @@ void main() {
     float spotShadow[MAX_SPOT_LIGHTS];
 
     dirShadow = 0.0;
-    for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+    for (int i = 0; i < POINT_LIGHT_COUNT; i++)
         pointShadow[i] = 0.0;
-    for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
+    for (int i = 0; i < SPOT_LIGHT_COUNT; i++)
         spotShadow[i] = 0.0;
 
     // dirShadow = calcDirShadow(dirLight.lightSpaceMatrix * vec4(f_fragPos, 1.0));
@@ -259,39 +336,45 @@ void main() {
     //     pointShadow[i] = calcSpotShadow(fragPosLightSpace, i);
     // }
 
-    vec4 ambient = calcAmbientLight(dirLight.color);
-    for (int i = 0; i < MAX_POINT_LIGHTS; i++)
-    {
-        ambient += calcAmbientLight(pointLights[i].color);
-    }
-    for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
+    vec4 ambient = vec4(0.0);
+    vec4 diffuse = vec4(0.0);
+    vec4 specular = vec4(0.0);
+    if (HAS_DIR_LIGHT)
     {
-        ambient += calcAmbientLight(spotLights[i].color);
+        ambient += calcAmbientLight(dirLight.color);
+        diffuse += calcDiffuseDirectional(norm, dirShadow);
     }
-    
-    vec4 diffuse = calcDiffuseDirectional(norm, dirShadow);
-    for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+    for (int i = 0; i < POINT_LIGHT_COUNT; i++)
     {
+        ambient += calcAmbientLight(pointLights[i].color);
         diffuse += calcDiffusePoint(norm, pointShadow[i], i);
     }
-    for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
+    for (int i = 0; i < SPOT_LIGHT_COUNT; i++)
     {
+        ambient += calcAmbientLight(spotLights[i].color);
         diffuse += calcDiffuseSpot(norm, spotShadow[i], i);
     }
 
-    vec4 specular = vec4(0.0);
-    if (material.specularIndex != -1)
+    if (HAS_CLUSTERED_LIGHTS)
+    {
+        ambient += vec4(clusterAmbient.rgb, 1.0);
+        calcClusteredLights(norm, viewDir, diffuse, specular);
+    }
+
+    if (HAS_SPECULAR_MAP)
     {
-        specular = calcSpecularDirectional(norm, viewDir, dirShadow);
-        for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+        if (HAS_DIR_LIGHT)
+            specular += calcSpecularDirectional(norm, viewDir, dirShadow);
+        for (int i = 0; i < POINT_LIGHT_COUNT; i++)
         {
             specular += calcSpecularPoint(norm, viewDir, pointShadow[i], i);
         }
-        for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
+        for (int i = 0; i < SPOT_LIGHT_COUNT; i++)
         {
             specular += calcSpecularSpot(norm, viewDir, spotShadow[i], i);
         }
     }
 
-    FragColor = ambient * diffuseTexture() + diffuse * diffuseTexture() + specular * specularTexture();
+    vec4 color = ambient * diffuseTexture() + diffuse * diffuseTexture() + specular * specularTexture();
+    FragColor = vec4(color.rgb, material.dissolve);
 }
\ No newline at end of file
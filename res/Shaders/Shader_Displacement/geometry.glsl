@@ -9,10 +9,16 @@ struct Material {
     vec3 diffuse;
     vec3 specular;
     float shininess;
+    float dissolve;
 };
 
 uniform Material material;
 
+// Variants get these as #defines, the generic build checks the material at runtime
+#ifndef SHADER_VARIANT
+#define HAS_NORMAL_MAP (material.normalIndex != -1)
+#endif
+
 layout(triangles) in;        // Input primitive is a triangle
 layout(triangle_strip, max_vertices = 3) out; // Output primitive is also a triangle
 
@@ -64,7 +70,7 @@ void main() {
     // Pass through the input vertices to the output
     f_fragPos = g_fragPos[0];
     f_texCoords = g_texCoords[0];
-    if (material.normalIndex != -1 && g_displaced[0] > 0)
+    if (HAS_NORMAL_MAP && g_displaced[0] > 0)
     {
         f_TBN = GetTBN();
     }
@@ -78,7 +84,7 @@ void main() {
 
     f_fragPos = g_fragPos[1];
     f_texCoords = g_texCoords[1];
-    if (material.normalIndex != -1 && g_displaced[1] > 0)
+    if (HAS_NORMAL_MAP && g_displaced[1] > 0)
     {
         f_TBN = GetTBN();
     }
@@ -92,7 +98,7 @@ void main() {
 
     f_fragPos = g_fragPos[2];
     f_texCoords = g_texCoords[2];
-    if (material.normalIndex != -1 && g_displaced[2] > 0)
+    if (HAS_NORMAL_MAP && g_displaced[2] > 0)
     {
         f_TBN = GetTBN();
     }
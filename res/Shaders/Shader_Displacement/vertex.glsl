@@ -9,12 +9,14 @@ struct Material {
     vec3 diffuse;
     vec3 specular;
     float shininess;
+    float dissolve;
 };
 
 layout(location = 0) in vec3 v_position;  // Vertex position
 layout(location = 1) in vec2 v_uv;        // Vertex uv
 layout(location = 2) in vec3 v_normal;    // Vertex normal
 layout(location = 3) in vec3 v_tangent;   // Vertex tangent
+layout(location = 4) in mat4 v_instanceModel; // 4, 5, 6, 7, per instance
 
 layout(location = 0) out vec3 g_fragPos;
 layout(location = 1) out vec2 g_texCoords;
@@ -24,23 +26,34 @@ layout(location = 6) out vec3 g_fragNormal;
 
 uniform Material material;
 
-uniform mat4 projection;
-uniform mat4 view;
+// Variants get these as #defines, the generic build checks the material at runtime
+#ifndef SHADER_VARIANT
+#define HAS_DISPLACEMENT_MAP (material.displacementIndex != -1)
+#define HAS_INSTANCING false
+#endif
+
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
 void main() {
+    mat4 modelMatrix = HAS_INSTANCING ? v_instanceModel : model;
     vec4 newPos = vec4(v_position, 1.0);
     g_displaced = 0;
-    if (material.displacementIndex != -1) {
+    if (HAS_DISPLACEMENT_MAP) {
         float newHeight = texture(material.textures, vec3(v_uv, float(material.displacementIndex))).r * 0.05;
         newPos += vec4(v_normal, 0.0) * newHeight;
         g_displaced = 1;
     }
 
-    g_fragPos = vec3(model * newPos);
+    g_fragPos = vec3(modelMatrix * newPos);
     g_texCoords = v_uv;
 
-    mat3 normalMatrix = transpose(inverse(mat3(model)));
+    mat3 normalMatrix = transpose(inverse(mat3(modelMatrix)));
     vec3 T = normalize(normalMatrix * v_tangent);
     vec3 N = normalize(normalMatrix * v_normal);
     T = normalize(T - dot(T, N) * N);
@@ -51,5 +64,5 @@ void main() {
     mat3 TBN = transpose(mat3(T, B, N));    
     g_TBN = TBN;
 
-    gl_Position = projection * view * model * newPos;
+    gl_Position = projection * view * modelMatrix * newPos;
 }
\ No newline at end of file
@@ -18,9 +18,21 @@ struct Light {
 };
 
 uniform Material material;
+
+// Variants get these as #defines, the generic build checks the material at runtime
+#ifndef SHADER_VARIANT
+#define HAS_DIFFUSE_MAP (material.diffuseIndex != -1)
+#define HAS_SPECULAR_MAP (material.specularIndex != -1)
+#define HAS_NORMAL_MAP (material.normalIndex != -1)
+#endif
 uniform Light light;
 
-uniform vec3 viewPos;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 
 layout(location = 0) in vec3 f_fragPos;
 layout(location = 1) in vec2 f_texCoords;
@@ -32,17 +44,17 @@ layout(location = 5) in vec3 f_fragNormal;
 layout(location = 0) out vec4 FragColor;  // Output color
 
 vec4 diffuseTexture() {
-    if (material.diffuseIndex == -1)
+    if (!HAS_DIFFUSE_MAP)
     return vec4(material.diffuse, 1.0);
     return texture(material.textures, vec3(f_texCoords, float(material.diffuseIndex)));
 }
 vec4 specularTexture() {
-    if (material.specularIndex == -1)
+    if (!HAS_SPECULAR_MAP)
     return vec4(material.specular, 1.0);
     return texture(material.textures, vec3(f_texCoords, float(material.specularIndex)));
 }
 vec3 normalMap() {
-    if (material.normalIndex == -1)
+    if (!HAS_NORMAL_MAP)
     return f_fragNormal;
     return normalize(texture(material.textures, vec3(f_texCoords, float(material.normalIndex))).rgb * 2.0 - 1.0);
 }
@@ -60,7 +72,7 @@ vec4 diffuse(vec3 normal, vec3 lightDir) {
 const float kPi = 3.14159265359;
 
 vec4 specular(vec3 normal, vec3 lightDir, vec3 viewDir) {
-    if (material.specularIndex == -1)
+    if (!HAS_SPECULAR_MAP)
     return vec4(vec3(0.0), 0.0);
     // vec3 reflectDir = reflect(-lightDir, normal);
     // float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
@@ -74,7 +86,7 @@ vec4 specular(vec3 normal, vec3 lightDir, vec3 viewDir) {
 void main() {
     vec3 norm = normalMap();
     vec3 lightDir; vec3 viewDir;
-    if (material.normalIndex == -1) {
+    if (!HAS_NORMAL_MAP) {
         lightDir = normalize(-light.direction);
         viewDir = normalize(viewPos - f_fragPos);
     }
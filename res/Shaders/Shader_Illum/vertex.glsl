@@ -20,12 +20,14 @@ struct Light {
 };
 uniform Light light;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
-uniform vec3 viewPos;
-
 void main() {
     g_fragPos = vec3(model * vec4(v_position, 1.f));
     g_texCoords = v_uv;
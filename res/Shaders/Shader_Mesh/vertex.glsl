@@ -8,8 +8,12 @@ layout(location = 0) out vec3 fragNormal;  // Normal to pass to fragment shader
 layout(location = 1) out vec3 fragPos;     // Position to pass to fragment shader
 layout(location = 2) out vec2 fragUV;     // uv to pass to fragment shader
 
-uniform mat4 projection;
-uniform mat4 view;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
 void main()
@@ -6,7 +6,12 @@ layout(location = 0) in vec3 g_normal[3];
 
 const float MAGNITUDE = 0.2;
 
-uniform mat4 projection;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 
 vec3 GetNormal() {
     vec3 a = vec3(gl_in[0].gl_Position) - vec3(gl_in[1].gl_Position);
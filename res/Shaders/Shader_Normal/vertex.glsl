@@ -17,7 +17,12 @@ struct Material {
 
 layout(location = 0) out vec3 g_normal;
 
-uniform mat4 view;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
 uniform Material material;
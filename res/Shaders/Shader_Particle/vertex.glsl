@@ -10,8 +10,12 @@ layout(location = 5) in vec4 instanceColor; // Per-instance color
 layout(location = 6) in float instanceLifetime; // Per-instance lifetime
 
 // Uniforms
-uniform mat4 projection;
-uniform mat4 view;
+layout(std140, binding = 0) uniform CameraUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
 // Output to fragment shader
@@ -22,9 +22,16 @@
 #include "EventClock.h"
 
 #include <Engine/LightNode.h>
+#include <Engine/Scene.h>
+#include <chrono>
 #include "glm/gtx/string_cast.hpp"
 #include "Graphics/FramebufferObject.h"
 #include "Graphics/UniformBufferObject.h"
+#include "Graphics/ShaderCache.h"
+#include "Graphics/GLState.h"
+#include "Graphics/RenderQueue.h"
+#include "Engine/SpatialIndex.h"
+#include "Graphics/LightClusters.h"
 
 std::thread save_thread;
 
@@ -44,14 +51,46 @@ int main()
 {
     auto &renderer = Renderer::instance();
     auto &input = InputManager::instance();
-    renderer.loadShader(0, "res/Shaders/Shader_Illum");
-    renderer.loadShader(1, "res/Shaders/Shader_Cube");
-    renderer.loadShader(2, "res/Shaders/Shader_Normal");
-    renderer.loadShader(3, "res/Shaders/Shader_Billboard");
-    renderer.loadShader(4, "res/Shaders/Shader_Displacement");
-    renderer.loadShader(5, "res/Shaders/Shader_Particle");
-    renderer.loadShader(6, "res/Shaders/Shader_Depth");
+
+    auto startupStart = std::chrono::steady_clock::now();
+    auto phaseStart = startupStart;
+    auto endPhase = [&](const char *phase)
+    {
+        auto now = std::chrono::steady_clock::now();
+        printf("Startup: %s %.1f ms\n", phase, std::chrono::duration<float, std::milli>(now - phaseStart).count());
+        phaseStart = now;
+    };
+
+    const std::vector<std::string> shaderPrograms = {
+        "res/Shaders/Shader_Illum",
+        "res/Shaders/Shader_Cube",
+        "res/Shaders/Shader_Normal",
+        "res/Shaders/Shader_Billboard",
+        "res/Shaders/Shader_Displacement",
+        "res/Shaders/Shader_Particle",
+        "res/Shaders/Shader_Depth",
+        ShadowMapCube::GetLayeredShaderPath(),
+    };
+
+    // Start decoding everything the last run needed while the shaders compile.
+    // Shaders are only submitted here, the driver compiles them while the scene loads
+    Scene scene;
+    scene.loadManifest("res/root.json");
+    scene.addShaders(shaderPrograms);
+    scene.beginPrefetch();
+    endPhase("manifest");
+
+    for (size_t i = 0; i < shaderPrograms.size(); i++)
+        renderer.loadShader(i, shaderPrograms[i]);
     renderer.assignSkyboxShader(1);
+    endPhase("shader submit");
+
+    // Resolved once, the render loop only indexes into the renderer's shader slots
+    const ShaderHandle normalShader = renderer.getShaderHandle(2);
+    const ShaderHandle displacementShader = renderer.getShaderHandle(4);
+    const ShaderHandle particleShader = renderer.getShaderHandle(5);
+    const ShaderHandle depthShader = renderer.getShaderHandle(6);
+    const ShaderHandle depthCubeShader = renderer.getShaderHandle(7);
 
     std::vector<Particle> particles = std::vector<Particle>(25);
     for (size_t i = 0; i < particles.size(); i++)
@@ -81,8 +120,26 @@ int main()
 
     // castNode<BillboardNode>(root->children[1])->lockHorizontal = true;
 
-    NodePtr root;
-    loadSceneGraph("res/root.json", root);
+    scene.load("res/root.json");
+    scene.beginPrefetch();
+    NodePtr root = scene.root;
+    SpatialIndex sceneIndex;
+    endPhase("scene graph");
+
+    scene.finishPrefetch();
+    endPhase("prefetch");
+
+    scene.createRenderObjects();
+    endPhase("render objects");
+
+    // Whatever the driver hasn't finished yet is waited on here, before the first frame
+    size_t readyShaders = renderer.finalizeReadyShaders();
+    renderer.finalizeShaders();
+    endPhase("shader finalize");
+    auto shaderCacheStats = ShaderCache::instance().getStats();
+    printf("Shaders: %zu of %zu ready without waiting\n", readyShaders, shaderPrograms.size());
+    printf("Shader cache: %zu hits, %zu misses, %zu rejected\n", shaderCacheStats.hits, shaderCacheStats.misses, shaderCacheStats.rejected);
+    printf("Startup: total %.1f ms\n", std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
 
     // auto lightContainer = makeNode<Node>("LightContainer");
     // root->addChild(lightContainer);
@@ -125,17 +182,19 @@ int main()
     (void)ImGui_ImplOpenGL3_Init("#version 450");
     ImGui::StyleColorsDark();
 
+    // CPU side resources are evicted by ResourceManager::update when over budget
     EventClock purgeClock(5.f, []()
-                          {  RenderObject::Purge();
-                        ResourceManager::instance().purgeAll(); }, [](float ct, float dt)
+                          { RenderObject::Purge(); }, [](float ct, float dt)
                           { return ct + dt; });
 
     FramebufferObject fbo(renderer.getScreenSize().x, renderer.getScreenSize().y, false, GL_DEPTH_COMPONENT, GL_DEPTH_ATTACHMENT);
     bool bind_fbo = false;
 
-    UniformBufferObject ubo = UniformBufferObject("LightingUniforms", LIGHTING_UNIFORM_SIZE, 1);
-    ubo.setData(&lightingUniforms);
-    ubo.use(renderer.getShader(4)->getID());
+    UniformBufferObject ubo = UniformBufferObject("LightingUniforms", LIGHTING_UNIFORM_SIZE, LIGHTING_UNIFORM_BINDING);
+    ubo.bindBase();
+#ifdef DEBUG
+    ubo.checkBlockSize(*renderer.getShader(displacementShader));
+#endif
 
     while (!renderer.shouldClose())
     {
@@ -166,6 +225,21 @@ int main()
             ResourceManager::instance().debugUseCounts();
         if (input.isKeyPressed(GLFW_KEY_F9))
             bind_fbo = !bind_fbo;
+#ifdef DEBUG // Benchmarks, debug builds only
+        if (input.isKeyPressed(GLFW_KEY_F10))
+        {
+            renderer.debugBenchmarkShaderLookups();
+            RenderObject::DebugBenchmarkLookups();
+            SpatialIndex::DebugBenchmark();
+            LightClusters::DebugBenchmark();
+            LightNode::DebugBenchmarkPointShadows(renderer.getShader(depthShader), renderer.getShader(depthCubeShader), [&](const std::shared_ptr<ShaderObject> &shader, const Frustum &view)
+                                                  { return renderSceneGraph(sceneIndex, shader, true, view); });
+        }
+        if (input.isKeyPressed(GLFW_KEY_F12))
+            RenderQueue::DebugBenchmarkStateChanges(root, renderer.getShader(displacementShader));
+#endif
+        if (input.isKeyPressed(GLFW_KEY_F11))
+            LightNode::ShadowsEnabled = !LightNode::ShadowsEnabled;
 
         if (mouseLook)
         {
@@ -177,10 +251,11 @@ int main()
             sendPlayerEvent(playerEvent);
         }
 
-        renderer.setViewProjectionUniforms();
+        renderer.updateFrameUniforms();
 
         // Simple update and render cycle
         updateSceneGraph(root);
+        sceneIndex.update(root);
 
         LightNode::UpdateActiveLights();
         LightNode::UpdateActiveLightVectors();
@@ -201,30 +276,56 @@ int main()
         {
             fbo.unbind();
         }
-        LightNode::RenderDepthMaps(renderer.getShader(6), [&]()
-                                   { renderSceneGraph(root, renderer.getShader(6), true); });
-        glPolygonMode(GL_FRONT_AND_BACK, (drawWireframe ? GL_LINE : GL_FILL));
+        LightNode::RenderDepthMaps(renderer.getShader(depthShader), [&](const std::shared_ptr<ShaderObject> &shader, const Frustum &view)
+                                   { return renderSceneGraph(sceneIndex, shader, true, view); }, renderer.getShader(depthCubeShader), &sceneIndex.getChanges());
+        GLState::instance().polygonMode((drawWireframe ? GL_LINE : GL_FILL));
         renderer.resetViewport();
-        particleObj.render(renderer.getShader(5), glm::mat4(1.f));
-        lightingUniforms.viewPos = mainCamera.position;
+        particleObj.render(renderer.getShader(particleShader), glm::mat4(1.f));
+        LightNode::UpdateLightingUniforms();
         setLightingData(ubo, lightingUniforms);
-        ubo.use(renderer.getShader(4)->getID());
-        renderSceneGraph(root, renderer.getShader(4), false);
+        LightNode::UpdateLightClusters();
+        renderSceneGraph(sceneIndex, renderer.getShader(displacementShader), false, renderer.getFrustum());
         if (drawNormals)
-            renderSceneGraph(root, renderer.getShader(2), true);
+            renderSceneGraph(root, renderer.getShader(normalShader), true, &renderer.getFrustum());
 
         {
             {
                 ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
                 (void)ImGui::Text("Delta Time: %f s", renderer.getDeltaTime());
+                (void)ImGui::Text("Uniform location queries: %zu", ShaderObject::LocationQueries);
+                (void)ImGui::Text("Shader variants: %zu", renderer.getShader(displacementShader)->getVariantCount());
+                auto glStats = GLState::instance().getLastFrameStats();
+                (void)ImGui::Text("GL state calls: %zu issued, %zu skipped", glStats.issued, glStats.skipped);
+                auto queueStats = RenderQueue::LastFrameStats;
+                (void)ImGui::Text("Render queue: %zu draws of %zu instances, %zu shader, %zu material, %zu VAO changes", queueStats.draws, queueStats.instances,
+                                  queueStats.shaderChanges, queueStats.materialChanges, queueStats.vertexArrayChanges);
+                (void)ImGui::Text("Culling: %zu visible, %zu culled", queueStats.visible, queueStats.culled);
+                auto indexStats = sceneIndex.getStats();
+                (void)ImGui::Text("Spatial index: %zu static, %zu dynamic, %zu unbounded, %zu reinserted", indexStats.staticNodes, indexStats.dynamicNodes,
+                                  indexStats.unboundedNodes, indexStats.reinsertions);
+                LightNode::ForEachActiveLight([](const LightNode &light)
+                                              { (void)ImGui::Text("Shadow casters of %s: %zu%s", light.name.c_str(), light.getShadowCasterCount(), light.isShadowReused() ? " (cached)" : ""); });
+                auto shadowStats = ShadowAtlas::instance().getStats();
+                (void)ImGui::Text("Shadow memory: %.1f / %.1f MB, %zu tiles, %zu cubes, %zu downsized, %zu denied", shadowStats.bytes / 1048576.f, shadowStats.budget / 1048576.f,
+                                  shadowStats.tiles, shadowStats.cubes, shadowStats.downsized, shadowStats.denied);
+                auto clusterStats = LightClusters::instance().getStats();
+                if (LightNode::IsClusteredLighting())
+                    (void)ImGui::Text("Light clusters: %zu lights, %zu indices, %zu max per cluster, %zu dropped, %.3f ms", clusterStats.lights, clusterStats.indices,
+                                      clusterStats.maxPerCluster, clusterStats.dropped, clusterStats.milliseconds);
+                auto resourceStats = ResourceManager::instance().getStats();
+                (void)ImGui::Text("Resources: %.1f / %.1f MB (textures %.1f, meshes %.1f), %zu evicted", resourceStats.totalBytes / 1048576.f, resourceStats.budget / 1048576.f,
+                                  resourceStats.bytes[(size_t)ResourceKind::TEXTURE] / 1048576.f, resourceStats.bytes[(size_t)ResourceKind::MESH] / 1048576.f, resourceStats.evictions);
 
                 Inspector::drawNode(root);
             }
             ImGui::Render();
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            // ImGui binds through GL directly
+            GLState::instance().invalidate();
         }
 
         purgeClock.update(renderer.getDeltaTime());
+        ResourceManager::instance().update();
 
         renderer.postUpdate();
     }
@@ -232,6 +333,7 @@ int main()
     if (save_thread.joinable())
         save_thread.join();
     root.reset();
+    scene.root.reset();
     RenderObject::ReleaseAllMeshes();
     ResourceManager::instance().clear();
     return 0;
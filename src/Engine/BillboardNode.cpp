@@ -1,5 +1,10 @@
 #include "BillboardNode.h"
 #include <Graphics/Renderer.h>
+#include <Graphics/RenderQueue.h>
+
+static const Uniform<int> ImageUniform("image");
+static const Uniform<int> LockHorizontalUniform("lockHorizontal");
+static const Uniform<glm::mat4> ModelUniform("model");
 
 void BillboardNode::render(const std::shared_ptr<ShaderObject> &_shader)
 {
@@ -9,23 +14,32 @@ void BillboardNode::render(const std::shared_ptr<ShaderObject> &_shader)
     {
         texture = std::make_shared<TextureObject>(render_name);
     }
-    if (!RenderObject::HasRenderObject("Billboard"))
+    if (!renderObject)
     {
-        auto data = std::make_shared<MeshData>();
-        data->loadFromSource("v 0.000000 0.000000 0.000000\np 1", false);
-        renderObject = RenderObject::AddRenderObject("Billboard", std::make_shared<RenderObject>(data));
+        if (!RenderObject::HasRenderObject("Billboard"))
+        {
+            auto data = std::make_shared<MeshData>();
+            data->loadFromSource("v 0.000000 0.000000 0.000000\np 1", false);
+            renderObject = RenderObject::AddRenderObject("Billboard", std::make_shared<RenderObject>(data));
+        }
+        else
+            renderObject = RenderObject::GetRenderObject("Billboard");
     }
-    if (!renderObject)
-        renderObject = RenderObject::GetRenderObject("Billboard");
-    auto shader = resolveShader(_shader);
+    const auto &shader = resolveShader(_shader);
     shader->use();
-    Renderer::instance().slotTexture(GL_TEXTURE_2D, texture->getID(), shader, "image");
-    shader->setInt("lockHorizontal", lockHorizontal ? 1 : 0);
-    shader->setMat4("model", transform.globalTransform);
+    Renderer::instance().slotTexture(GL_TEXTURE_2D, texture->getID(), shader, ImageUniform);
+    shader->set(LockHorizontalUniform, lockHorizontal ? 1 : 0);
+    shader->set(ModelUniform, transform.globalTransform);
     renderObject->renderRaw();
     Renderer::instance().resetTextureSlots();
 }
 
+void BillboardNode::enqueue(RenderQueue &queue, const std::shared_ptr<ShaderObject> &shader)
+{
+    if (enabled && visible)
+        queue.pushNode(RenderPass::SOLID, this, shader, resolveShader(shader));
+}
+
 void BillboardNode::reset()
 {
     texture.reset();
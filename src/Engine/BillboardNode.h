@@ -14,6 +14,8 @@ public:
         : Renderable(name), lockHorizontal(false) { forced_shader = 3; }
 
     void render(const std::shared_ptr<ShaderObject> &shader) override;
+    void enqueue(RenderQueue &queue, const std::shared_ptr<ShaderObject> &shader) override;
+    bool getWorldBounds(AABB &) override { return false; }
     void reset() override;
 
 private:
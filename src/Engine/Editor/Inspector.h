@@ -161,6 +161,7 @@ inline void Inspector::drawContent<LightNode>(const std::shared_ptr<LightNode> &
     else if (auto dir = std::dynamic_pointer_cast<DirectionalLight>(caster))
     {
         drawLightColor(node->name, dir->color);
+        SliderInt("shadow cascades", &dir->cascadeCount, 1, MAX_SHADOW_CASCADES);
     }
     if (draw_children)
         drawChildren(node);
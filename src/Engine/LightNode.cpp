@@ -1,123 +1,186 @@
 #include "LightNode.h"
+#include <Graphics/GLState.h>
+#include <Graphics/RenderQueue.h>
+#include <Graphics/Renderer.h>
+#include <Graphics/LightClusters.h>
+#include <Graphics/GLExtensions.h>
+#include <Engine/Camera.h>
+#include <chrono>
 
 LightNode *LightNode::ActiveDirectionalLight;
 std::array<LightNode *, MAX_POINT_LIGHTS> LightNode::ActivePointLights;
 std::array<LightNode *, MAX_SPOT_LIGHTS> LightNode::ActiveSpotLights;
+ShaderFeatures LightNode::ActiveLightFeatures = 0;
+bool LightNode::ShadowsEnabled = true;
+bool LightNode::ClusteredLightingEnabled = true;
+uint32_t LightNode::ShadowFrame = 0;
 
-std::vector<LightNode *> LightNode::DirectionalLights;
-std::vector<LightNode *> LightNode::PointLights;
-std::vector<LightNode *> LightNode::SpotLights;
-
-LightNode::LightNode(const std::string &name, std::vector<LightNode *> *vector)
-    : Transformable(name)
-{
-    vector->push_back(this);
-}
+LightTable LightNode::Lights;
+std::vector<LightNode *> LightNode::ClusteredLights;
+std::vector<LightNode::LightRank> LightNode::PointRanks;
+std::vector<LightNode::LightRank> LightNode::SpotRanks;
+std::vector<LightNode::LightRank> LightNode::ClusterRanks;
 
 LightNode::LightNode(const std::string &name, const LightColor &color)
-    : LightNode(name, &DirectionalLights)
+    : LightNode(name)
 {
-    caster = std::make_shared<DirectionalLight>(color);
-    shadowMap = std::make_shared<ShadowMap2D>();
+    setCaster(std::make_shared<DirectionalLight>(color));
 }
 LightNode::LightNode(const std::string &name, const LightColor &color, const LightAttenuation &attenuation)
-    : LightNode(name, &PointLights)
+    : LightNode(name)
 {
-    caster = std::make_shared<PointLight>(color, attenuation);
-    shadowMap = std::make_shared<ShadowMapCube>();
+    setCaster(std::make_shared<PointLight>(color, attenuation));
 }
 LightNode::LightNode(const std::string &name, const LightColor &color, const LightAttenuation &attenuation, const LightCutOff &cutOff)
-    : LightNode(name, &SpotLights)
+    : LightNode(name)
 {
-    caster = std::make_shared<SpotLight>(color, attenuation, cutOff);
-    shadowMap = std::make_shared<ShadowMap2D>();
+    setCaster(std::make_shared<SpotLight>(color, attenuation, cutOff));
 }
 
 LightNode::LightNode(const std::string &name)
     : Transformable(name)
 {
+    handle = Lights.add(this);
 }
 
 LightNode::~LightNode()
 {
-    std::vector<LightNode *> *vector = 0;
-
-    if (auto dir = std::dynamic_pointer_cast<DirectionalLight>(caster))
-        vector = &DirectionalLights;
-    else if (auto point = std::dynamic_pointer_cast<PointLight>(caster))
-        vector = &PointLights;
-    else if (auto spot = std::dynamic_pointer_cast<SpotLight>(caster))
-        vector = &SpotLights;
-    else
-    {
-        std::cerr << "Unknown light type" << std::endl;
-        return;
-    }
-
-    vector->erase(std::remove(vector->begin(), vector->end(), this), vector->end());
+    Lights.remove(handle);
 }
 
 void LightNode::setCaster(const std::shared_ptr<LightCaster> &_caster)
 {
     caster = _caster;
 
-    std::vector<LightNode *> *vector = 0;
-    if (auto dir = std::dynamic_pointer_cast<DirectionalLight>(caster))
+    if (std::dynamic_pointer_cast<DirectionalLight>(caster))
     {
-        vector = &DirectionalLights;
-        shadowMap = std::make_shared<ShadowMap2D>();
+        type = LightType::DIRECTIONAL;
+        shadowMap = std::make_shared<ShadowMapCascaded>();
     }
-    else if (auto point = std::dynamic_pointer_cast<PointLight>(caster))
+    else if (std::dynamic_pointer_cast<PointLight>(caster))
     {
-        vector = &PointLights;
+        type = LightType::POINT;
         shadowMap = std::make_shared<ShadowMapCube>();
     }
-    else if (auto spot = std::dynamic_pointer_cast<SpotLight>(caster))
+    else if (std::dynamic_pointer_cast<SpotLight>(caster))
     {
-        vector = &SpotLights;
+        type = LightType::SPOT;
         shadowMap = std::make_shared<ShadowMap2D>();
     }
-
-    vector->push_back(this);
+    else
+    {
+        std::cerr << "Unknown light type" << std::endl;
+        type = LightType::NONE;
+        shadowMap = nullptr;
+    }
+    Lights.types[handle] = type;
+    Lights.invalidateMatrices(handle);
 }
 
 void LightNode::updateVectors()
 {
-    if (auto point = std::dynamic_pointer_cast<PointLight>(caster))
+    // Everything below comes from the global transform, a light that didn't move has nothing to update
+    const glm::mat4 &global = transform.globalTransform;
+    float cutOff = type == LightType::SPOT ? static_cast<const SpotLight *>(caster.get())->cutOff.outer : 0.f;
+    if (type != LightType::DIRECTIONAL && Lights.matrixTransforms[handle] == global && Lights.matrixCutOffs[handle] == cutOff)
+        return;
+    Lights.matrixTransforms[handle] = global;
+    Lights.matrixCutOffs[handle] = cutOff;
+
+    switch (type)
     {
+    case LightType::POINT:
+    {
+        auto *point = static_cast<PointLight *>(caster.get());
         point->position = transform.getGlobalPosition();
+        break;
     }
-    else if (auto spot = std::dynamic_pointer_cast<SpotLight>(caster))
+    case LightType::SPOT:
     {
+        auto *spot = static_cast<SpotLight *>(caster.get());
         spot->position = transform.getGlobalPosition();
         spot->direction = transform.getGlobalFront();
         spot->up = transform.getGlobalUp();
+        break;
     }
-    else if (auto dir = std::dynamic_pointer_cast<DirectionalLight>(caster))
+    case LightType::DIRECTIONAL:
     {
+        auto *dir = static_cast<DirectionalLight *>(caster.get());
         dir->direction = transform.getGlobalFront();
         dir->up = transform.getGlobalUp();
+        break;
     }
-    else
+    default:
         throw std::runtime_error("Unknown light type");
+    }
 
     caster->calcLightSpaceMatrix();
 }
 
-void LightNode::renderDepth(const std::shared_ptr<ShaderObject> &shader, const std::function<void()> &renderFunc)
+void LightNode::renderDepth(const std::shared_ptr<ShaderObject> &shader, const ShadowCasterFunc &renderFunc, const std::shared_ptr<ShaderObject> &layeredShader,
+                            const std::vector<AABB> *changes)
 {
     if (!shadowMap)
         return;
-    shadowMap->render(shader, caster, renderFunc);
+    // The signature has to be checked against where the atlas put the map this frame, not where it was last frame.
+    // A map that got no place has nothing to keep
+    bool placed = shadowMap->place();
+    shadowReused = placed && changes && shadowFrame + 1 == ShadowFrame && shadowMap->isUpToDate(caster, *changes);
+    shadowFrame = ShadowFrame;
+    if (shadowReused)
+        return;
+    if (type == LightType::POINT && layeredShader)
+        std::static_pointer_cast<ShadowMapCube>(shadowMap)->renderLayered(layeredShader, caster, renderFunc);
+    else
+        shadowMap->render(shader, caster, renderFunc);
+}
+
+void LightNode::UpdateLights()
+{
+    for (size_t i = 0; i < Lights.size(); i++)
+    {
+        const LightNode *light = Lights.nodes[i];
+        Lights.active[i] = light->active && light->type != LightType::NONE;
+        // Read off the transform, lights that weren't selected last frame haven't had their vectors updated
+        glm::vec3 position = light->transform.getGlobalPosition();
+        Lights.positionX[i] = position.x;
+        Lights.positionY[i] = position.y;
+        Lights.positionZ[i] = position.z;
+        if (!light->caster)
+            continue;
+        const glm::vec3 &diffuse = light->caster->color.diffuse;
+        Lights.brightness[i] = glm::max(diffuse.r, glm::max(diffuse.g, diffuse.b));
+        bool attenuated = light->type == LightType::POINT || light->type == LightType::SPOT;
+        Lights.range[i] = attenuated ? static_cast<const AttenuationLightCaster *>(light->caster.get())->getRange() : FLT_MAX;
+    }
+    const Renderer &renderer = Renderer::instance();
+    Lights.updateCoverage(renderer.getFrustum(), mainCamera.position, renderer.getProjection()[1][1]);
 }
 
-int lastUsedShadowMapSlot = 0;
+void LightNode::RankLights(LightType type, std::vector<LightRank> &ranks)
+{
+    ranks.clear();
+    for (size_t i = 0; i < Lights.size(); i++)
+    {
+        if (Lights.types[i] != type)
+            continue;
+        LightNode *light = Lights.nodes[i];
+        bool wasSelected = light->selected;
+        light->selected = false;
+        float importance = Lights.coverage[i] * Lights.brightness[i];
+        if (!Lights.active[i] || importance <= 0.f)
+            continue;
+        ranks.push_back({light, wasSelected ? importance * LIGHT_SELECTION_HYSTERESIS : importance});
+    }
+}
 
-void LightNode::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+size_t LightNode::SelectLights(std::vector<LightRank> &ranks, size_t count)
 {
-    caster->setUniforms(shader, name);
-    shadowMap->setUniforms(shader, name);
-    lastUsedShadowMapSlot = shadowMap->getTextureSlot();
+    // Only the first count end up sorted, O(n log count)
+    count = std::min(count, ranks.size());
+    std::partial_sort(ranks.begin(), ranks.begin() + count, ranks.end(), [](const LightRank &a, const LightRank &b)
+                      { return a.importance > b.importance; });
+    return count;
 }
 
 void LightNode::UpdateActiveLights()
@@ -126,77 +189,69 @@ void LightNode::UpdateActiveLights()
     ActivePointLights.fill(nullptr);
     ActiveSpotLights.fill(nullptr);
 
-#ifdef DEBUG // Debug mode gives warning when too many lights are active, but takes more time updating (iterates all lights)
-    for (auto dir : DirectionalLights)
+    UpdateLights();
+    for (size_t i = 0; i < Lights.size(); i++)
     {
-        if (!dir || !dir->isActive())
+        if (Lights.types[i] != LightType::DIRECTIONAL || !Lights.active[i])
             continue;
+        LightNode *dir = Lights.nodes[i];
+#ifdef DEBUG // Debug mode gives warning when too many lights are active, but takes more time updating (iterates all lights)
         if (ActiveDirectionalLight != nullptr)
         {
             printf("Too many active directional lights\n");
             break;
         }
         ActiveDirectionalLight = dir;
+#else // Release mode does not give warning when too many lights are active, but takes less time updating (stops when limit is met)
+        ActiveDirectionalLight = dir;
+        break;
+#endif
     }
 
-    int activePointLightCount = 0;
-    for (auto point : PointLights)
+    // Point and spot lights compete for their slots by what they add to the frame, a light that had a slot last
+    // frame keeps it until another one beats it by LIGHT_SELECTION_HYSTERESIS
+    RankLights(LightType::POINT, PointRanks);
+    RankLights(LightType::SPOT, SpotRanks);
+
+    ClusteredLights.clear();
+    bool clustered = IsClusteredLighting();
+    if (clustered)
     {
-        if (!point || !point->isActive())
-            continue;
-        if (activePointLightCount >= MAX_POINT_LIGHTS)
-        {
-            printf("Too many active point lights\n");
-            break;
-        }
-        ActivePointLights[activePointLightCount] = point;
-        activePointLightCount++;
+        // Every light in view, the most important first if there are more than the clusters take
+        ClusterRanks = PointRanks;
+        ClusterRanks.insert(ClusterRanks.end(), SpotRanks.begin(), SpotRanks.end());
+        size_t count = SelectLights(ClusterRanks, MAX_CLUSTERED_LIGHTS);
+        for (size_t i = 0; i < count; i++)
+            ClusteredLights.push_back(ClusterRanks[i].node);
     }
 
-    int activeSpotLightCount = 0;
-    for (auto spot : SpotLights)
+    size_t activePointLightCount = SelectLights(PointRanks, MAX_POINT_LIGHTS);
+    for (size_t i = 0; i < activePointLightCount; i++)
     {
-        if (!spot || !spot->isActive())
-            continue;
-        if (activeSpotLightCount >= MAX_SPOT_LIGHTS)
-        {
-            printf("Too many active spot lights\n");
-            break;
-        }
-        ActiveSpotLights[activeSpotLightCount] = spot;
-        activeSpotLightCount++;
+        ActivePointLights[i] = PointRanks[i].node;
+        ActivePointLights[i]->selected = true;
     }
-#else // Release mode does not give warning when too many lights are active, but takes less time updating (stops when limit is met)
-    for (auto &dir : DirectionalLights)
+    size_t activeSpotLightCount = SelectLights(SpotRanks, MAX_SPOT_LIGHTS);
+    for (size_t i = 0; i < activeSpotLightCount; i++)
     {
-        if (!dir || !dir->isActive())
-            continue;
-        ActiveDirectionalLight = dir;
-        break;
+        ActiveSpotLights[i] = SpotRanks[i].node;
+        ActiveSpotLights[i]->selected = true;
     }
 
-    int activePointLightCount = 0;
-    for (auto point : PointLights)
+    // Active lights are packed at the front, so the counts are all a variant has to loop over
+    bool anyActive = ActiveDirectionalLight || activePointLightCount || activeSpotLightCount;
+    if (!clustered)
     {
-        if (!point || !point->isActive())
-            continue;
-        ActivePointLights[activePointLightCount] = point;
-        activePointLightCount++;
-        if (activePointLightCount >= MAX_POINT_LIGHTS)
-            break;
+        ActiveLightFeatures = makeLightFeatures(ActiveDirectionalLight != nullptr, activePointLightCount, activeSpotLightCount, ShadowsEnabled && anyActive);
+        return;
     }
+    // The slots still pick the lights that get shadow maps, the shading of every light in view goes through the clusters
+    ActiveLightFeatures = makeLightFeatures(ActiveDirectionalLight != nullptr, 0, 0, ShadowsEnabled && anyActive) | SHADER_FEATURE_CLUSTERED_LIGHTS;
+}
 
-    int activeSpotLightCount = 0;
-    for (auto spot : SpotLights)
-    {
-        if (!spot || !spot->isActive())
-            continue;
-        ActiveSpotLights[activeSpotLightCount] = spot;
-        activeSpotLightCount++;
-        if (activeSpotLightCount >= MAX_SPOT_LIGHTS)
-            break;
-    }
-#endif
+bool LightNode::IsClusteredLighting()
+{
+    return ClusteredLightingEnabled && GLEXT_shader_storage_buffer_object;
 }
 
 void LightNode::UpdateActiveLightVectors()
@@ -209,49 +264,148 @@ void LightNode::UpdateActiveLightVectors()
     for (auto spot : ActiveSpotLights)
         if (spot)
             spot->updateVectors();
+    // The slotted ones again, cheaper than checking which of them are in both
+    for (auto light : ClusteredLights)
+        light->updateVectors();
 }
 
-void LightNode::SetActiveLightUniforms(const std::shared_ptr<ShaderObject> &shader)
+void LightNode::UpdateLightClusters()
 {
-    if (ActiveDirectionalLight)
+    if (!IsClusteredLighting())
+        return;
+    LightClusters &clusters = LightClusters::instance();
+    clusters.clear();
+    for (auto light : ClusteredLights)
     {
-        ActiveDirectionalLight->setUniforms(shader, "dirLight");
-        lightingUniforms.dirLight = *std::dynamic_pointer_cast<DirectionalLight>(ActiveDirectionalLight->caster).get();
+        if (light->type == LightType::POINT)
+            clusters.addPointLight(*static_cast<const PointLight *>(light->caster.get()));
+        else
+            clusters.addSpotLight(*static_cast<const SpotLight *>(light->caster.get()));
     }
+    Renderer &renderer = Renderer::instance();
+    clusters.update(renderer.getView(), renderer.getProjection(), renderer.getScreenSize());
+}
+
+void LightNode::UpdateLightingUniforms()
+{
+    lightingUniforms.dirLight = ActiveDirectionalLight ? *static_cast<const DirectionalLight *>(ActiveDirectionalLight->caster.get()) : DirectionalLight();
     for (int i = 0; i < MAX_POINT_LIGHTS; i++)
-        if (ActivePointLights[i])
-        {
-            ActivePointLights[i]->setUniforms(shader, "pointLights[" + std::to_string(i) + "]");
-            lightingUniforms.pointLights[i] = *std::dynamic_pointer_cast<PointLight>(ActivePointLights[i]->caster).get();
-        }
-        else
-            shader->setInt("pointLights[" + std::to_string(i) + "].shadowMap", lastUsedShadowMapSlot);
-    lastUsedShadowMapSlot = 0;
+    {
+        LightNode *point = ActivePointLights[i];
+        lightingUniforms.pointLights[i] = point ? *static_cast<const PointLight *>(point->caster.get()) : PointLight();
+        auto cube = point ? std::static_pointer_cast<ShadowMapCube>(point->shadowMap) : nullptr;
+        lightingUniforms.pointShadowLayers[i] = cube ? cube->getLayer() : -1;
+    }
+    float atlasSize = (float)glm::max(ShadowAtlas::instance().getAtlasSize(), 1u);
     for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
-        if (ActiveSpotLights[i])
-        {
-            ActiveSpotLights[i]->setUniforms(shader, "spotLights[" + std::to_string(i) + "]");
-            lightingUniforms.spotLights[i] = *std::dynamic_pointer_cast<SpotLight>(ActiveSpotLights[i]->caster).get();
-        }
-        else
-            shader->setInt("spotLights[" + std::to_string(i) + "].shadowMap", lastUsedShadowMapSlot);
-    lastUsedShadowMapSlot = 0;
+    {
+        LightNode *spot = ActiveSpotLights[i];
+        lightingUniforms.spotLights[i] = spot ? *static_cast<const SpotLight *>(spot->caster.get()) : SpotLight();
+        auto map = spot ? std::static_pointer_cast<ShadowMap2D>(spot->shadowMap) : nullptr;
+        ShadowTile tile = map ? map->getTile() : ShadowTile{0, 0, 0};
+        lightingUniforms.spotShadowRects[i] = glm::vec4(tile.x, tile.y, tile.size, tile.size) / atlasSize;
+    }
 }
 
-void LightNode::RenderDepthMaps(const std::shared_ptr<ShaderObject> &shader, const std::function<void()> &renderFunc)
+void LightNode::RenderDepthMaps(const std::shared_ptr<ShaderObject> &shader, const ShadowCasterFunc &renderFunc, const std::shared_ptr<ShaderObject> &layeredShader,
+                                const std::vector<AABB> *changes)
 {
-    glCullFace(GL_FRONT);
+    // Counted while shadows are off too, so maps don't count as current across frames nothing was tracked in
+    ShadowFrame++;
+    if (!ShadowsEnabled)
+        return;
+    AllocateShadowMaps();
+    GLState::instance().cullFace(GL_FRONT);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     if (ActiveDirectionalLight)
-        ActiveDirectionalLight->renderDepth(shader, renderFunc);
+        ActiveDirectionalLight->renderDepth(shader, renderFunc, nullptr, changes);
     for (int i = 0; i < MAX_POINT_LIGHTS; i++)
         if (ActivePointLights[i])
-            ActivePointLights[i]->renderDepth(shader, renderFunc);
+            ActivePointLights[i]->renderDepth(shader, renderFunc, layeredShader, changes);
     for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
         if (ActiveSpotLights[i])
-            ActiveSpotLights[i]->renderDepth(shader, renderFunc);
+            ActiveSpotLights[i]->renderDepth(shader, renderFunc, nullptr, changes);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glCullFace(GL_BACK);
+    GLState::instance().cullFace(GL_BACK);
+}
+
+void LightNode::AllocateShadowMaps()
+{
+    ShadowAtlas &atlas = ShadowAtlas::instance();
+    float screenHeight = (float)Renderer::instance().getScreenSize().y;
+    auto request = [&](const LightNode *light, bool cube)
+    {
+        float coverage = light->getScreenCoverage();
+        if (coverage <= 0.f)
+            return;
+        const glm::vec3 &diffuse = light->caster->color.diffuse;
+        float importance = coverage * glm::max(diffuse.r, glm::max(diffuse.g, diffuse.b));
+        if (cube)
+            atlas.requestCube(light->shadowMap.get(), importance);
+        else
+        {
+            unsigned int size = SHADOW_TILE_MIN_SIZE;
+            while (size < coverage * screenHeight && size < SHADOW_TILE_MAX_SIZE)
+                size *= 2;
+            atlas.requestTile(light->shadowMap.get(), size, importance);
+        }
+    };
+
+    atlas.beginFrame();
+    for (auto point : ActivePointLights)
+        if (point && point->shadowMap)
+            request(point, true);
+    for (auto spot : ActiveSpotLights)
+        if (spot && spot->shadowMap)
+            request(spot, false);
+    atlas.allocate();
+}
+
+#ifdef DEBUG
+void LightNode::DebugBenchmarkPointShadows(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<ShaderObject> &layeredShader, const ShadowCasterFunc &renderFunc, int iterations)
+{
+    // Draws are read off the render queue stats, which are put back afterwards so the overlay doesn't see the benchmark
+    RenderQueueStats frameStats = RenderQueue::FrameStats;
+    GLState::instance().cullFace(GL_FRONT);
+    auto measure = [&](const std::shared_ptr<ShaderObject> &layered, size_t &draws)
+    {
+        RenderQueue::FrameStats = {};
+        glFinish();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++)
+            for (auto point : ActivePointLights)
+                if (point)
+                    point->renderDepth(shader, renderFunc, layered);
+        glFinish();
+        auto end = std::chrono::high_resolution_clock::now();
+        draws = RenderQueue::FrameStats.draws / iterations;
+        return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+    };
+    size_t perFaceDraws, layeredDraws;
+    double perFace = measure(nullptr, perFaceDraws);
+    double layered = measure(layeredShader, layeredDraws);
+    GLState::instance().cullFace(GL_BACK);
+    RenderQueue::FrameStats = frameStats;
+
+    size_t lightCount = 0;
+    for (auto point : ActivePointLights)
+        lightCount += point != nullptr;
+    printf("Point shadows over %zu lights, %d iterations:\n", lightCount, iterations);
+    printf("  face by face: %zu draws, %.3f ms\n", perFaceDraws, perFace);
+    printf("  single pass:  %zu draws, %.3f ms\n", layeredDraws, layered);
+}
+#endif
+
+void LightNode::ForEachActiveLight(const std::function<void(const LightNode &)> &func)
+{
+    if (ActiveDirectionalLight)
+        func(*ActiveDirectionalLight);
+    for (auto point : ActivePointLights)
+        if (point)
+            func(*point);
+    for (auto spot : ActiveSpotLights)
+        if (spot)
+            func(*spot);
 }
 
 void to_json(nlohmann::json &j, const LightColor &color)
@@ -287,24 +441,28 @@ void to_json(nlohmann::json &j, const std::shared_ptr<LightNode> &node)
 void to_json(nlohmann::json &j, const LightNode *node)
 {
     ::to_json(j, dynamic_cast<const Transformable *>(node));
-    if (auto point = std::dynamic_pointer_cast<PointLight>(node->getCaster()))
+    if (node->getType() == LightType::POINT)
     {
+        auto point = std::static_pointer_cast<const PointLight>(node->getCaster());
         j += {"lightType", "point"};
         j += {"lightColor", point->color};
         j += {"lightAttenuation", point->attenuation};
     }
-    else if (auto spot = std::dynamic_pointer_cast<SpotLight>(node->getCaster()))
+    else if (node->getType() == LightType::SPOT)
     {
+        auto spot = std::static_pointer_cast<const SpotLight>(node->getCaster());
         j += {"lightType", "spot"};
         j += {"lightColor", spot->color};
         j += {"lightAttenuation", spot->attenuation};
         j += {"innerCutoff", spot->cutOff.inner};
         j += {"outerCutoff", spot->cutOff.outer};
     }
-    else if (auto dir = std::dynamic_pointer_cast<DirectionalLight>(node->getCaster()))
+    else if (node->getType() == LightType::DIRECTIONAL)
     {
+        auto dir = std::static_pointer_cast<const DirectionalLight>(node->getCaster());
         j += {"lightType", "directional"};
         j += {"lightColor", dir->color};
+        j += {"shadowCascades", dir->cascadeCount};
     }
     j += {"lightActive", node->isActive()};
 }
@@ -336,6 +494,8 @@ void from_json(const nlohmann::json &j, const std::shared_ptr<LightNode> &node)
     {
         auto caster = std::make_shared<DirectionalLight>();
         j.at("lightColor").get_to(caster->color);
+        if (j.contains("shadowCascades"))
+            j.at("shadowCascades").get_to(caster->cascadeCount);
         node->setCaster(caster);
     }
     else
@@ -3,25 +3,55 @@
 #include <Graphics/LightCaster.h>
 #include <Graphics/ShadowMap.h>
 #include <Engine/SceneGraph.h>
+#include <Engine/LightTable.h>
+
+// A light that had a slot last frame is only replaced by one this many times as important, so lights of about the
+// same importance don't trade slots back and forth as the camera moves
+constexpr float LIGHT_SELECTION_HYSTERESIS = 1.25f;
 
 class LightNode : public Transformable
 {
 protected:
     std::shared_ptr<LightCaster> caster = nullptr;
     std::shared_ptr<ShadowMap> shadowMap = nullptr;
+    LightType type = LightType::NONE;
+    // Into Lights
+    uint32_t handle = 0;
     bool active = false;
+    // ShadowFrame of the last RenderDepthMaps that went through this light, a map skipped since may have missed changes
+    uint32_t shadowFrame = 0;
+    bool shadowReused = false;
+    // Had a point or spot slot in the last UpdateActiveLights
+    bool selected = false;
+
+    struct LightRank
+    {
+        LightNode *node;
+        float importance; // With the hysteresis bonus
+    };
 
     static LightNode * ActiveDirectionalLight;
     static std::array<LightNode *, MAX_POINT_LIGHTS> ActivePointLights;
     static std::array<LightNode *, MAX_SPOT_LIGHTS> ActiveSpotLights;
 
-    static std::vector<LightNode *> DirectionalLights;
-    static std::vector<LightNode *> PointLights;
-    static std::vector<LightNode *> SpotLights;
-
-    LightNode(const std::string &name, std::vector<LightNode *> *vector);
+    // Every LightNode there is, active or not
+    static LightTable Lights;
+    // Every active point and spot light in view, the most important MAX_CLUSTERED_LIGHTS when there are more. What LightClusters bins
+    static std::vector<LightNode *> ClusteredLights;
+    // Rebuilt by every UpdateActiveLights, kept to reuse their storage
+    static std::vector<LightRank> PointRanks, SpotRanks, ClusterRanks;
+    // Calls of RenderDepthMaps so far
+    static uint32_t ShadowFrame;
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const;
+    // Brings Lights up to date with every node and works out their screen coverage, first thing in UpdateActiveLights
+    static void UpdateLights();
+    // Asks the ShadowAtlas for room for every active point and spot light the camera can see, sized by how much of
+    // the screen the light's range covers and ranked by that and its brightness, then lets it hand the room out
+    static void AllocateShadowMaps();
+    // Active lights of type that are in view into ranks, unsorted
+    static void RankLights(LightType type, std::vector<LightRank> &ranks);
+    // Moves the count most important of ranks to the front, in order. Returns how many there are
+    static size_t SelectLights(std::vector<LightRank> &ranks, size_t count);
 
 public:
     // Directional
@@ -35,19 +65,65 @@ public:
 
     ~LightNode();
 
+    // A copy would share the handle and remove it from Lights a second time
+    LightNode(const LightNode &) = delete;
+    LightNode &operator=(const LightNode &) = delete;
+
     std::shared_ptr<LightCaster> getCaster() { return caster; }
     const std::shared_ptr<LightCaster> getCaster() const { return caster; }
+    LightType getType() const { return type; }
     bool isActive() const { return active; }
     void setActive(bool _active) { active = _active; }
+    // The one place the caster's type is looked up at runtime, everything after goes by getType
     void setCaster(const std::shared_ptr<LightCaster> &_caster);
+    // Only LightTable moves lights around
+    void setHandle(uint32_t _handle) { handle = _handle; }
 
+    // Copies the transform into the caster. The light space matrices are only computed again when the global transform
+    // or the spot cutoff changed since the last time, directional cascades follow the camera and are always redone
     void updateVectors();
-    void renderDepth(const std::shared_ptr<ShaderObject> &shader, const std::function<void()> &renderFunc);
+    // Point lights go through ShadowMapCube::renderLayered when layeredShader is set.
+    // With changes, the map is kept as it is if none of them touch it and the light didn't change
+    void renderDepth(const std::shared_ptr<ShaderObject> &shader, const ShadowCasterFunc &renderFunc, const std::shared_ptr<ShaderObject> &layeredShader = nullptr,
+                     const std::vector<AABB> *changes = nullptr);
+    // Casters drawn into this light's shadow map last frame, 0 without one
+    size_t getShadowCasterCount() const { return shadowMap ? shadowMap->getCasterCount() : 0; }
+    // Whether the last RenderDepthMaps kept the shadow map instead of rendering it
+    bool isShadowReused() const { return shadowReused; }
+    // Share of the screen height the light's range spans from the main camera, 0 when the range is out of view.
+    // 1 for directional lights. As of the last UpdateActiveLights
+    float getScreenCoverage() const { return Lights.coverage[handle]; }
+    // Screen coverage weighted by the brightest diffuse channel, what the active light selection ranks by
+    float getImportance() const { return Lights.coverage[handle] * Lights.brightness[handle]; }
+
+    // Light part of the shader feature key, updated by UpdateActiveLights
+    static ShaderFeatures ActiveLightFeatures;
+    // RenderDepthMaps does nothing when off
+    static bool ShadowsEnabled;
+    // Point and spot lights are shaded through LightClusters instead of the fixed slots, when the context has SSBOs
+    static bool ClusteredLightingEnabled;
+    static bool IsClusteredLighting();
 
+    // Picks the directional light and ranks point and spot lights by getImportance for the slots, and for the
+    // clusters when clustered lighting is on. Lights out of view get neither
     static void UpdateActiveLights();
     static void UpdateActiveLightVectors();
-    static void SetActiveLightUniforms(const std::shared_ptr<ShaderObject> &shader);
-    static void RenderDepthMaps(const std::shared_ptr<ShaderObject> &shader, const std::function<void()> &renderFunc);
+    // Copies the active lights and where their shadow maps are into lightingUniforms, slots without a light are zeroed.
+    // Once a frame after RenderDepthMaps, before setLightingData uploads it
+    static void UpdateLightingUniforms();
+    // Bins ClusteredLights into the renderer's view, once a frame after the camera uniforms are set. Nothing without clustered lighting
+    static void UpdateLightClusters();
+    // renderFunc is called once per shadow view with the frustum its casters have to be in.
+    // With a layeredShader point lights render all six faces in one pass. changes are the boxes
+    // where the scene changed since the last call, maps they don't touch are reused. Null renders every map
+    static void RenderDepthMaps(const std::shared_ptr<ShaderObject> &shader, const ShadowCasterFunc &renderFunc, const std::shared_ptr<ShaderObject> &layeredShader = nullptr,
+                                const std::vector<AABB> *changes = nullptr);
+#ifdef DEBUG
+    // Renders every active point light face by face and in one pass, and compares draws and time
+    static void DebugBenchmarkPointShadows(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<ShaderObject> &layeredShader, const ShadowCasterFunc &renderFunc, int iterations = 100);
+#endif
+    // Directional first, then point and spot lights in slot order
+    static void ForEachActiveLight(const std::function<void(const LightNode &)> &func);
 };
 
 void to_json(nlohmann::json &j, const LightColor &color);
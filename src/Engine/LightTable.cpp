@@ -0,0 +1,96 @@
+#include <Engine/LightTable.h>
+#include <Engine/LightNode.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LIGHT_TABLE_SSE 1
+#endif
+
+uint32_t LightTable::add(LightNode *node)
+{
+    nodes.push_back(node);
+    types.push_back(LightType::NONE);
+    active.push_back(0);
+    positionX.push_back(0.f);
+    positionY.push_back(0.f);
+    positionZ.push_back(0.f);
+    range.push_back(0.f);
+    brightness.push_back(0.f);
+    coverage.push_back(0.f);
+    matrixTransforms.push_back(glm::mat4(0.f));
+    matrixCutOffs.push_back(0.f);
+    return (uint32_t)(nodes.size() - 1);
+}
+
+void LightTable::remove(uint32_t handle)
+{
+    size_t last = nodes.size() - 1;
+    if (handle != last)
+    {
+        nodes[handle] = nodes[last];
+        types[handle] = types[last];
+        active[handle] = active[last];
+        positionX[handle] = positionX[last];
+        positionY[handle] = positionY[last];
+        positionZ[handle] = positionZ[last];
+        range[handle] = range[last];
+        brightness[handle] = brightness[last];
+        coverage[handle] = coverage[last];
+        matrixTransforms[handle] = matrixTransforms[last];
+        matrixCutOffs[handle] = matrixCutOffs[last];
+        nodes[handle]->setHandle(handle);
+    }
+    nodes.pop_back();
+    types.pop_back();
+    active.pop_back();
+    positionX.pop_back();
+    positionY.pop_back();
+    positionZ.pop_back();
+    range.pop_back();
+    brightness.pop_back();
+    coverage.pop_back();
+    matrixTransforms.pop_back();
+    matrixCutOffs.pop_back();
+}
+
+void LightTable::updateCoverage(const Frustum &frustum, const glm::vec3 &eye, float focal)
+{
+    const size_t count = size();
+    size_t i = 0;
+
+#if LIGHT_TABLE_SSE
+    const __m128 one = _mm_set1_ps(1.f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(&positionX[i]), py = _mm_loadu_ps(&positionY[i]), pz = _mm_loadu_ps(&positionZ[i]);
+        __m128 radius = _mm_loadu_ps(&range[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+        __m128 inside = _mm_cmpeq_ps(one, one);
+        for (const auto &plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), px), _mm_mul_ps(_mm_set1_ps(plane.y), py)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), pz), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        __m128 dx = _mm_sub_ps(px, _mm_set1_ps(eye.x)), dy = _mm_sub_ps(py, _mm_set1_ps(eye.y)), dz = _mm_sub_ps(pz, _mm_set1_ps(eye.z));
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        // Whole screen from inside the range, otherwise how much of the height the range's sphere spans
+        __m128 within = _mm_cmple_ps(distance, radius);
+        __m128 spanned = _mm_min_ps(one, _mm_div_ps(_mm_mul_ps(radius, _mm_set1_ps(focal)), distance));
+        __m128 result = _mm_or_ps(_mm_and_ps(within, one), _mm_andnot_ps(within, spanned));
+        _mm_storeu_ps(&coverage[i], _mm_and_ps(inside, result));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        glm::vec3 position(positionX[i], positionY[i], positionZ[i]);
+        if (!frustum.intersects(position, range[i]))
+        {
+            coverage[i] = 0.f;
+            continue;
+        }
+        float distance = glm::distance(eye, position);
+        coverage[i] = distance <= range[i] ? 1.f : glm::min(1.f, range[i] * focal / distance);
+    }
+}
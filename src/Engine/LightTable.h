@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+#include <Graphics/Frustum.h>
+
+class LightNode;
+
+// Which LightCaster a LightNode holds, so per frame code can static_cast instead of asking RTTI
+enum class LightType : uint8_t
+{
+    NONE, // No caster set yet
+    DIRECTIONAL,
+    POINT,
+    SPOT,
+};
+
+// Every LightNode's per frame data, one array per field indexed by the node's handle. LightNode::UpdateLights
+// fills it in one pass over the nodes, the selection then only walks the arrays. Color, attenuation and cutoff stay
+// in the casters, which the shadow maps and uniform uploads take as they are
+struct LightTable
+{
+    std::vector<LightNode *> nodes;
+    std::vector<LightType> types;
+    std::vector<uint8_t> active;
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> range;      // FLT_MAX for directional lights
+    std::vector<float> brightness; // Brightest diffuse channel
+    std::vector<float> coverage;   // Written by updateCoverage
+    // What the light space matrices were last computed from, LightNode::updateVectors skips lights where neither changed
+    std::vector<glm::mat4> matrixTransforms;
+    std::vector<float> matrixCutOffs;
+
+    // Returns the handle, which stays the node's until it is removed
+    uint32_t add(LightNode *node);
+    // The last light is moved into the handle's place and its node told its new handle
+    void remove(uint32_t handle);
+    // Forces the light space matrices to be computed on the next updateVectors
+    void invalidateMatrices(uint32_t handle) { matrixTransforms[handle] = glm::mat4(0.f); }
+    size_t size() const { return nodes.size(); }
+
+    // Share of the screen height each light's range spans from eye, 0 where the range is outside frustum. focal is
+    // the projection's [1][1]. Four lights at a time where there is SSE
+    void updateCoverage(const Frustum &frustum, const glm::vec3 &eye, float focal);
+};
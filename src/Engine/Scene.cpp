@@ -1,26 +1,206 @@
 #include "Scene.h"
 #include <Graphics/RenderObject.h>
+#include <ResourceManager/TextureData.h>
+#include <ResourceManager/ShaderProgram.h>
+#include <ResourceManager/MeshData.h>
+#include <ResourceManager/MaterialLibrary.h>
+#include "SkyboxNode.h"
+#include "BillboardNode.h"
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+
+using json = nlohmann::json;
+
+static void addUnique(std::vector<std::string> &list, const std::string &name)
+{
+    if (!name.empty() && std::find(list.begin(), list.end(), name) == list.end())
+        list.push_back(name);
+}
+
+bool SceneManifest::operator==(const SceneManifest &other) const
+{
+    return shaders == other.shaders && meshes == other.meshes && materials == other.materials && textures == other.textures;
+}
+
+void to_json(json &j, const SceneManifest &manifest)
+{
+    j = json{{"shaders", manifest.shaders}, {"meshes", manifest.meshes}, {"materials", manifest.materials}, {"textures", manifest.textures}};
+}
+
+void from_json(const json &j, SceneManifest &manifest)
+{
+    j.at("shaders").get_to(manifest.shaders);
+    j.at("meshes").get_to(manifest.meshes);
+    j.at("materials").get_to(manifest.materials);
+    j.at("textures").get_to(manifest.textures);
+}
+
+std::string getManifestPath(const std::string &sceneFile)
+{
+    std::filesystem::path path(sceneFile);
+    return (path.parent_path() / (path.stem().string() + ".deps.json")).string();
+}
 
 void Scene::extractUsedResources()
 {
-    materials.clear();
-    textures.clear();
-    meshes.clear();
+    if (!root)
+        return;
+    manifest.meshes.clear();
+    manifest.materials.clear();
+    manifest.textures.clear();
 
     auto lambda = [&](Node *node)
     {
-        if (auto *cast = dynamic_cast<Renderable *>(node))
+        if (dynamic_cast<SkyboxNode *>(node))
         {
-            auto obj = RenderObject::GetRenderObject(cast->render_name);
-            for (auto &group : obj->groups)
+            // The cubemap faces are read by CubemapObject directly
+            addUnique(manifest.meshes, SkyboxNode::SkyboxMesh);
+        }
+        else if (auto *billboard = dynamic_cast<BillboardNode *>(node))
+        {
+            addUnique(manifest.textures, billboard->render_name);
+        }
+        else if (auto *cast = dynamic_cast<Renderable *>(node))
+        {
+            addUnique(manifest.meshes, cast->render_name);
+        }
+    };
+    root->traverse(lambda);
+
+    auto &resources = ResourceManager::instance();
+    for (const auto &mesh_name : manifest.meshes)
+    {
+        auto mesh = resources.peekResource<MeshData>(mesh_name);
+        if (!mesh)
+            continue;
+        for (const auto &kvp : mesh->materialLibraries)
+            addUnique(manifest.materials, kvp.first);
+        for (const auto &texture : mesh->getUsedTextures())
+            addUnique(manifest.textures, texture);
+    }
+}
+
+bool Scene::loadManifest(const std::string &sceneFile)
+{
+    filename = sceneFile;
+    std::string path = getManifestPath(sceneFile);
+    std::error_code error;
+    auto manifestTime = std::filesystem::last_write_time(path, error);
+    if (error)
+        return false;
+    auto sceneTime = std::filesystem::last_write_time(sceneFile, error);
+    if (error || sceneTime > manifestTime)
+        return false;
+
+    try
+    {
+        std::ifstream file(path);
+        json j;
+        file >> j;
+        j.get_to(manifest);
+        cachedManifest = manifest;
+    }
+    catch (const std::exception &e)
+    {
+        printf("Ignoring scene manifest %s: %s\n", path.c_str(), e.what());
+        manifest = SceneManifest();
+        return false;
+    }
+    return true;
+}
+
+void Scene::saveManifest() const
+{
+    json j = manifest;
+    std::ofstream file(getManifestPath(filename));
+    file << j.dump(4);
+}
+
+void Scene::addShaders(const std::vector<std::string> &programs)
+{
+    for (const auto &program : programs)
+        addUnique(manifest.shaders, program);
+}
+
+template <typename ResourceType>
+void Scene::queueLoads(const std::vector<std::string> &names, std::unordered_set<std::string> &requested)
+{
+    for (const auto &name : names)
+    {
+        if (!requested.insert(name).second)
+            continue;
+        auto future = ResourceManager::instance().loadResourceAsync<ResourceType>(name);
+        pendingLoads.emplace_back(name, [future]()
+                                  { (void)future.get(); });
+    }
+}
+
+void Scene::beginPrefetch()
+{
+    // Dependencies are queued before their dependents. The pool is FIFO, so a mesh that
+    // waits on one of its material libraries waits on a load that already started
+    queueLoads<TextureData>(manifest.textures, requestedTextures);
+    queueLoads<MaterialLibrary>(manifest.materials, requestedMaterials);
+    queueLoads<ShaderProgram>(manifest.shaders, requestedShaders);
+    queueLoads<MeshData>(manifest.meshes, requestedMeshes);
+}
+
+void Scene::finishPrefetch()
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t failed = 0;
+    size_t loaded = 0;
+    size_t waves = 0;
+
+    while (!pendingLoads.empty())
+    {
+        waves++;
+        auto loads = std::move(pendingLoads);
+        pendingLoads.clear();
+        for (auto &load : loads)
+        {
+            try
+            {
+                load.second();
+                loaded++;
+            }
+            catch (const std::exception &e)
             {
-                auto usedTextures = group.getData()->getGroup(group.getName()).getUsedTextures();
-                textures.insert(textures.end(), usedTextures.begin(), usedTextures.end());
+                printf("Prefetch of %s failed: %s\n", load.first.c_str(), e.what());
+                failed++;
             }
-            // materials.insert(materials.end(), obj->groups[0].getData()->materialLibraries.begin(), obj->groups[0].getData()->materialLibraries.end());
-            meshes.push_back(cast->render_name);
         }
-    };
 
-    root->traverse(lambda);
-}
\ No newline at end of file
+        // Libraries and textures of meshes that weren't in the cached manifest
+        extractUsedResources();
+        beginPrefetch();
+    }
+
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Prefetched %zu resources (%zu shaders, %zu meshes, %zu material libraries, %zu textures) in %zu waves, waited %.1f ms, %zu failed\n",
+           loaded, manifest.shaders.size(), manifest.meshes.size(), manifest.materials.size(), manifest.textures.size(), waves, ms, failed);
+
+    if (manifest != cachedManifest && !filename.empty())
+    {
+        saveManifest();
+        cachedManifest = manifest;
+    }
+}
+
+void Scene::createRenderObjects()
+{
+    for (const auto &mesh : manifest.meshes)
+    {
+        if (!ResourceManager::instance().peekResource<MeshData>(mesh))
+            continue;
+        try
+        {
+            RenderObject::GetRenderObjectHandle(mesh);
+        }
+        catch (const std::exception &e)
+        {
+            printf("Failed to create render object %s: %s\n", mesh.c_str(), e.what());
+        }
+    }
+}
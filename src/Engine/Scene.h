@@ -1,26 +1,74 @@
 #pragma once
 
 #include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_set>
 #include "SceneGraph.h"
 #include <ResourceManager/ResourceManager.h>
 
-struct Scene
+// Everything a scene pulls from the ResourceManager, cached next to the scene file
+// so the next startup can queue all of it before the graph is even parsed
+struct SceneManifest
 {
-private:
-    std::vector<std::string> materials;
-    std::vector<std::string> textures;
     std::vector<std::string> shaders;
     std::vector<std::string> meshes;
+    std::vector<std::string> materials;
+    std::vector<std::string> textures;
+
+    bool operator==(const SceneManifest &other) const;
+    bool operator!=(const SceneManifest &other) const { return !(*this == other); }
+};
+void to_json(nlohmann::json &j, const SceneManifest &manifest);
+void from_json(const nlohmann::json &j, SceneManifest &manifest);
+
+// "res/root.json" -> "res/root.deps.json"
+std::string getManifestPath(const std::string &sceneFile);
+
+struct Scene
+{
+private:
+    std::string filename;
+    SceneManifest cachedManifest; // As read from or last written to disk
+
+    // Queued loads that finishPrefetch still has to wait on, by name
+    std::vector<std::pair<std::string, std::function<void(void)>>> pendingLoads;
+    // Names queued so far, one set per resource type since a path can name more than one kind of resource
+    std::unordered_set<std::string> requestedShaders, requestedMeshes, requestedMaterials, requestedTextures;
+
+    template <typename ResourceType>
+    void queueLoads(const std::vector<std::string> &names, std::unordered_set<std::string> &requested);
 
 public:
+    SceneManifest manifest;
+
     std::shared_ptr<Node> root;
     std::shared_ptr<Node> activeCamera;
     std::shared_ptr<ShaderObject> defaultShader;
 
+    // Rebuilds the meshes, materials and textures of the manifest from the graph. Material
+    // libraries and mesh textures are only known for meshes that are already loaded
     void extractUsedResources();
 
+    // False if there is no cached manifest or the scene file is newer
+    bool loadManifest(const std::string &sceneFile);
+    void saveManifest() const;
+
+    void addShaders(const std::vector<std::string> &programs);
+
+    // Queues everything in the manifest that wasn't queued yet on the loader pool, returns immediately
+    void beginPrefetch();
+    // Waits for the queued loads, picks up dependencies found in the loaded meshes
+    // and refreshes the cached manifest if it changed
+    void finishPrefetch();
+
+    // Builds the render objects on the GL thread so the first frame doesn't
+    void createRenderObjects();
+
     inline void load(const std::string &filename)
     {
+        this->filename = filename;
         loadSceneGraph(filename, root);
         extractUsedResources();
     }
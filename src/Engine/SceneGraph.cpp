@@ -1,5 +1,6 @@
 #include "SceneGraph.h"
 #include <Graphics/RenderObject.h>
+#include <Graphics/RenderQueue.h>
 #include "SkyboxNode.h"
 #include "BillboardNode.h"
 #include "LightNode.h"
@@ -261,21 +262,42 @@ void from_json(const json &j, const TransformablePtr &node)
 void Renderable::render(const std::shared_ptr<ShaderObject> &_shader)
 {
     // Render the mesh
-    auto shader = resolveShader(_shader);
+    const auto &shader = resolveShader(_shader);
     if (!renderObject)
         renderObject = RenderObject::GetRenderObject(render_name);
     if (enabled && visible)
         renderObject->render(shader, transform.globalTransform);
 }
+void Renderable::enqueue(RenderQueue &queue, const std::shared_ptr<ShaderObject> &_shader)
+{
+    const auto &shader = resolveShader(_shader);
+    if (!renderObject)
+        renderObject = RenderObject::GetRenderObject(render_name);
+    if (enabled && visible)
+        queue.pushObject(*renderObject, shader, transform.globalTransform);
+}
+bool Renderable::getWorldBounds(AABB &bounds)
+{
+    if (!renderObject)
+        renderObject = RenderObject::GetRenderObject(render_name);
+    bounds = renderObject->getBounds().transformed(transform.globalTransform);
+    return !bounds.isEmpty();
+}
 void Renderable::reset()
 {
     renderObject.reset();
 }
-const std::shared_ptr<ShaderObject> Renderable::resolveShader(const std::shared_ptr<ShaderObject> &shader) const
+const std::shared_ptr<ShaderObject> &Renderable::resolveShader(const std::shared_ptr<ShaderObject> &shader)
 {
     if (forced_shader < 0)
         return shader;
-    return Renderer::instance().getShader(forced_shader);
+    auto &renderer = Renderer::instance();
+    if (forced_shader != forcedShaderKey || !renderer.hasShader(forcedShaderHandle))
+    {
+        forcedShaderHandle = renderer.getShaderHandle(forced_shader);
+        forcedShaderKey = forced_shader;
+    }
+    return renderer.getShader(forcedShaderHandle);
 }
 void to_json(json &j, const RenderablePtr &node)
 {
@@ -315,14 +337,28 @@ void updateSceneGraph(const NodePtr &root)
     root->traverse([](Node *node)
                    { if (auto *cast = dynamic_cast<Transformable *>(node)) { cast->updateTransform(); } });
 }
+// Kept between calls so the packet and key storage is only grown, never reallocated per frame
+static RenderQueue SceneQueue;
+
 void renderSceneGraph(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader)
 {
-    root->traverse([&](Node *node)
-                   { if (auto *cast = dynamic_cast<Renderable *>(node)) { cast->render(shader); } });
+    renderSceneGraph(root, shader, false);
+}
+
+size_t renderSceneGraph(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum *frustum)
+{
+    SceneQueue.clear();
+    size_t count = SceneQueue.collect(root, shader, ignore_forced_shaders, frustum);
+    SceneQueue.sort();
+    SceneQueue.submit();
+    return count;
 }
 
-void renderSceneGraph(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders)
+size_t renderSceneGraph(const SpatialIndex &index, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum &frustum)
 {
-    root->traverse([&](Node *node)
-                   { if (auto *cast = dynamic_cast<Renderable *>(node)) { if (ignore_forced_shaders && cast->forced_shader != -1) return; cast->render(shader); } });
+    SceneQueue.clear();
+    size_t count = SceneQueue.collect(index, shader, ignore_forced_shaders, frustum);
+    SceneQueue.sort();
+    SceneQueue.submit();
+    return count;
 }
\ No newline at end of file
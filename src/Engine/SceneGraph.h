@@ -10,6 +10,7 @@
 
 #include "Transform.h"
 #include <Graphics/ShaderObject.h>
+#include <SlotArray.h>
 
 typedef std::shared_ptr<class Node> NodePtr;
 typedef std::shared_ptr<class Transformable> TransformablePtr;
@@ -84,6 +85,10 @@ void to_json(nlohmann::json &j, const Transformable *node);
 void from_json(const nlohmann::json &j, const TransformablePtr &node);
 
 class RenderObject;
+class RenderQueue;
+class Frustum;
+class SpatialIndex;
+struct AABB;
 
 class Renderable : public Transformable
 {
@@ -96,11 +101,20 @@ public:
         : Transformable(name), render_name(""), visible(true), forced_shader(-1) {}
 
     virtual void render(const std::shared_ptr<ShaderObject> &shader);
+    // Adds the node's draws to the queue instead of drawing right away, render is what nodes without mesh groups fall back to
+    virtual void enqueue(RenderQueue &queue, const std::shared_ptr<ShaderObject> &shader);
+    // World space box around what render draws, false if the node can't say and is never culled
+    virtual bool getWorldBounds(AABB &bounds);
     virtual void reset();
 
 protected:
     std::shared_ptr<RenderObject> renderObject;
-    const std::shared_ptr<ShaderObject> resolveShader(const std::shared_ptr<ShaderObject> &shader) const;
+    const std::shared_ptr<ShaderObject> &resolveShader(const std::shared_ptr<ShaderObject> &shader);
+
+private:
+    // forced_shader interned to a renderer handle, redone when the key changes or the shader is reloaded
+    int forcedShaderKey = -1;
+    Handle<ShaderObject> forcedShaderHandle;
 };
 void to_json(nlohmann::json &j, const RenderablePtr &node);
 void to_json(nlohmann::json &j, const Renderable *node);
@@ -134,4 +148,7 @@ inline void deleteNode(NodePtr &node)
 
 void updateSceneGraph(const NodePtr &root);
 void renderSceneGraph(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader);
-void renderSceneGraph(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders);
\ No newline at end of file
+// Renderables outside frustum are skipped, null draws everything. Both return how many Renderables were drawn
+size_t renderSceneGraph(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum *frustum = nullptr);
+// The nodes of an up to date index that are in frustum, without walking the graph
+size_t renderSceneGraph(const SpatialIndex &index, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum &frustum);
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "SkyboxNode.h"
+#include <Graphics/GLState.h>
+#include <Graphics/RenderQueue.h>
 
 void to_json(nlohmann::json &j, const std::shared_ptr<SkyboxNode> &node)
 {
@@ -29,6 +31,8 @@ void SkyboxNode::setCubemap(const std::string &cubemapDir, const std::string &ex
     cubeMap = std::make_shared<CubemapObject>(cubemapDir, extension);
 }
 
+static const Uniform<int> CubemapUniform("cubemap");
+
 void SkyboxNode::render(const std::shared_ptr<ShaderObject> &_shader)
 {
     if (!enabled || !visible)
@@ -41,18 +45,24 @@ void SkyboxNode::render(const std::shared_ptr<ShaderObject> &_shader)
     }
     if (!SkyboxObject)
         SkyboxObject = RenderObject::GetRenderObject(SkyboxMesh);
-    auto shader = resolveShader(_shader);
+    const auto &shader = resolveShader(_shader);
     shader->use();
-    Renderer::instance().slotTexture(GL_TEXTURE_CUBE_MAP, cubeMap->getID(), shader, "cubemap");
-    glDepthMask(GL_FALSE);
-    glDepthFunc(GL_LEQUAL);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    Renderer::instance().slotTexture(GL_TEXTURE_CUBE_MAP, cubeMap->getID(), shader, CubemapUniform);
+    GLState::instance().depthMask(GL_FALSE);
+    GLState::instance().depthFunc(GL_LEQUAL);
+    GLState::instance().polygonMode(GL_FILL);
     SkyboxObject->renderRaw();
-    glDepthFunc(DEFAULT_DEPTH_FUNC);
-    glDepthMask(GL_TRUE);
+    GLState::instance().depthFunc(DEFAULT_DEPTH_FUNC);
+    GLState::instance().depthMask(GL_TRUE);
     Renderer::instance().resetTextureSlots();
 }
 
+void SkyboxNode::enqueue(RenderQueue &queue, const std::shared_ptr<ShaderObject> &shader)
+{
+    if (enabled && visible)
+        queue.pushNode(RenderPass::SKYBOX, this, shader, resolveShader(shader));
+}
+
 void SkyboxNode::reset()
 {
     cubeMap.reset();
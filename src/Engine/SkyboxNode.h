@@ -9,16 +9,19 @@ class SkyboxNode : public Renderable
 {
 private:
     std::shared_ptr<CubemapObject> cubeMap;
-    const std::string SkyboxMesh = "res/Models/skybox.obj";
     std::shared_ptr<RenderObject> SkyboxObject;
 
 public:
+    static inline const std::string SkyboxMesh = "res/Models/skybox.obj";
+
     SkyboxNode(const std::string &name = "Unnamed")
         : Renderable(name) { forced_shader = Renderer::instance().getSkyboxShaderIndex(); }
 
     void setCubemap(const std::array<std::string, 6> &sides);
     void setCubemap(const std::string &cubemapDir, const std::string &extension = "png");
     void render(const std::shared_ptr<ShaderObject> &shader) override;
+    void enqueue(RenderQueue &queue, const std::shared_ptr<ShaderObject> &shader) override;
+    bool getWorldBounds(AABB &) override { return false; }
     void reset() override;
 };
 void to_json(nlohmann::json &j, const std::shared_ptr<SkyboxNode> &node);
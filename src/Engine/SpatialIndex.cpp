@@ -0,0 +1,534 @@
+#include "SpatialIndex.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstdio>
+
+void StaticBVH::build(std::vector<SpatialItem> items)
+{
+    this->items = std::move(items);
+    nodes.clear();
+    if (this->items.empty())
+        return;
+    nodes.reserve(2 * this->items.size() / SPATIAL_INDEX_LEAF_SIZE + 1);
+    buildRange(0, this->items.size(), 0);
+}
+
+void StaticBVH::clear()
+{
+    nodes.clear();
+    items.clear();
+}
+
+void StaticBVH::buildRange(uint32_t begin, uint32_t end, int depth)
+{
+    uint32_t index = nodes.size();
+    nodes.push_back({});
+    AABB bounds, centers;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        bounds.expand(items[i].bounds);
+        centers.expand(items[i].bounds.getCenter());
+    }
+    nodes[index].bounds = bounds;
+
+    // The query stack holds one entry per level plus one, so depth is capped well below it
+    if (end - begin <= SPATIAL_INDEX_LEAF_SIZE || depth >= 48)
+    {
+        nodes[index].first = begin;
+        nodes[index].count = end - begin;
+        return;
+    }
+
+    // Median split on the longest axis of the centers, cheap to build and always balanced
+    glm::vec3 size = centers.max - centers.min;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end,
+                     [axis](const SpatialItem &a, const SpatialItem &b)
+                     { return a.bounds.getCenter()[axis] < b.bounds.getCenter()[axis]; });
+
+    buildRange(begin, middle, depth + 1);
+    nodes[index].first = nodes.size();
+    nodes[index].count = 0;
+    buildRange(middle, end, depth + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+int DynamicBVH::allocateNode()
+{
+    if (freeList == -1)
+    {
+        nodes.push_back({});
+        nodes.back().height = -1;
+        nodes.back().parent = -1;
+        freeList = nodes.size() - 1;
+    }
+    int index = freeList;
+    freeList = nodes[index].parent;
+    nodes[index] = {AABB(), {AABB(), nullptr}, -1, -1, -1, 0};
+    return index;
+}
+
+void DynamicBVH::releaseNode(int index)
+{
+    nodes[index].parent = freeList;
+    nodes[index].height = -1;
+    freeList = index;
+}
+
+int DynamicBVH::insert(const AABB &bounds, Renderable *node)
+{
+    int leaf = allocateNode();
+    nodes[leaf].bounds.min = bounds.min - glm::vec3(SPATIAL_INDEX_MARGIN);
+    nodes[leaf].bounds.max = bounds.max + glm::vec3(SPATIAL_INDEX_MARGIN);
+    nodes[leaf].item = {bounds, node};
+    insertLeaf(leaf);
+    leafCount++;
+    return leaf;
+}
+
+void DynamicBVH::remove(int proxy)
+{
+    removeLeaf(proxy);
+    releaseNode(proxy);
+    leafCount--;
+}
+
+bool DynamicBVH::move(int proxy, const AABB &bounds)
+{
+    nodes[proxy].item.bounds = bounds;
+    if (nodes[proxy].bounds.contains(bounds))
+        return false;
+    removeLeaf(proxy);
+    nodes[proxy].bounds.min = bounds.min - glm::vec3(SPATIAL_INDEX_MARGIN);
+    nodes[proxy].bounds.max = bounds.max + glm::vec3(SPATIAL_INDEX_MARGIN);
+    insertLeaf(proxy);
+    return true;
+}
+
+void DynamicBVH::clear()
+{
+    nodes.clear();
+    root = freeList = -1;
+    leafCount = 0;
+}
+
+void DynamicBVH::insertLeaf(int leaf)
+{
+    if (root == -1)
+    {
+        root = leaf;
+        nodes[root].parent = -1;
+        return;
+    }
+
+    // Copied, allocating the new parent can move the nodes
+    const AABB leafBounds = nodes[leaf].bounds;
+    // Walk down to the sibling where the leaf costs the least surface area, counting what it adds to every ancestor
+    int index = root;
+    while (!nodes[index].isLeaf())
+    {
+        const TreeNode &node = nodes[index];
+        AABB combined = node.bounds;
+        combined.expand(leafBounds);
+        float area = node.bounds.getSurfaceArea();
+        float combinedArea = combined.getSurfaceArea();
+        // Making a new parent for this node and the leaf
+        float cost = 2.f * combinedArea;
+        float inheritance = 2.f * (combinedArea - area);
+
+        auto descendCost = [&](int child)
+        {
+            AABB box = nodes[child].bounds;
+            box.expand(leafBounds);
+            if (nodes[child].isLeaf())
+                return box.getSurfaceArea() + inheritance;
+            return box.getSurfaceArea() - nodes[child].bounds.getSurfaceArea() + inheritance;
+        };
+        float leftCost = descendCost(node.left);
+        float rightCost = descendCost(node.right);
+        if (cost < leftCost && cost < rightCost)
+            break;
+        index = leftCost < rightCost ? node.left : node.right;
+    }
+
+    int sibling = index;
+    int oldParent = nodes[sibling].parent;
+    int newParent = allocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].bounds = nodes[sibling].bounds;
+    nodes[newParent].bounds.expand(leafBounds);
+    nodes[newParent].height = nodes[sibling].height + 1;
+    nodes[newParent].left = sibling;
+    nodes[newParent].right = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+    if (oldParent == -1)
+        root = newParent;
+    else if (nodes[oldParent].left == sibling)
+        nodes[oldParent].left = newParent;
+    else
+        nodes[oldParent].right = newParent;
+
+    refitFrom(nodes[leaf].parent);
+}
+
+void DynamicBVH::removeLeaf(int leaf)
+{
+    if (leaf == root)
+    {
+        root = -1;
+        return;
+    }
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+    // The sibling takes the parent's place
+    if (grandParent == -1)
+    {
+        root = sibling;
+        nodes[sibling].parent = -1;
+    }
+    else
+    {
+        if (nodes[grandParent].left == parent)
+            nodes[grandParent].left = sibling;
+        else
+            nodes[grandParent].right = sibling;
+        nodes[sibling].parent = grandParent;
+        refitFrom(grandParent);
+    }
+    releaseNode(parent);
+}
+
+void DynamicBVH::refitFrom(int index)
+{
+    while (index != -1)
+    {
+        index = balance(index);
+        TreeNode &node = nodes[index];
+        node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+        node.bounds = nodes[node.left].bounds;
+        node.bounds.expand(nodes[node.right].bounds);
+        index = node.parent;
+    }
+}
+
+// Rotates the taller child up if the children differ in height by more than one, returns the node now in index's place
+int DynamicBVH::balance(int a)
+{
+    TreeNode &A = nodes[a];
+    if (A.isLeaf() || A.height < 2)
+        return a;
+
+    int b = A.left, c = A.right;
+    int difference = nodes[c].height - nodes[b].height;
+    if (difference >= -1 && difference <= 1)
+        return a;
+
+    // Promote the taller child, which always has children at this height
+    bool promoteRight = difference > 1;
+    int up = promoteRight ? c : b;
+    int other = promoteRight ? b : c;
+    int f = nodes[up].left, g = nodes[up].right;
+
+    // up replaces a under a's parent
+    nodes[up].left = a;
+    nodes[up].parent = A.parent;
+    A.parent = up;
+    if (nodes[up].parent == -1)
+        root = up;
+    else if (nodes[nodes[up].parent].left == a)
+        nodes[nodes[up].parent].left = up;
+    else
+        nodes[nodes[up].parent].right = up;
+
+    // The taller grandchild stays with up, the shorter one moves down to a
+    int keep = nodes[f].height > nodes[g].height ? f : g;
+    int give = keep == f ? g : f;
+    nodes[up].right = keep;
+    if (promoteRight)
+        A.right = give;
+    else
+        A.left = give;
+    nodes[give].parent = a;
+
+    A.bounds = nodes[other].bounds;
+    A.bounds.expand(nodes[give].bounds);
+    A.height = 1 + std::max(nodes[other].height, nodes[give].height);
+    nodes[up].bounds = A.bounds;
+    nodes[up].bounds.expand(nodes[keep].bounds);
+    nodes[up].height = 1 + std::max(A.height, nodes[keep].height);
+    return up;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+void SpatialIndex::update(const NodePtr &root)
+{
+    updateCount++;
+    stats.reinsertions = 0;
+    unbounded.clear();
+    changes.clear();
+
+    AABB bounds;
+    root->traverse([&](Node *node)
+                   {
+        auto *renderable = dynamic_cast<Renderable *>(node);
+        if (!renderable)
+            return;
+        bool hasBounds = renderable->getWorldBounds(bounds);
+        bool drawn = renderable->enabled && renderable->visible;
+        auto it = entries.find(renderable);
+        if (it != entries.end() && (!hasBounds || it->second.isStatic != renderable->is_static || (it->second.proxy == -1 && !it->second.isStatic)))
+        {
+            // Changed kind, it goes back in as new
+            if (!it->second.bounds.isEmpty())
+                changes.push_back(it->second.bounds);
+            removeEntry(it->second);
+            entries.erase(it);
+            it = entries.end();
+        }
+        if (!hasBounds)
+        {
+            unbounded.push_back(renderable);
+            entries[renderable] = {AABB(), -1, false, drawn, updateCount};
+            return;
+        }
+
+        if (it == entries.end())
+        {
+            Entry entry = {bounds, -1, renderable->is_static, drawn, updateCount};
+            if (entry.isStatic)
+                staticDirty = true;
+            else
+                entry.proxy = dynamicTree.insert(bounds, renderable);
+            entries[renderable] = entry;
+            changes.push_back(bounds);
+            return;
+        }
+        Entry &entry = it->second;
+        entry.seen = updateCount;
+        if (entry.drawn != drawn)
+        {
+            entry.drawn = drawn;
+            changes.push_back(bounds);
+        }
+        if (entry.bounds.min == bounds.min && entry.bounds.max == bounds.max)
+            return;
+        changes.push_back(entry.bounds);
+        changes.push_back(bounds);
+        entry.bounds = bounds;
+        // is_static only freezes the local transform, a static node still moves with its parent. Rare enough that
+        // rebuilding the static tree is fine
+        if (entry.isStatic)
+            staticDirty = true;
+        else if (dynamicTree.move(entry.proxy, bounds))
+            stats.reinsertions++; });
+
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (it->second.seen != updateCount)
+        {
+            if (!it->second.bounds.isEmpty())
+                changes.push_back(it->second.bounds);
+            removeEntry(it->second);
+            it = entries.erase(it);
+        }
+        else
+            it++;
+    }
+
+    if (staticDirty)
+    {
+        std::vector<SpatialItem> items;
+        for (const auto &kvp : entries)
+            if (kvp.second.isStatic)
+                items.push_back({kvp.second.bounds, kvp.first});
+        staticTree.build(std::move(items));
+        staticDirty = false;
+        stats.staticRebuilds++;
+    }
+
+    stats.staticNodes = staticTree.size();
+    stats.dynamicNodes = dynamicTree.size();
+    stats.unboundedNodes = unbounded.size();
+}
+
+void SpatialIndex::removeEntry(Entry &entry)
+{
+    if (entry.isStatic)
+        staticDirty = true;
+    else if (entry.proxy != -1)
+        dynamicTree.remove(entry.proxy);
+    entry.proxy = -1;
+}
+
+void SpatialIndex::clear()
+{
+    entries.clear();
+    staticTree.clear();
+    dynamicTree.clear();
+    unbounded.clear();
+    changes.clear();
+    staticDirty = false;
+}
+
+void SpatialIndex::queryFrustum(const Frustum &frustum, const std::function<void(Renderable *)> &visit) const
+{
+    query([&](const AABB &box)
+          { return frustum.intersects(box); },
+          visit);
+}
+
+void SpatialIndex::querySphere(const glm::vec3 &center, float radius, const std::function<void(Renderable *)> &visit) const
+{
+    query([&](const AABB &box)
+          { return box.overlaps(center, radius); },
+          visit);
+}
+
+void SpatialIndex::queryAABB(const AABB &bounds, const std::function<void(Renderable *)> &visit) const
+{
+    query([&](const AABB &box)
+          { return box.overlaps(bounds); },
+          visit);
+}
+
+void SpatialIndex::queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, const std::function<void(Renderable *, float)> &visit) const
+{
+    glm::vec3 inverseDirection = 1.f / direction;
+    float distance;
+    auto overlaps = [&](const AABB &box)
+    { return box.intersectsRay(origin, inverseDirection, maxDistance, distance); };
+    // distance is left by the overlaps call on the item's own box, the last one before visit
+    auto forward = [&](const SpatialItem &item)
+    { visit(item.node, distance); };
+    staticTree.query(overlaps, forward);
+    dynamicTree.query(overlaps, forward);
+}
+
+Renderable *SpatialIndex::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, float *distance) const
+{
+    Renderable *closest = nullptr;
+    float closestDistance = maxDistance;
+    queryRay(origin, direction, maxDistance, [&](Renderable *node, float hit)
+             {
+        if (hit <= closestDistance)
+        {
+            closest = node;
+            closestDistance = hit;
+        } });
+    if (closest && distance)
+        *distance = closestDistance;
+    return closest;
+}
+
+#ifdef DEBUG
+void SpatialIndex::DebugBenchmark(size_t nodeCount, size_t queryCount)
+{
+    std::mt19937 random(1234);
+    const float worldSize = 1000.f;
+    std::uniform_real_distribution<float> position(-worldSize / 2, worldSize / 2);
+    std::uniform_real_distribution<float> size(0.5f, 4.f);
+    std::uniform_real_distribution<float> step(-1.f, 1.f);
+
+    std::vector<SpatialItem> items(nodeCount);
+    for (auto &item : items)
+    {
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extents(size(random), size(random), size(random));
+        item.bounds.min = center - extents;
+        item.bounds.max = center + extents;
+        item.node = nullptr;
+    }
+
+    using Clock = std::chrono::high_resolution_clock;
+    auto milliseconds = [](Clock::time_point start)
+    { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+    auto start = Clock::now();
+    StaticBVH staticTree;
+    staticTree.build(items);
+    double staticBuild = milliseconds(start);
+
+    start = Clock::now();
+    DynamicBVH dynamicTree;
+    std::vector<int> proxies;
+    for (const auto &item : items)
+        proxies.push_back(dynamicTree.insert(item.bounds, nullptr));
+    double dynamicBuild = milliseconds(start);
+
+    // A frame of every box drifting a little, most stay inside their grown box
+    start = Clock::now();
+    size_t reinsertions = 0;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        glm::vec3 offset = glm::vec3(step(random), step(random), step(random)) * 0.1f;
+        items[i].bounds.min += offset;
+        items[i].bounds.max += offset;
+        reinsertions += dynamicTree.move(proxies[i], items[i].bounds);
+    }
+    double refit = milliseconds(start);
+    printf("Spatial index over %zu boxes: static build %.2f ms, dynamic build %.2f ms (height %i), refit %.2f ms (%zu reinserted)\n",
+           nodeCount, staticBuild, dynamicBuild, dynamicTree.getHeight(), refit, reinsertions);
+    staticTree.build(items);
+
+    // Same queries through both trees and a linear scan, the hit counts should agree
+    auto run = [&](const char *name, auto makeOverlaps)
+    {
+        size_t staticHits = 0, dynamicHits = 0, linearHits = 0;
+        double staticTime = 0, dynamicTime = 0, linearTime = 0;
+        std::mt19937 queries(42);
+        for (size_t q = 0; q < queryCount; q++)
+        {
+            auto overlaps = makeOverlaps(queries);
+            auto queryStart = Clock::now();
+            staticTree.query(overlaps, [&](const SpatialItem &)
+                             { staticHits++; });
+            staticTime += milliseconds(queryStart);
+            queryStart = Clock::now();
+            dynamicTree.query(overlaps, [&](const SpatialItem &)
+                              { dynamicHits++; });
+            dynamicTime += milliseconds(queryStart);
+            queryStart = Clock::now();
+            for (const auto &item : items)
+                linearHits += overlaps(item.bounds);
+            linearTime += milliseconds(queryStart);
+        }
+        printf("  %-8s static %.4f ms, dynamic %.4f ms, linear %.4f ms per query (%zu / %zu / %zu hits)\n", name,
+               staticTime / queryCount, dynamicTime / queryCount, linearTime / queryCount, staticHits, dynamicHits, linearHits);
+    };
+
+    run("frustum", [&](std::mt19937 &queries)
+        {
+        glm::vec3 eye(position(queries), position(queries), position(queries));
+        glm::vec3 target(position(queries), position(queries), position(queries));
+        Frustum frustum(glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 100.f) * glm::lookAt(eye, target, glm::vec3(0.f, 1.f, 0.f)));
+        return [frustum](const AABB &box)
+        { return frustum.intersects(box); }; });
+    run("sphere", [&](std::mt19937 &queries)
+        {
+        glm::vec3 center(position(queries), position(queries), position(queries));
+        return [center](const AABB &box)
+        { return box.overlaps(center, 25.f); }; });
+    run("aabb", [&](std::mt19937 &queries)
+        {
+        AABB bounds;
+        bounds.expand(glm::vec3(position(queries), position(queries), position(queries)));
+        bounds.expand(bounds.min + glm::vec3(40.f));
+        return [bounds](const AABB &box)
+        { return box.overlaps(bounds); }; });
+    run("ray", [&](std::mt19937 &queries)
+        {
+        glm::vec3 origin(position(queries), position(queries), position(queries));
+        glm::vec3 direction = glm::normalize(glm::vec3(step(queries), step(queries), step(queries)));
+        glm::vec3 inverseDirection = 1.f / direction;
+        return [origin, inverseDirection](const AABB &box)
+        { float distance; return box.intersectsRay(origin, inverseDirection, 500.f, distance); }; });
+}
+#endif
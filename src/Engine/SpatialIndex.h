@@ -0,0 +1,208 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+#include <Engine/SceneGraph.h>
+#include <Graphics/Frustum.h>
+
+// Dynamic boxes are grown by this much, a node only goes back into the tree once it leaves the grown box
+constexpr float SPATIAL_INDEX_MARGIN = 0.25f;
+// Most items in a leaf of the static tree
+constexpr uint32_t SPATIAL_INDEX_LEAF_SIZE = 4;
+
+struct SpatialItem
+{
+    AABB bounds;
+    Renderable *node;
+};
+
+// Built once over a fixed set of boxes. Nodes are laid out depth first in one array,
+// the left child of an inner node is the one after it
+class StaticBVH
+{
+public:
+    void build(std::vector<SpatialItem> items);
+    void clear();
+    size_t size() const { return items.size(); }
+
+    // Visits every item whose box passes overlaps, subtrees whose box fails it are skipped
+    template <typename Overlaps, typename Visit>
+    void query(const Overlaps &overlaps, const Visit &visit) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BVHNode &node = nodes[stack[--top]];
+            if (!overlaps(node.bounds))
+                continue;
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                    if (overlaps(items[i].bounds))
+                        visit(items[i]);
+                continue;
+            }
+            uint32_t index = (uint32_t)(&node - nodes.data());
+            stack[top++] = node.first;
+            stack[top++] = index + 1;
+        }
+    }
+
+private:
+    struct BVHNode
+    {
+        AABB bounds;
+        uint32_t first; // First item for leaves, the right child for inner nodes
+        uint32_t count; // 0 for inner nodes
+    };
+
+    std::vector<BVHNode> nodes;
+    std::vector<SpatialItem> items;
+
+    void buildRange(uint32_t begin, uint32_t end, int depth);
+};
+
+// Incrementally updated tree of grown boxes. Leaves are inserted where they add the least surface area
+// and rotations keep it balanced, a moved leaf is refit by removing and inserting it again
+class DynamicBVH
+{
+public:
+    // Returns the proxy that names the leaf in move and remove
+    int insert(const AABB &bounds, Renderable *node);
+    void remove(int proxy);
+    // True if the leaf had to be reinserted, false if bounds still fit its grown box and only the item was updated
+    bool move(int proxy, const AABB &bounds);
+    void clear();
+    size_t size() const { return leafCount; }
+    int getHeight() const { return root == -1 ? 0 : nodes[root].height; }
+
+    template <typename Overlaps, typename Visit>
+    void query(const Overlaps &overlaps, const Visit &visit) const
+    {
+        if (root == -1)
+            return;
+        std::vector<int> &stack = queryStack;
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            const TreeNode &node = nodes[stack.back()];
+            stack.pop_back();
+            if (!overlaps(node.bounds))
+                continue;
+            if (node.isLeaf())
+            {
+                // The grown box only steers the walk, hits are decided on the real one
+                if (overlaps(node.item.bounds))
+                    visit(node.item);
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+private:
+    struct TreeNode
+    {
+        AABB bounds;      // Grown by SPATIAL_INDEX_MARGIN for leaves
+        SpatialItem item; // Leaves only
+        int parent;       // Next free node while on the free list
+        int left, right;
+        int height;       // 0 for leaves, -1 while free
+
+        bool isLeaf() const { return left == -1; }
+    };
+
+    std::vector<TreeNode> nodes;
+    int root = -1;
+    int freeList = -1;
+    size_t leafCount = 0;
+    mutable std::vector<int> queryStack;
+
+    int allocateNode();
+    void releaseNode(int index);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    int balance(int index);
+    void refitFrom(int index);
+};
+
+struct SpatialIndexStats
+{
+    size_t staticNodes;
+    size_t dynamicNodes;
+    size_t unboundedNodes;
+    size_t reinsertions; // Dynamic nodes that left their grown box since the last update
+    size_t staticRebuilds;
+};
+
+// Renderables of a scene graph by their world bounds. Static nodes go in a StaticBVH that is rebuilt
+// when the set of static nodes changes or one moves with its parent, everything else in a DynamicBVH. Nodes without bounds are kept
+// in a list and returned by every query. update keeps it in step with the graph
+class SpatialIndex
+{
+public:
+    // Inserts new Renderables under root, refits moved ones and drops the ones no longer in the graph
+    void update(const NodePtr &root);
+    void clear();
+
+    void queryFrustum(const Frustum &frustum, const std::function<void(Renderable *)> &visit) const;
+    void querySphere(const glm::vec3 &center, float radius, const std::function<void(Renderable *)> &visit) const;
+    void queryAABB(const AABB &bounds, const std::function<void(Renderable *)> &visit) const;
+    // Every node whose box the ray enters within maxDistance, with the distance it enters at
+    void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, const std::function<void(Renderable *, float)> &visit) const;
+    // Closest of queryRay by box, null if the ray hits nothing
+    Renderable *raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, float *distance = nullptr) const;
+
+    const std::vector<Renderable *> &getUnbounded() const { return unbounded; }
+    // World boxes where something changed in the last update: the old and new bounds of moved nodes,
+    // and the bounds of nodes that were added, removed, enabled or hidden. Cached shadow maps test against these
+    const std::vector<AABB> &getChanges() const { return changes; }
+    const SpatialIndexStats &getStats() const { return stats; }
+
+#ifdef DEBUG
+    // Random boxes in both trees, queries timed against a linear scan over the same boxes
+    static void DebugBenchmark(size_t nodeCount = 100000, size_t queryCount = 1000);
+#endif
+
+private:
+    struct Entry
+    {
+        AABB bounds;   // Exact world bounds as of the last update
+        int proxy;     // Into dynamic, -1 for static and unbounded nodes
+        bool isStatic;
+        bool drawn;    // Enabled and visible
+        uint32_t seen; // updateCount of the last update that found the node
+    };
+
+    std::unordered_map<Renderable *, Entry> entries;
+    StaticBVH staticTree;
+    DynamicBVH dynamicTree;
+    std::vector<Renderable *> unbounded;
+    std::vector<AABB> changes;
+    bool staticDirty = false;
+    uint32_t updateCount = 0;
+    SpatialIndexStats stats = {};
+
+    template <typename Overlaps>
+    void query(const Overlaps &overlaps, const std::function<void(Renderable *)> &visit) const
+    {
+        auto forward = [&](const SpatialItem &item)
+        { visit(item.node); };
+        staticTree.query(overlaps, forward);
+        dynamicTree.query(overlaps, forward);
+        for (auto *node : unbounded)
+            visit(node);
+    }
+    void removeEntry(Entry &entry);
+};
@@ -1,4 +1,5 @@
 #include <Graphics/CubemapObject.h>
+#include <Graphics/GLState.h>
 #include <iostream>
 #include <stb/stb_image.h>
 #include "CubemapObject.h"
@@ -23,7 +24,7 @@ void CubemapObject::generateCubemap(unsigned char *data[6], int width, int heigh
 {
     // Generate a new cube map
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    GLState::instance().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
     // Set the texture parameters
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -42,7 +43,7 @@ void CubemapObject::generateCubemap(unsigned char *data[6], int width, int heigh
     }
 
     // Unbind the cube map
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    GLState::instance().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
 CubemapObject::CubemapObject(const std::array<std::string, 6> &filePaths)
@@ -64,7 +65,7 @@ CubemapObject::CubemapObject(const std::string &cubemapDir, const std::string &e
 }
 CubemapObject::~CubemapObject()
 {
-    glDeleteTextures(1, &textureID);
+    GLState::instance().deleteTexture(textureID);
 }
 
 void CubemapObject::bind() const
@@ -1,16 +1,17 @@
 #include "FramebufferObject.h"
+#include <Graphics/GLState.h>
 #include <iostream>
 #include "Renderer.h"
 
 FramebufferObject::FramebufferObject(int width, int height, bool overrideTexture, GLuint format, GLuint attachment)
 {
     glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, fbo);
 
     if (!overrideTexture)
     {
         glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        GLState::instance().bindTexture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -29,13 +30,13 @@ FramebufferObject::FramebufferObject(int width, int height, bool overrideTexture
         std::cerr << "Framebuffer is not complete!" << std::endl;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 FramebufferObject::FramebufferObject(int width, int height, GLuint texture, GLuint textureType, GLuint format, GLuint attachment)
 {
     glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, fbo);
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, textureType, texture, 0);
 
@@ -44,24 +45,24 @@ FramebufferObject::FramebufferObject(int width, int height, GLuint texture, GLui
         std::cerr << "Framebuffer is not complete!" << std::endl;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 FramebufferObject::~FramebufferObject()
 {
-    glDeleteFramebuffers(1, &fbo);
-    glDeleteTextures(1, &texture);
+    GLState::instance().deleteFramebuffer(fbo);
+    GLState::instance().deleteTexture(texture);
     // glDeleteRenderbuffers(1, &rbo);
 }
 
 void FramebufferObject::bind() const
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, fbo);
 }
 
 void FramebufferObject::unbind() const
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void FramebufferObject::bindTexture() const
@@ -72,6 +73,6 @@ void FramebufferObject::bindTexture() const
 void FramebufferObject::setTexture(GLuint id, GLuint type, GLuint attachement)
 {
     texture = id;
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, fbo);
     glFramebufferTexture2D(GL_FRAMEBUFFER, attachement, type, texture, 0);
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include <Graphics/Frustum.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_AVX 1
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+AABB AABB::transformed(const glm::mat4 &transformation) const
+{
+    if (isEmpty())
+        return *this;
+    // Each world axis gets the extents projected onto it through the absolute matrix
+    glm::vec3 center = glm::vec3(transformation * glm::vec4(getCenter(), 1.f));
+    glm::mat3 absolute = glm::mat3(transformation);
+    for (int i = 0; i < 3; i++)
+        absolute[i] = glm::abs(absolute[i]);
+    glm::vec3 extents = absolute * getExtents();
+    AABB result;
+    result.min = center - extents;
+    result.max = center + extents;
+    return result;
+}
+
+bool AABB::intersectsRay(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, float &distance) const
+{
+    // Slab test, the ray is inside the box where it is inside all three slabs
+    glm::vec3 t0 = (min - origin) * inverseDirection;
+    glm::vec3 t1 = (max - origin) * inverseDirection;
+    glm::vec3 entries = glm::min(t0, t1), exits = glm::max(t0, t1);
+    float enter = glm::max(glm::max(entries.x, entries.y), glm::max(entries.z, 0.f));
+    float exit = glm::min(glm::min(exits.x, exits.y), glm::min(exits.z, maxDistance));
+    if (enter > exit)
+        return false;
+    distance = enter;
+    return true;
+}
+
+void AABBList::clear()
+{
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+}
+
+void AABBList::push(const AABB &box)
+{
+    glm::vec3 center = box.getCenter(), extents = box.getExtents();
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    extentX.push_back(extents.x);
+    extentY.push_back(extents.y);
+    extentZ.push_back(extents.z);
+}
+
+Frustum::Frustum(const glm::mat4 &viewProjection)
+{
+    // Rows of the matrix, glm stores columns
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    planes[LEFT] = rows[3] + rows[0];
+    planes[RIGHT] = rows[3] - rows[0];
+    planes[BOTTOM] = rows[3] + rows[1];
+    planes[TOP] = rows[3] - rows[1];
+    planes[NEAR_PLANE] = rows[3] + rows[2];
+    planes[FAR_PLANE] = rows[3] - rows[2];
+    for (auto &plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+}
+
+void Frustum::clampFar(const glm::vec3 &origin, float distance)
+{
+    // The far plane faces back towards origin, its distance from origin along that normal is dot + w
+    glm::vec4 &plane = planes[FAR_PLANE];
+    float offset = glm::dot(glm::vec3(plane), origin);
+    if (distance < offset + plane.w)
+        plane.w = distance - offset;
+}
+
+bool Frustum::intersects(const AABB &box) const
+{
+    glm::vec3 center = box.getCenter(), extents = box.getExtents();
+    for (const auto &plane : planes)
+    {
+        glm::vec3 normal = glm::vec3(plane);
+        // Distance of the box corner furthest along the normal
+        if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extents) + plane.w < 0.f)
+            return false;
+    }
+    return true;
+}
+
+bool Frustum::intersects(const glm::vec3 &center, float radius) const
+{
+    for (const auto &plane : planes)
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+            return false;
+    return true;
+}
+
+size_t Frustum::cull(const AABBList &boxes, std::vector<uint8_t> &visible) const
+{
+    const size_t count = boxes.size();
+    visible.resize(count);
+    size_t visibleCount = 0;
+    size_t i = 0;
+
+#if FRUSTUM_AVX
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]), cy = _mm256_loadu_ps(&boxes.centerY[i]), cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]), ey = _mm256_loadu_ps(&boxes.extentY[i]), ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const auto &plane : planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+                                            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(glm::abs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(glm::abs(plane.y)), ey)),
+                                          _mm256_mul_ps(_mm256_set1_ps(glm::abs(plane.z)), ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int j = 0; j < 8; j++)
+        {
+            visible[i + j] = (mask >> j) & 1;
+            visibleCount += visible[i + j];
+        }
+    }
+#elif FRUSTUM_SSE
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&boxes.centerX[i]), cy = _mm_loadu_ps(&boxes.centerY[i]), cz = _mm_loadu_ps(&boxes.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&boxes.extentX[i]), ey = _mm_loadu_ps(&boxes.extentY[i]), ez = _mm_loadu_ps(&boxes.extentZ[i]);
+        __m128 inside = _mm_cmpeq_ps(cx, cx); // All ones unless the center is NaN
+        for (const auto &plane : planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(glm::abs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(glm::abs(plane.y)), ey)),
+                                       _mm_mul_ps(_mm_set1_ps(glm::abs(plane.z)), ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int j = 0; j < 4; j++)
+        {
+            visible[i + j] = (mask >> j) & 1;
+            visibleCount += visible[i + j];
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+        glm::vec3 extents(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+        bool inside = true;
+        for (const auto &plane : planes)
+            inside = inside && glm::dot(glm::vec3(plane), center) + glm::dot(glm::abs(glm::vec3(plane)), extents) + plane.w >= 0.f;
+        visible[i] = inside;
+        visibleCount += inside;
+    }
+    return visibleCount;
+}
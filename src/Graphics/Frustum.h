@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+
+struct AABB
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool isEmpty() const { return min.x > max.x; }
+    glm::vec3 getCenter() const { return (min + max) * 0.5f; }
+    glm::vec3 getExtents() const { return (max - min) * 0.5f; }
+
+    void expand(const glm::vec3 &point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    void expand(const AABB &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+    bool contains(const AABB &other) const { return glm::all(glm::lessThanEqual(min, other.min)) && glm::all(glm::greaterThanEqual(max, other.max)); }
+    bool overlaps(const AABB &other) const { return glm::all(glm::lessThanEqual(min, other.max)) && glm::all(glm::greaterThanEqual(max, other.min)); }
+    bool overlaps(const glm::vec3 &center, float radius) const
+    {
+        glm::vec3 offset = center - glm::clamp(center, min, max);
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+    // Distance along the ray where it enters the box, 0 if it starts inside. inverseDirection is 1 / direction
+    bool intersectsRay(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, float &distance) const;
+    float getSurfaceArea() const
+    {
+        glm::vec3 size = max - min;
+        return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+    // Box around this one after transformation, loose for rotations but never smaller
+    AABB transformed(const glm::mat4 &transformation) const;
+};
+
+// Boxes as separate center and extent arrays, so the culling kernel loads four or eight of a component at once
+struct AABBList
+{
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    void clear();
+    void push(const AABB &box);
+    size_t size() const { return centerX.size(); }
+};
+
+// Planes point inwards, a point is inside when dot(plane, vec4(point, 1)) >= 0 for all six
+class Frustum
+{
+public:
+    enum Plane
+    {
+        LEFT,
+        RIGHT,
+        BOTTOM,
+        TOP,
+        NEAR_PLANE, // NEAR and FAR are macros on Windows
+        FAR_PLANE,
+        PLANE_COUNT
+    };
+    glm::vec4 planes[PLANE_COUNT];
+
+    Frustum() = default;
+    // From a projection * view matrix, the planes come out in world space
+    explicit Frustum(const glm::mat4 &viewProjection);
+
+    // Pulls the far plane in to distance from origin if that is closer, for lights whose reach ends before their projection does
+    void clampFar(const glm::vec3 &origin, float distance);
+
+    bool intersects(const AABB &box) const;
+    bool intersects(const glm::vec3 &center, float radius) const;
+
+    // visible[i] is set to 1 for every box that touches the frustum and 0 otherwise, returns how many do.
+    // Tests four boxes per step with SSE, eight with AVX, and falls back to scalar code without either
+    size_t cull(const AABBList &boxes, std::vector<uint8_t> &visible) const;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <GLAD/glad.h>
+#include <Graphics/GLDebug.h>
 #include <string>
 
 void GLClearError();
@@ -9,10 +10,12 @@ bool GLLogCall(const char *function, const char *file, int line);
 #define ASSERT(x) \
     if (!(x))     \
         throw;
+// Release builds never check, debug builds get errors through KHR_debug where the context has it
 #if DEBUG
-#define GLCall(x)   \
-    GLClearError(); \
-    x;              \
+#define GLCall(x)                              \
+    GLClearError();                            \
+    setGLCallSite(#x, __FILE__, __LINE__);     \
+    x;                                         \
     ASSERT(GLLogCall(#x, __FILE__, __LINE__))
 #else
 #define GLCall(x) x;
@@ -20,11 +23,22 @@ bool GLLogCall(const char *function, const char *file, int line);
 
 inline void GLClearError()
 {
+    if (isGLDebugOutputEnabled())
+    {
+        takeGLDebugError();
+        return;
+    }
     while (glGetError() != GL_NO_ERROR)
         ;
 };
 inline bool GLLogCall(const char *function, const char *file, int line)
 {
+    // The callback already printed the message with the call site
+    if (isGLDebugOutputEnabled())
+    {
+        setGLCallSite(nullptr, nullptr, 0);
+        return !takeGLDebugError();
+    }
     while (GLenum error = glGetError())
     {
         std::string error_name = "";
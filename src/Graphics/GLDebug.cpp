@@ -0,0 +1,132 @@
+#include <Graphics/GLDebug.h>
+#include <Graphics/GLExtensions.h>
+#include <Graphics/GLState.h>
+#include <cstdio>
+#include <atomic>
+
+struct GLCallSite
+{
+    const char *function;
+    const char *file;
+    int line;
+};
+
+static bool DebugOutputEnabled = false;
+static bool DebugOutputSynchronous = false;
+// Asynchronous output calls back from a driver thread
+static std::atomic<bool> DebugErrorReported(false);
+static GLCallSite CurrentCallSite = {nullptr, nullptr, 0};
+
+static const char *getSourceName(GLenum source)
+{
+    switch (source)
+    {
+    case GL_DEBUG_SOURCE_API:
+        return "API";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+        return "Window System";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER:
+        return "Shader Compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:
+        return "Third Party";
+    case GL_DEBUG_SOURCE_APPLICATION:
+        return "Application";
+    default:
+        return "Other";
+    }
+}
+
+static const char *getTypeName(GLenum type)
+{
+    switch (type)
+    {
+    case GL_DEBUG_TYPE_ERROR:
+        return "Error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+        return "Deprecated Behavior";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+        return "Undefined Behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:
+        return "Portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:
+        return "Performance";
+    case GL_DEBUG_TYPE_MARKER:
+        return "Marker";
+    default:
+        return "Other";
+    }
+}
+
+static const char *getSeverityName(GLenum severity)
+{
+    switch (severity)
+    {
+    case GL_DEBUG_SEVERITY_HIGH:
+        return "High";
+    case GL_DEBUG_SEVERITY_MEDIUM:
+        return "Medium";
+    case GL_DEBUG_SEVERITY_LOW:
+        return "Low";
+    default:
+        return "Notification";
+    }
+}
+
+static void APIENTRY debugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void * /*userParam*/)
+{
+    // Push and pop group messages only echo the group names
+    if (type == GL_DEBUG_TYPE_PUSH_GROUP || type == GL_DEBUG_TYPE_POP_GROUP)
+        return;
+    if (type == GL_DEBUG_TYPE_ERROR)
+        DebugErrorReported = true;
+
+    // The call site is only ours to read, and only right, when the callback runs inside the call
+    if (DebugOutputSynchronous && CurrentCallSite.function)
+        printf("[OpenGL %s] (%s, %s) %s %s: %i: %.*s\n", getTypeName(type), getSeverityName(severity), getSourceName(source),
+               CurrentCallSite.function, CurrentCallSite.file, CurrentCallSite.line, (int)length, message);
+    else
+        printf("[OpenGL %s] (%s, %s) %u: %.*s\n", getTypeName(type), getSeverityName(severity), getSourceName(source), id, (int)length, message);
+}
+
+bool enableGLDebugOutput(GLenum minSeverity, bool synchronous)
+{
+    if (!GLEXT_debug_output)
+        return false;
+
+    GLState::instance().enable(GL_DEBUG_OUTPUT);
+    GLState::instance().setEnabled(GL_DEBUG_OUTPUT_SYNCHRONOUS, synchronous);
+    DebugOutputSynchronous = synchronous;
+    glDebugMessageCallback(debugMessageCallback, nullptr);
+    setGLDebugSeverity(minSeverity);
+    DebugOutputEnabled = true;
+    return true;
+}
+
+void setGLDebugSeverity(GLenum minSeverity)
+{
+    if (!GLEXT_debug_output)
+        return;
+    // Ordered from least to most severe, everything from minSeverity up stays on
+    const GLenum severities[] = {GL_DEBUG_SEVERITY_NOTIFICATION, GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_HIGH};
+    bool enabled = false;
+    for (GLenum severity : severities)
+    {
+        enabled = enabled || severity == minSeverity;
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severity, 0, nullptr, enabled ? GL_TRUE : GL_FALSE);
+    }
+}
+
+bool isGLDebugOutputEnabled()
+{
+    return DebugOutputEnabled;
+}
+
+void setGLCallSite(const char *function, const char *file, int line)
+{
+    CurrentCallSite = {function, file, line};
+}
+
+bool takeGLDebugError()
+{
+    return DebugErrorReported.exchange(false);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <GLAD/glad.h>
+
+// KHR_debug output. The driver reports errors and warnings through a callback instead of being polled with glGetError
+
+// Installs the callback, messages below minSeverity are filtered out by the driver.
+// Synchronous output runs the callback inside the offending call, which the call site needs to be right.
+// False if the context has no debug output, GLCall falls back to glGetError then
+bool enableGLDebugOutput(GLenum minSeverity, bool synchronous);
+// GL_DEBUG_SEVERITY_NOTIFICATION < LOW < MEDIUM < HIGH
+void setGLDebugSeverity(GLenum minSeverity);
+bool isGLDebugOutputEnabled();
+
+// Set by GLCall in debug builds so messages can name the call, file and line. Null clears it
+void setGLCallSite(const char *function, const char *file, int line);
+// Whether the callback reported an error since the last call, and clears it
+bool takeGLDebugError();
@@ -0,0 +1,72 @@
+#include <Graphics/GLExtensions.h>
+#include <cstring>
+
+#ifndef GL_VERSION_4_1
+PFNGLGETPROGRAMBINARYPROC glext_glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROC glext_glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROC glext_glProgramParameteri = nullptr;
+#endif
+bool GLEXT_program_binary = false;
+#ifndef GL_KHR_parallel_shader_compile
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glext_glMaxShaderCompilerThreadsKHR = nullptr;
+#endif
+bool GLEXT_parallel_shader_compile = false;
+#ifndef GL_VERSION_4_3
+PFNGLDEBUGMESSAGECALLBACKPROC glext_glDebugMessageCallback = nullptr;
+PFNGLDEBUGMESSAGECONTROLPROC glext_glDebugMessageControl = nullptr;
+#endif
+bool GLEXT_debug_output = false;
+bool GLEXT_cube_map_array = false;
+bool GLEXT_vertex_layer = false;
+bool GLEXT_shader_storage_buffer_object = false;
+
+bool hasGLExtension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool hasGLVersion(int major, int minor)
+{
+    GLint contextMajor = 0, contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+void loadGLExtensions(GLADloadproc load)
+{
+#ifndef GL_VERSION_4_1
+    glext_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+    glext_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+    glext_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+#endif
+    GLEXT_program_binary = (hasGLVersion(4, 1) || hasGLExtension("GL_ARB_get_program_binary")) &&
+                           glGetProgramBinary && glProgramBinary && glProgramParameteri;
+
+#ifndef GL_KHR_parallel_shader_compile
+    if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+        glext_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+    else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+        glext_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+#endif
+    GLEXT_parallel_shader_compile = glMaxShaderCompilerThreadsKHR != nullptr;
+
+#ifndef GL_VERSION_4_3
+    glext_glDebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)load("glDebugMessageCallback");
+    glext_glDebugMessageControl = (PFNGLDEBUGMESSAGECONTROLPROC)load("glDebugMessageControl");
+#endif
+    GLEXT_debug_output = (hasGLVersion(4, 3) || hasGLExtension("GL_KHR_debug")) &&
+                         glDebugMessageCallback && glDebugMessageControl;
+
+    GLEXT_cube_map_array = hasGLVersion(4, 0) || hasGLExtension("GL_ARB_texture_cube_map_array");
+    GLEXT_vertex_layer = hasGLExtension("GL_ARB_shader_viewport_layer_array") || hasGLExtension("GL_AMD_vertex_shader_layer");
+    GLEXT_shader_storage_buffer_object = hasGLVersion(4, 3) || hasGLExtension("GL_ARB_shader_storage_buffer_object");
+}
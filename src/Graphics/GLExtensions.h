@@ -0,0 +1,89 @@
+#pragma once
+
+#include <GLAD/glad.h>
+
+// GLAD is generated for GL 3.3 core. Entry points past that are loaded here by loadGLExtensions,
+// right after gladLoadGLLoader. Check the group's GLEXT_ flag before calling into it
+
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_VERSION_4_1
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+typedef void(APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void(APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void(APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+extern PFNGLGETPROGRAMBINARYPROC glext_glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC glext_glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC glext_glProgramParameteri;
+#define glGetProgramBinary glext_glGetProgramBinary
+#define glProgramBinary glext_glProgramBinary
+#define glProgramParameteri glext_glProgramParameteri
+#endif
+extern bool GLEXT_program_binary;
+
+// KHR_parallel_shader_compile, falls back to the ARB entry point which shares the enums
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void(APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+extern PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glext_glMaxShaderCompilerThreadsKHR;
+#define glMaxShaderCompilerThreadsKHR glext_glMaxShaderCompilerThreadsKHR
+#endif
+extern bool GLEXT_parallel_shader_compile;
+
+// GL 4.3 / KHR_debug
+#ifndef GL_VERSION_4_3
+#define GL_CONTEXT_FLAG_DEBUG_BIT 0x00000002
+#define GL_DEBUG_OUTPUT 0x92E0
+#define GL_DEBUG_OUTPUT_SYNCHRONOUS 0x8242
+#define GL_DEBUG_SOURCE_API 0x8246
+#define GL_DEBUG_SOURCE_WINDOW_SYSTEM 0x8247
+#define GL_DEBUG_SOURCE_SHADER_COMPILER 0x8248
+#define GL_DEBUG_SOURCE_THIRD_PARTY 0x8249
+#define GL_DEBUG_SOURCE_APPLICATION 0x824A
+#define GL_DEBUG_SOURCE_OTHER 0x824B
+#define GL_DEBUG_TYPE_ERROR 0x824C
+#define GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR 0x824D
+#define GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR 0x824E
+#define GL_DEBUG_TYPE_PORTABILITY 0x824F
+#define GL_DEBUG_TYPE_PERFORMANCE 0x8250
+#define GL_DEBUG_TYPE_OTHER 0x8251
+#define GL_DEBUG_TYPE_MARKER 0x8268
+#define GL_DEBUG_TYPE_PUSH_GROUP 0x8269
+#define GL_DEBUG_TYPE_POP_GROUP 0x826A
+#define GL_DEBUG_SEVERITY_NOTIFICATION 0x826B
+#define GL_DEBUG_SEVERITY_HIGH 0x9146
+#define GL_DEBUG_SEVERITY_MEDIUM 0x9147
+#define GL_DEBUG_SEVERITY_LOW 0x9148
+typedef void(APIENTRYP PFNGLDEBUGMESSAGECALLBACKPROC)(GLDEBUGPROC callback, const void *userParam);
+typedef void(APIENTRYP PFNGLDEBUGMESSAGECONTROLPROC)(GLenum source, GLenum type, GLenum severity, GLsizei count, const GLuint *ids, GLboolean enabled);
+extern PFNGLDEBUGMESSAGECALLBACKPROC glext_glDebugMessageCallback;
+extern PFNGLDEBUGMESSAGECONTROLPROC glext_glDebugMessageControl;
+#define glDebugMessageCallback glext_glDebugMessageCallback
+#define glDebugMessageControl glext_glDebugMessageControl
+#endif
+extern bool GLEXT_debug_output;
+
+// GL 4.0 / ARB_texture_cube_map_array, no entry points. Point light shadows need it for the cube pool
+#ifndef GL_VERSION_4_0
+#define GL_TEXTURE_CUBE_MAP_ARRAY 0x9009
+#endif
+extern bool GLEXT_cube_map_array;
+
+// GL 4.3 / ARB_shader_storage_buffer_object, the binding calls are GL 3.0 ones. Clustered lighting reads its lists from these
+#ifndef GL_VERSION_4_3
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+extern bool GLEXT_shader_storage_buffer_object;
+
+// ARB_shader_viewport_layer_array or AMD_vertex_shader_layer, vertex shaders can write gl_Layer. No entry points
+extern bool GLEXT_vertex_layer;
+
+// Whether the context reports the extension, GL_EXTENSIONS is walked with glGetStringi
+bool hasGLExtension(const char *name);
+// True if the context version is at least major.minor
+bool hasGLVersion(int major, int minor);
+
+void loadGLExtensions(GLADloadproc load);
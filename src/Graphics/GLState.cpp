@@ -0,0 +1,247 @@
+#include <Graphics/GLState.h>
+
+int GLState::textureTargetIndex(GLenum target)
+{
+    switch (target)
+    {
+    case GL_TEXTURE_2D:
+        return TEXTURE_2D;
+    case GL_TEXTURE_CUBE_MAP:
+        return TEXTURE_CUBE_MAP;
+    case GL_TEXTURE_2D_ARRAY:
+        return TEXTURE_2D_ARRAY;
+    default:
+        return -1;
+    }
+}
+
+int GLState::capabilityIndex(GLenum capability)
+{
+    switch (capability)
+    {
+    case GL_DEPTH_TEST:
+        return DEPTH_TEST;
+    case GL_CULL_FACE:
+        return CULL_FACE;
+    case GL_BLEND:
+        return BLEND;
+    case GL_MULTISAMPLE:
+        return MULTISAMPLE;
+    default:
+        return -1;
+    }
+}
+
+GLuint *GLState::bufferBinding(GLenum target)
+{
+    switch (target)
+    {
+    case GL_ARRAY_BUFFER:
+        return &arrayBuffer;
+    case GL_UNIFORM_BUFFER:
+        return &uniformBuffer;
+    default:
+        // Element array bindings belong to the VAO, not worth tracking separately
+        return nullptr;
+    }
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint *current = bufferBinding(target);
+    if (!current || set(*current, buffer))
+        glBindBuffer(target, buffer);
+}
+
+void GLState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    // Also binds the generic target
+    GLuint *current = bufferBinding(target);
+    if (target == GL_UNIFORM_BUFFER && index < uniformBindings.size())
+    {
+        if (uniformBindings[index] == buffer && uniformBuffer == buffer)
+        {
+            stats.skipped++;
+            return;
+        }
+        uniformBindings[index] = buffer;
+    }
+    if (current)
+        *current = buffer;
+    stats.issued++;
+    glBindBufferBase(target, index, buffer);
+}
+
+void GLState::bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    switch (target)
+    {
+    case GL_FRAMEBUFFER:
+        if (drawFramebuffer == framebuffer && readFramebuffer == framebuffer)
+        {
+            stats.skipped++;
+            return;
+        }
+        drawFramebuffer = readFramebuffer = framebuffer;
+        stats.issued++;
+        break;
+    case GL_DRAW_FRAMEBUFFER:
+        if (!set(drawFramebuffer, framebuffer))
+            return;
+        break;
+    case GL_READ_FRAMEBUFFER:
+        if (!set(readFramebuffer, framebuffer))
+            return;
+        break;
+    }
+    glBindFramebuffer(target, framebuffer);
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+    int index = textureTargetIndex(target);
+    if (index < 0 || activeUnit >= textures.size())
+    {
+        stats.issued++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (set(textures[activeUnit][index], texture))
+        glBindTexture(target, texture);
+}
+
+void GLState::enable(GLenum capability)
+{
+    int index = capabilityIndex(capability);
+    if (index < 0)
+        stats.issued++;
+    else if (!set(capabilities[index], 1))
+        return;
+    glEnable(capability);
+}
+
+void GLState::disable(GLenum capability)
+{
+    int index = capabilityIndex(capability);
+    if (index < 0)
+        stats.issued++;
+    else if (!set(capabilities[index], 0))
+        return;
+    glDisable(capability);
+}
+
+void GLState::depthFunc(GLenum func)
+{
+    if (set(depthFuncMode, func))
+        glDepthFunc(func);
+}
+
+void GLState::depthMask(GLboolean mask)
+{
+    if (set(depthMaskValue, mask))
+        glDepthMask(mask);
+}
+
+void GLState::cullFace(GLenum mode)
+{
+    if (set(cullFaceMode, mode))
+        glCullFace(mode);
+}
+
+void GLState::blendFunc(GLenum source, GLenum destination)
+{
+    if (blendSource == source && blendDestination == destination)
+    {
+        stats.skipped++;
+        return;
+    }
+    blendSource = source;
+    blendDestination = destination;
+    stats.issued++;
+    glBlendFunc(source, destination);
+}
+
+void GLState::polygonMode(GLenum mode)
+{
+    if (set(polygonModeValue, mode))
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height)
+    {
+        stats.skipped++;
+        return;
+    }
+    viewportRect[0] = x;
+    viewportRect[1] = y;
+    viewportRect[2] = width;
+    viewportRect[3] = height;
+    stats.issued++;
+    glViewport(x, y, width, height);
+}
+
+void GLState::deleteProgram(GLuint program)
+{
+    // A program in use is only flagged for deletion, it stays current
+    glDeleteProgram(program);
+}
+
+void GLState::deleteVertexArray(GLuint vao)
+{
+    if (vertexArray == vao)
+        vertexArray = 0;
+    glDeleteVertexArrays(1, &vao);
+}
+
+void GLState::deleteBuffer(GLuint buffer)
+{
+    if (arrayBuffer == buffer)
+        arrayBuffer = 0;
+    if (uniformBuffer == buffer)
+        uniformBuffer = 0;
+    for (auto &binding : uniformBindings)
+        if (binding == buffer)
+            binding = 0;
+    glDeleteBuffers(1, &buffer);
+}
+
+void GLState::deleteTexture(GLuint texture)
+{
+    for (auto &unit : textures)
+        for (auto &binding : unit)
+            if (binding == texture)
+                binding = 0;
+    glDeleteTextures(1, &texture);
+}
+
+void GLState::deleteFramebuffer(GLuint framebuffer)
+{
+    if (drawFramebuffer == framebuffer)
+        drawFramebuffer = 0;
+    if (readFramebuffer == framebuffer)
+        readFramebuffer = 0;
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+void GLState::invalidate()
+{
+    program = vertexArray = UNKNOWN;
+    arrayBuffer = uniformBuffer = UNKNOWN;
+    uniformBindings.fill(UNKNOWN);
+    drawFramebuffer = readFramebuffer = UNKNOWN;
+    activeUnit = UNKNOWN;
+    for (auto &unit : textures)
+        unit.fill(UNKNOWN);
+    capabilities.fill(UNKNOWN);
+    depthFuncMode = depthMaskValue = cullFaceMode = polygonModeValue = UNKNOWN;
+    blendSource = blendDestination = UNKNOWN;
+    viewportRect[0] = viewportRect[1] = viewportRect[2] = viewportRect[3] = -1;
+}
+
+void GLState::endFrame()
+{
+    lastFrameStats = stats;
+    stats = {};
+}
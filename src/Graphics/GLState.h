@@ -0,0 +1,133 @@
+#pragma once
+
+#include <GLAD/glad.h>
+#include <array>
+#include <cstddef>
+
+constexpr size_t GL_STATE_TEXTURE_UNITS = 32;
+constexpr size_t GL_STATE_UNIFORM_BINDINGS = 16;
+
+struct GLStateStats
+{
+    size_t issued;
+    size_t skipped; // Calls dropped because the state was already set
+};
+
+// Shadow copy of the GL state the engine touches. Binds go through here so redundant ones never reach the driver.
+// Anything that changes this state behind its back has to call invalidate
+class GLState
+{
+public:
+    static GLState &instance()
+    {
+        static GLState instance;
+        return instance;
+    }
+
+    inline void useProgram(GLuint program)
+    {
+        if (set(this->program, program))
+            glUseProgram(program);
+    }
+    inline void bindVertexArray(GLuint vao)
+    {
+        if (set(vertexArray, vao))
+            glBindVertexArray(vao);
+    }
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+    inline void activeTexture(GLuint unit)
+    {
+        if (set(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    // On the active unit, like glBindTexture
+    void bindTexture(GLenum target, GLuint texture);
+    inline void bindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        activeTexture(unit);
+        bindTexture(target, texture);
+    }
+
+    void enable(GLenum capability);
+    void disable(GLenum capability);
+    void setEnabled(GLenum capability, bool enabled) { enabled ? enable(capability) : disable(capability); }
+    void depthFunc(GLenum func);
+    void depthMask(GLboolean mask);
+    void cullFace(GLenum mode);
+    void blendFunc(GLenum source, GLenum destination);
+    // Core profile only has GL_FRONT_AND_BACK
+    void polygonMode(GLenum mode);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    // Deleting a bound object unbinds it, these keep the shadow state in step
+    void deleteProgram(GLuint program);
+    void deleteVertexArray(GLuint vao);
+    void deleteBuffer(GLuint buffer);
+    void deleteTexture(GLuint texture);
+    void deleteFramebuffer(GLuint framebuffer);
+
+    // Forget everything, the next call of each kind goes to the driver
+    void invalidate();
+
+    // Counts for the frame so far, endFrame moves them to getLastFrameStats
+    const GLStateStats &getStats() const { return stats; }
+    const GLStateStats &getLastFrameStats() const { return lastFrameStats; }
+    void endFrame();
+
+private:
+    GLState() { invalidate(); }
+
+    // Nothing is bound to this name, so it never matches a real one
+    static constexpr GLuint UNKNOWN = 0xFFFFFFFF;
+
+    enum TextureTarget
+    {
+        TEXTURE_2D,
+        TEXTURE_CUBE_MAP,
+        TEXTURE_2D_ARRAY,
+        TEXTURE_TARGET_COUNT
+    };
+    enum Capability
+    {
+        DEPTH_TEST,
+        CULL_FACE,
+        BLEND,
+        MULTISAMPLE,
+        CAPABILITY_COUNT
+    };
+
+    GLuint program, vertexArray;
+    GLuint arrayBuffer, uniformBuffer;
+    std::array<GLuint, GL_STATE_UNIFORM_BINDINGS> uniformBindings;
+    GLuint drawFramebuffer, readFramebuffer;
+    GLuint activeUnit;
+    std::array<std::array<GLuint, TEXTURE_TARGET_COUNT>, GL_STATE_TEXTURE_UNITS> textures;
+    std::array<GLuint, CAPABILITY_COUNT> capabilities; // 0, 1 or UNKNOWN
+    GLuint depthFuncMode, depthMaskValue, cullFaceMode, polygonModeValue;
+    GLuint blendSource, blendDestination;
+    GLint viewportRect[4];
+
+    GLStateStats stats = {}, lastFrameStats = {};
+
+    // Updates the shadow value, true when the call has to go through
+    inline bool set(GLuint &current, GLuint value)
+    {
+        if (current == value)
+        {
+            stats.skipped++;
+            return false;
+        }
+        current = value;
+        stats.issued++;
+        return true;
+    }
+    static int textureTargetIndex(GLenum target);
+    static int capabilityIndex(GLenum capability);
+    GLuint *bufferBinding(GLenum target);
+
+    GLState(const GLState &) = delete;
+    GLState &operator=(const GLState &) = delete;
+};
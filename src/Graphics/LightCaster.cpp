@@ -2,56 +2,166 @@
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <Engine/Camera.h>
+#include <Graphics/Renderer.h>
+#include <cfloat>
 #include "LightCaster.h"
 
-void LightColor::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+LightUniforms::LightUniforms(const std::string &name)
+    : position(name + ".position"), direction(name + ".direction"),
+      ambient(name + ".color.ambient"), diffuse(name + ".color.diffuse"), specular(name + ".color.specular"),
+      constant(name + ".attenuation.constant"), linear(name + ".attenuation.linear"), quadratic(name + ".attenuation.quadratic"),
+      inner(name + ".cutOff.inner"), outer(name + ".cutOff.outer"),
+      cascadeSplits(name + ".cascadeSplits"), cascadeCount(name + ".cascadeCount"),
+      shadowMap(name + ".shadowMap")
 {
-    shader->setVec3(name + ".color.ambient", ambient);
-    shader->setVec3(name + ".color.diffuse", diffuse);
-    shader->setVec3(name + ".color.specular", specular);
+    // Resolves to the first element when the GLSL member is an array
+    lightSpaceMatrix[0] = Uniform<glm::mat4>(name + ".lightSpaceMatrix");
+    for (int i = 1; i < 6; i++)
+        lightSpaceMatrix[i] = Uniform<glm::mat4>(name + ".lightSpaceMatrix[" + std::to_string(i) + "]");
 }
 
-void LightAttenuation::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+void LightColor::setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const
 {
-    shader->setFloat(name + ".attenuation.constant", constant);
-    shader->setFloat(name + ".attenuation.linear", linear);
-    shader->setFloat(name + ".attenuation.quadratic", quadratic);
+    shader->set(uniforms.ambient, ambient);
+    shader->set(uniforms.diffuse, diffuse);
+    shader->set(uniforms.specular, specular);
 }
 
-void LightCutOff::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+void LightAttenuation::setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const
 {
-    shader->setFloat(name + ".cutOff.inner", inner);
-    shader->setFloat(name + ".cutOff.outer", outer);
+    shader->set(uniforms.constant, constant);
+    shader->set(uniforms.linear, linear);
+    shader->set(uniforms.quadratic, quadratic);
 }
 
-void DirectionalLight::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+void LightCutOff::setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const
 {
-    shader->setVec3(name + ".direction", direction);
-    color.setUniforms(shader, name);
-    shader->setMat4(name + ".lightSpaceMatrix", lightSpaceMatrix);
+    glm::vec2 cosines = getCosines();
+    shader->set(uniforms.inner, cosines.x);
+    shader->set(uniforms.outer, cosines.y);
+}
+
+float AttenuationLightCaster::getRange() const
+{
+    // Solves brightest / (constant + linear * d + quadratic * d^2) = LIGHT_RANGE_THRESHOLD for d
+    float brightest = glm::max(glm::max(color.diffuse.r, color.diffuse.g), color.diffuse.b);
+    float constant = attenuation.constant - brightest / LIGHT_RANGE_THRESHOLD;
+    if (attenuation.quadratic > 0.f)
+    {
+        // A light never as bright as the threshold has no solution, it lights nothing
+        float discriminant = attenuation.linear * attenuation.linear - 4.f * attenuation.quadratic * constant;
+        if (discriminant < 0.f)
+            return 0.f;
+        return glm::max((-attenuation.linear + glm::sqrt(discriminant)) / (2.f * attenuation.quadratic), 0.f);
+    }
+    if (attenuation.linear > 0.f)
+        return glm::max(-constant / attenuation.linear, 0.f);
+    return FLT_MAX;
+}
+
+// FNV-1a over the matrices and whatever else decides the shadow map's views
+static uint64_t hashShadowState(const glm::mat4 *matrices, int count, float extra)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](const void *data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ ((const uint8_t *)data)[i]) * 1099511628211ull;
+    };
+    mix(matrices, sizeof(glm::mat4) * count);
+    mix(&extra, sizeof(float));
+    return hash;
+}
+
+void DirectionalLight::setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const
+{
+    shader->set(uniforms.direction, direction);
+    color.setUniforms(shader, uniforms);
+    glm::vec4 splits(SHADOW_CASCADE_DISTANCE);
+    for (int i = 0; i < cascadeCount; i++)
+    {
+        shader->set(uniforms.lightSpaceMatrix[i], cascadeMatrices[i]);
+        splits[i] = cascadeSplits[i];
+    }
+    shader->set(uniforms.cascadeSplits, splits);
+    shader->set(uniforms.cascadeCount, cascadeCount);
 }
 
 void DirectionalLight::calcLightSpaceMatrix()
 {
-    // glm::vec3 lightViewPos = -direction * 7.5f + mainCamera.position + mainCamera.front;
-    // glm::vec3 lightViewCenter = mainCamera.position + mainCamera.front;
+    auto &renderer = Renderer::instance();
+    cascadeCount = glm::clamp(cascadeCount, 1, MAX_SHADOW_CASCADES);
 
-    glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.f, 7.5f);
-    glm::mat4 lightView = glm::lookAt(-direction * 1.0f, glm::vec3(0.0f), up);
-    lightSpaceMatrix = lightProjection * lightView;
+    // Corners of the camera frustum on the near and far planes, a slice at any depth is a lerp between them
+    glm::mat4 inverse = glm::inverse(renderer.getProjection() * renderer.getView());
+    glm::vec3 nearCorners[4], farCorners[4];
+    for (int i = 0; i < 4; i++)
+    {
+        glm::vec2 ndc((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f);
+        glm::vec4 nearCorner = inverse * glm::vec4(ndc, -1.f, 1.f);
+        glm::vec4 farCorner = inverse * glm::vec4(ndc, 1.f, 1.f);
+        nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+        farCorners[i] = glm::vec3(farCorner) / farCorner.w;
+    }
+
+    float lastSplit = CAMERA_NEAR_PLANE;
+    for (int cascade = 0; cascade < cascadeCount; cascade++)
+    {
+        // Practical split scheme, logarithmic near the camera where it matters and closer to uniform further out
+        float fraction = (cascade + 1) / (float)cascadeCount;
+        float logSplit = CAMERA_NEAR_PLANE * glm::pow(SHADOW_CASCADE_DISTANCE / CAMERA_NEAR_PLANE, fraction);
+        float uniformSplit = CAMERA_NEAR_PLANE + (SHADOW_CASCADE_DISTANCE - CAMERA_NEAR_PLANE) * fraction;
+        float split = glm::mix(uniformSplit, logSplit, SHADOW_CASCADE_SPLIT_LAMBDA);
+
+        glm::vec3 corners[8];
+        glm::vec3 center(0.f);
+        for (int i = 0; i < 4; i++)
+        {
+            corners[i] = glm::mix(nearCorners[i], farCorners[i], (lastSplit - CAMERA_NEAR_PLANE) / (CAMERA_FAR_PLANE - CAMERA_NEAR_PLANE));
+            corners[i + 4] = glm::mix(nearCorners[i], farCorners[i], (split - CAMERA_NEAR_PLANE) / (CAMERA_FAR_PLANE - CAMERA_NEAR_PLANE));
+            center += corners[i] + corners[i + 4];
+        }
+        center /= 8.f;
+
+        // A sphere around the slice keeps the box the same size however the camera turns, so edges don't shimmer
+        float radius = 0.f;
+        for (const auto &corner : corners)
+            radius = glm::max(radius, glm::length(corner - center));
+        radius = glm::ceil(radius * 16.f) / 16.f;
+
+        // Moves the box by whole texels only, so camera movement doesn't shift what each texel covers.
+        // Depth is snapped the same way, a camera that moved less than a texel gives the exact same matrix
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.f), direction, up);
+        float texelSize = 2.f * radius / SHADOW_CASCADE_RESOLUTION;
+        glm::vec3 lightCenter = glm::floor(glm::vec3(lightRotation * glm::vec4(center, 1.f)) / texelSize) * texelSize;
+        center = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightCenter, 1.f));
+
+        glm::mat4 lightView = glm::lookAt(center - direction * (radius + SHADOW_CASCADE_CASTER_DISTANCE), center, up);
+        glm::mat4 lightProjection = glm::ortho(-radius, radius, -radius, radius, 0.f, 2.f * radius + SHADOW_CASCADE_CASTER_DISTANCE);
+
+        cascadeMatrices[cascade] = lightProjection * lightView;
+        cascadeSplits[cascade] = split;
+        lastSplit = split;
+    }
+    lightSpaceMatrix = cascadeMatrices[0];
+}
+
+uint64_t DirectionalLight::getShadowSignature() const
+{
+    return hashShadowState(cascadeMatrices, cascadeCount, (float)cascadeCount);
 }
-void PointLight::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+void PointLight::setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const
 {
-    shader->setVec3(name + ".position", position);
-    color.setUniforms(shader, name);
-    attenuation.setUniforms(shader, name);
+    shader->set(uniforms.position, position);
+    color.setUniforms(shader, uniforms);
+    attenuation.setUniforms(shader, uniforms);
     for (int i = 0; i < 6; i++)
-        shader->setMat4(name + ".lightSpaceMatrix[" + std::to_string(i) + "]", lightSpaceMatrix[i]);
+        shader->set(uniforms.lightSpaceMatrix[i], lightSpaceMatrix[i]);
 }
 
 void PointLight::calcLightSpaceMatrix()
 {
-    glm::mat4 lightProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.125f, 20.0f);
+    glm::mat4 lightProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.125f, POINT_SHADOW_FAR_PLANE);
     glm::mat4 views[6];
     views[0] = glm::lookAt(position, position + glm::vec3(+1.0, +0.0, +0.0), glm::vec3(+0.0, +1.0, +0.0));
     views[1] = glm::lookAt(position, position + glm::vec3(-1.0, +0.0, +0.0), glm::vec3(+0.0, +1.0, +0.0));
@@ -63,14 +173,20 @@ void PointLight::calcLightSpaceMatrix()
         lightSpaceMatrix[i] = lightProjection * views[i];
 }
 
-void SpotLight::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const
+uint64_t PointLight::getShadowSignature() const
+{
+    // Casters are culled against the range as well
+    return hashShadowState(lightSpaceMatrix, 6, getRange());
+}
+
+void SpotLight::setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const
 {
-    shader->setVec3(name + ".position", position);
-    shader->setVec3(name + ".direction", direction);
-    color.setUniforms(shader, name);
-    attenuation.setUniforms(shader, name);
-    cutOff.setUniforms(shader, name);
-    shader->setMat4(name + ".lightSpaceMatrix", lightSpaceMatrix);
+    shader->set(uniforms.position, position);
+    shader->set(uniforms.direction, direction);
+    color.setUniforms(shader, uniforms);
+    attenuation.setUniforms(shader, uniforms);
+    cutOff.setUniforms(shader, uniforms);
+    shader->set(uniforms.lightSpaceMatrix[0], lightSpaceMatrix);
 }
 
 void SpotLight::calcLightSpaceMatrix()
@@ -80,54 +196,77 @@ void SpotLight::calcLightSpaceMatrix()
     lightSpaceMatrix = lightProjection * lightView;
 }
 
-#include <Graphics/UniformBufferObject.h>
-void pushLightingColorData(UniformBufferObject &ubo, const LightColor &color, size_t &offset)
+uint64_t SpotLight::getShadowSignature() const
 {
-    ubo.pushData(&color.ambient[0], sizeof(glm::vec3), offset);
-    ubo.pushData(&color.diffuse[0], sizeof(glm::vec3), offset);
-    ubo.pushData(&color.specular[0], sizeof(glm::vec3), offset);
+    return hashShadowState(&lightSpaceMatrix, 1, getRange());
 }
-void pushLightingAttenuationData(UniformBufferObject &ubo, const LightAttenuation &attenuation, size_t &offset)
+
+#include <Graphics/UniformBufferObject.h>
+
+using LightingBlock = Std140Buffer<LightingBlockLayout>;
+
+static void writeLightColor(LightingBlock &block, size_t base, const LightColor &color)
 {
-    glm::vec3 attenuation_vector = {attenuation.constant, attenuation.linear, attenuation.quadratic};
-    ubo.pushData(&attenuation_vector[0], sizeof(glm::vec3), offset);
+    block.set(base + LightColorLayout::offset<0>, color.ambient);
+    block.set(base + LightColorLayout::offset<1>, color.diffuse);
+    block.set(base + LightColorLayout::offset<2>, color.specular);
 }
-void pushLightingCutoffData(UniformBufferObject &ubo, const LightCutOff &cutoff, size_t &offset)
+
+static void writeLightAttenuation(LightingBlock &block, size_t base, const LightAttenuation &attenuation)
 {
-    glm::vec2 cutoff_vector = {cutoff.inner, cutoff.outer};
-    ubo.pushData(&cutoff_vector[0], sizeof(glm::vec2), offset);
+    block.set(base + LightAttenuationLayout::offset<0>, attenuation.constant);
+    block.set(base + LightAttenuationLayout::offset<1>, attenuation.linear);
+    block.set(base + LightAttenuationLayout::offset<2>, attenuation.quadratic);
 }
+
 void setLightingData(UniformBufferObject &ubo, const LightingUniforms &uniforms)
 {
-    size_t offset = 0;
-
-    ubo.pushData(&uniforms.viewPos[0], sizeof(glm::vec3), offset);
+    using Cascades = Std140Array<glm::mat4, MAX_SHADOW_CASCADES>;
+    using PointMatrices = Std140Array<glm::mat4, 6>;
+    using PointLights = Std140Array<PointLightLayout, MAX_POINT_LIGHTS>;
+    using SpotLights = Std140Array<SpotLightLayout, MAX_SPOT_LIGHTS>;
+    static LightingBlock block;
 
     // Directional Light
-    ubo.pushData(&uniforms.dirLight.direction[0], sizeof(glm::vec3), offset);
-    ubo.pushData(&uniforms.dirLight.up[0], sizeof(glm::vec3), offset);
-    pushLightingColorData(ubo, uniforms.dirLight.color, offset);
-    ubo.pushData(&uniforms.dirLight.lightSpaceMatrix[0][0], sizeof(glm::mat4), offset);
+    const DirectionalLight &dir = uniforms.dirLight;
+    size_t base = LightingBlockLayout::offset<0>;
+    block.set(base + DirectionalLightLayout::offset<0>, dir.direction);
+    block.set(base + DirectionalLightLayout::offset<1>, dir.up);
+    writeLightColor(block, base + DirectionalLightLayout::offset<2>, dir.color);
+    for (int i = 0; i < MAX_SHADOW_CASCADES; i++)
+        block.set(base + DirectionalLightLayout::offset<3> + Cascades::offset(i), dir.cascadeMatrices[i]);
+    block.set(base + DirectionalLightLayout::offset<4>, glm::vec4(dir.cascadeSplits[0], dir.cascadeSplits[1], dir.cascadeSplits[2], dir.cascadeSplits[3]));
+    block.set(base + DirectionalLightLayout::offset<5>, dir.cascadeCount);
 
     // Point Lights
     for (int i = 0; i < MAX_POINT_LIGHTS; i++)
     {
-        ubo.pushData(&uniforms.pointLights[i].position[0], sizeof(glm::vec3), offset);
-        pushLightingColorData(ubo, uniforms.pointLights[i].color, offset);
-        pushLightingAttenuationData(ubo, uniforms.pointLights[i].attenuation, offset);
+        const PointLight &point = uniforms.pointLights[i];
+        base = LightingBlockLayout::offset<1> + PointLights::offset(i);
+        block.set(base + PointLightLayout::offset<0>, point.position);
+        writeLightColor(block, base + PointLightLayout::offset<1>, point.color);
+        writeLightAttenuation(block, base + PointLightLayout::offset<2>, point.attenuation);
         for (int j = 0; j < 6; j++)
-            ubo.pushData(&uniforms.pointLights[i].lightSpaceMatrix[j][0][0], sizeof(glm::mat4), offset);
+            block.set(base + PointLightLayout::offset<3> + PointMatrices::offset(j), point.lightSpaceMatrix[j]);
+        block.set(base + PointLightLayout::offset<4>, uniforms.pointShadowLayers[i]);
     }
 
     // Spot Lights
     for (int i = 0; i < MAX_SPOT_LIGHTS; i++)
     {
-        ubo.pushData(&uniforms.spotLights[i].position[0], sizeof(glm::vec3), offset);
-        ubo.pushData(&uniforms.spotLights[i].direction[0], sizeof(glm::vec3), offset);
-        ubo.pushData(&uniforms.spotLights[i].up[0], sizeof(glm::vec3), offset);
-        pushLightingColorData(ubo, uniforms.spotLights[i].color, offset);
-        pushLightingAttenuationData(ubo, uniforms.spotLights[i].attenuation, offset);
-        pushLightingCutoffData(ubo, uniforms.spotLights[i].cutOff, offset);
-        ubo.pushData(&uniforms.spotLights[i].lightSpaceMatrix[0][0], sizeof(glm::mat4), offset);
+        const SpotLight &spot = uniforms.spotLights[i];
+        base = LightingBlockLayout::offset<2> + SpotLights::offset(i);
+        block.set(base + SpotLightLayout::offset<0>, spot.position);
+        block.set(base + SpotLightLayout::offset<1>, spot.direction);
+        block.set(base + SpotLightLayout::offset<2>, spot.up);
+        writeLightColor(block, base + SpotLightLayout::offset<3>, spot.color);
+        writeLightAttenuation(block, base + SpotLightLayout::offset<4>, spot.attenuation);
+        glm::vec2 cutOffCosines = spot.cutOff.getCosines();
+        block.set(base + SpotLightLayout::offset<5> + LightCutOffLayout::offset<0>, cutOffCosines.x);
+        block.set(base + SpotLightLayout::offset<5> + LightCutOffLayout::offset<1>, cutOffCosines.y);
+        block.set(base + SpotLightLayout::offset<6>, spot.lightSpaceMatrix);
+        block.set(base + SpotLightLayout::offset<7>, uniforms.spotShadowRects[i]);
     }
-}
\ No newline at end of file
+
+    ubo.setData(block.data());
+}
@@ -3,30 +3,66 @@
 #include <glm/glm.hpp>
 #include <memory>
 #include <Graphics/ShaderObject.h>
+#include <Graphics/Std140.h>
 #include <stdexcept>
+#include <cstdint>
 
 constexpr int MAX_POINT_LIGHTS = 4;
 constexpr int MAX_SPOT_LIGHTS = 4;
+// Directional shadows are split into up to this many cascades along the camera frustum
+constexpr int MAX_SHADOW_CASCADES = 4;
+constexpr int DEFAULT_SHADOW_CASCADES = 3;
+// Cascades cover the camera frustum out to this distance, nothing further away gets directional shadows
+constexpr float SHADOW_CASCADE_DISTANCE = 50.f;
+// Blend of uniform (0) and logarithmic (1) split distances
+constexpr float SHADOW_CASCADE_SPLIT_LAMBDA = 0.75f;
+// Casters up to this far towards the light from a cascade still land in its depth range
+constexpr float SHADOW_CASCADE_CASTER_DISTANCE = 20.f;
+// Size of a cascade layer, cascades are snapped to its texels
+constexpr unsigned int SHADOW_CASCADE_RESOLUTION = 2048;
+// Far plane of point light shadow projections
+constexpr float POINT_SHADOW_FAR_PLANE = 20.f;
+// Attenuated lights are treated as out of reach where they fall below this fraction of their brightest color channel
+constexpr float LIGHT_RANGE_THRESHOLD = 5.f / 256.f;
+
+// Uniforms of one light struct in GLSL, interned once per name ("dirLight", "pointLights[0]", ...)
+struct LightUniforms
+{
+    Uniform<glm::vec3> position, direction;
+    Uniform<glm::vec3> ambient, diffuse, specular;
+    Uniform<float> constant, linear, quadratic;
+    Uniform<float> inner, outer;
+    Uniform<glm::mat4> lightSpaceMatrix[6]; // One per cascade for directional lights, spot lights only use the first
+    Uniform<glm::vec4> cascadeSplits;
+    Uniform<int> cascadeCount;
+    Uniform<int> shadowMap;
+
+    LightUniforms() = default;
+    LightUniforms(const std::string &name);
+};
 
 struct LightColor
 {
     glm::vec3 ambient, diffuse, specular;
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const;
+    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const;
 };
 
 struct LightAttenuation
 {
     float constant, linear, quadratic;
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const;
+    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const;
 };
 
 struct LightCutOff
 {
-    float inner, outer;
+    float inner, outer; // Half angles in degrees
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const;
+    // What the shaders compare against, every upload goes through here
+    glm::vec2 getCosines() const { return glm::cos(glm::radians(glm::vec2(inner, outer))); }
+
+    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const;
 };
 
 struct LightCaster
@@ -43,9 +79,11 @@ struct LightCaster
     }
     virtual ~LightCaster() = 0;
 
-    virtual void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const = 0;
+    virtual void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const = 0;
     virtual void calcLightSpaceMatrix() = 0;
     virtual glm::mat4 getLightSpaceMatrix() const = 0;
+    // Changes whenever what the shadow map would cover changes, a hash of the light space matrices
+    virtual uint64_t getShadowSignature() const = 0;
 };
 inline LightCaster::~LightCaster() {}
 
@@ -63,26 +101,42 @@ struct AttenuationLightCaster : public LightCaster
     {
     }
     virtual ~AttenuationLightCaster() = 0;
+
+    // Distance where the light falls below LIGHT_RANGE_THRESHOLD, nothing further away is lit or shadowed by it
+    float getRange() const;
 };
 inline AttenuationLightCaster::~AttenuationLightCaster() {}
 
 struct DirectionalLight : public LightCaster
 {
     glm::vec3 direction, up;
-    glm::mat4 lightSpaceMatrix;
+    glm::mat4 lightSpaceMatrix; // Of the first cascade
+
+    // Each cascade is another depth pass, fewer stretch the same texels over more of the view
+    int cascadeCount = DEFAULT_SHADOW_CASCADES;
+    glm::mat4 cascadeMatrices[MAX_SHADOW_CASCADES];
+    float cascadeSplits[MAX_SHADOW_CASCADES]; // View depth where each cascade ends
 
     DirectionalLight(const LightColor &color)
-        : LightCaster(color)
+        : LightCaster(color), direction(glm::vec3(0.f)), up(glm::vec3(0.f)), lightSpaceMatrix(glm::mat4(1.f))
     {
+        // The lighting block gets every cascade slot, used or not
+        for (int i = 0; i < MAX_SHADOW_CASCADES; i++)
+        {
+            cascadeMatrices[i] = glm::mat4(1.f);
+            cascadeSplits[i] = 0.f;
+        }
     }
     DirectionalLight()
         : DirectionalLight(LightColor())
     {
     }
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const override;
+    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const override;
+    // Fits the cascades to the renderer's current view and projection
     void calcLightSpaceMatrix() override;
     glm::mat4 getLightSpaceMatrix() const override { return lightSpaceMatrix; }
+    uint64_t getShadowSignature() const override;
 };
 
 struct PointLight : public AttenuationLightCaster
@@ -98,9 +152,10 @@ struct PointLight : public AttenuationLightCaster
     {
     }
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const override;
+    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const override;
     void calcLightSpaceMatrix() override;
     glm::mat4 getLightSpaceMatrix() const override { throw std::runtime_error("Can't get singular light space matrix of point light!"); }
+    uint64_t getShadowSignature() const override;
 };
 
 struct SpotLight : public AttenuationLightCaster
@@ -111,7 +166,7 @@ struct SpotLight : public AttenuationLightCaster
     glm::mat4 lightSpaceMatrix;
 
     SpotLight(const LightColor &color, const LightAttenuation &attenuation, const LightCutOff &cutOff)
-        : AttenuationLightCaster(color, attenuation), cutOff(cutOff), direction(glm::vec3(0.f)), up(glm::vec3(0.f))
+        : AttenuationLightCaster(color, attenuation), direction(glm::vec3(0.f)), up(glm::vec3(0.f)), cutOff(cutOff), lightSpaceMatrix(glm::mat4(1.f))
     {
     }
     SpotLight()
@@ -119,25 +174,46 @@ struct SpotLight : public AttenuationLightCaster
     {
     }
 
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name) const override;
+    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const LightUniforms &uniforms) const override;
     void calcLightSpaceMatrix() override;
     glm::mat4 getLightSpaceMatrix() const override { return lightSpaceMatrix; }
+    uint64_t getShadowSignature() const override;
 };
 
+// CPU side of the LightingUniforms block, filled once a frame by LightNode::UpdateLightingUniforms
 struct LightingUniforms
 {
     DirectionalLight dirLight;
     PointLight pointLights[MAX_POINT_LIGHTS];
     SpotLight spotLights[MAX_SPOT_LIGHTS];
-    glm::vec3 viewPos;
+    // Where each light's shadow map is in the ShadowAtlas, written into the light's struct in the block
+    int pointShadowLayers[MAX_POINT_LIGHTS];
+    glm::vec4 spotShadowRects[MAX_SPOT_LIGHTS];
 };
-constexpr size_t LIGHTING_UNIFORM_SIZE = sizeof(LightingUniforms);
+
+// The LightingUniforms block and its structs as declared in Shader_Displacement/fragment.glsl, member for member
+using LightColorLayout = Std140Struct<glm::vec3, glm::vec3, glm::vec3>;
+using LightAttenuationLayout = Std140Struct<float, float, float>;
+using LightCutOffLayout = Std140Struct<float, float>;
+using DirectionalLightLayout = Std140Struct<glm::vec3, glm::vec3, LightColorLayout, Std140Array<glm::mat4, MAX_SHADOW_CASCADES>, glm::vec4, int>;
+using PointLightLayout = Std140Struct<glm::vec3, LightColorLayout, LightAttenuationLayout, Std140Array<glm::mat4, 6>, int>;
+using SpotLightLayout = Std140Struct<glm::vec3, glm::vec3, glm::vec3, LightColorLayout, LightAttenuationLayout, LightCutOffLayout, glm::mat4, glm::vec4>;
+using LightingBlockLayout = Std140Struct<DirectionalLightLayout, Std140Array<PointLightLayout, MAX_POINT_LIGHTS>, Std140Array<SpotLightLayout, MAX_SPOT_LIGHTS>>;
+
+// What the GL reports for the block, a changed declaration has to change these along with the layouts above
+static_assert(LightColorLayout::size == 48 && LightAttenuationLayout::size == 16 && LightCutOffLayout::size == 16, "std140 light member structs");
+static_assert(DirectionalLightLayout::offset<3> == 80 && DirectionalLightLayout::offset<5> == 352 && DirectionalLightLayout::size == 368, "std140 DirectionalLight");
+static_assert(PointLightLayout::offset<3> == 80 && PointLightLayout::offset<4> == 464 && PointLightLayout::size == 480, "std140 PointLight");
+static_assert(SpotLightLayout::offset<6> == 128 && SpotLightLayout::offset<7> == 192 && SpotLightLayout::size == 208, "std140 SpotLight");
+static_assert(LightingBlockLayout::offset<1> == 368 && LightingBlockLayout::offset<2> == 368 + 480 * MAX_POINT_LIGHTS, "std140 LightingUniforms");
+
+constexpr size_t LIGHTING_UNIFORM_SIZE = LightingBlockLayout::size;
+// Shaders declare the block with layout(binding = 1)
+constexpr GLuint LIGHTING_UNIFORM_BINDING = 1;
 
 inline LightingUniforms lightingUniforms;
 
 class UniformBufferObject;
 
-void pushLightingColorData(UniformBufferObject &ubo, const LightColor &color, size_t &offset);
-void pushLightingAttenuationData(UniformBufferObject &ubo, const LightAttenuation &attenuation, size_t &offset);
-void pushLightingCutoffData(UniformBufferObject &ubo, const LightCutOff &cutoff, size_t &offset);
+// Builds the whole block in memory by LightingBlockLayout and uploads it with one call
 void setLightingData(UniformBufferObject &ubo, const LightingUniforms &uniforms);
\ No newline at end of file
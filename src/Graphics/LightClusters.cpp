@@ -0,0 +1,389 @@
+#include <Graphics/LightClusters.h>
+#include <Graphics/Renderer.h>
+#include <Graphics/GLState.h>
+#include <Graphics/GLExtensions.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_SSE 1
+#endif
+
+// Slice of a view depth, the inverse of the exponential spacing buildClusters uses
+static uint32_t sliceOf(float depth)
+{
+    float slice = glm::log(depth / CAMERA_NEAR_PLANE) * CLUSTER_GRID_Z / glm::log(CAMERA_FAR_PLANE / CAMERA_NEAR_PLANE);
+    return (uint32_t)glm::clamp(slice, 0.f, (float)(CLUSTER_GRID_Z - 1));
+}
+
+static float sliceDepth(uint32_t slice)
+{
+    return CAMERA_NEAR_PLANE * glm::pow(CAMERA_FAR_PLANE / CAMERA_NEAR_PLANE, (float)slice / CLUSTER_GRID_Z);
+}
+
+void LightClusters::clear()
+{
+    lights.clear();
+    ambient = glm::vec3(0.f);
+}
+
+void LightClusters::addPointLight(const PointLight &light)
+{
+    if (lights.size() >= MAX_CLUSTERED_LIGHTS)
+        return;
+    ClusterLight cluster;
+    cluster.position = glm::vec4(light.position, light.getRange());
+    cluster.direction = glm::vec4(0.f, 0.f, 0.f, -2.f);
+    cluster.ambient = glm::vec4(light.color.ambient, 0.f);
+    cluster.diffuse = glm::vec4(light.color.diffuse, 0.f);
+    cluster.specular = glm::vec4(light.color.specular, 0.f);
+    cluster.attenuation = glm::vec4(light.attenuation.constant, light.attenuation.linear, light.attenuation.quadratic, 0.f);
+    lights.push_back(cluster);
+    ambient += light.color.ambient;
+}
+
+void LightClusters::addSpotLight(const SpotLight &light)
+{
+    if (lights.size() >= MAX_CLUSTERED_LIGHTS)
+        return;
+    ClusterLight cluster;
+    cluster.position = glm::vec4(light.position, light.getRange());
+    cluster.direction = glm::vec4(glm::normalize(light.direction), light.cutOff.getCosines().y);
+    cluster.ambient = glm::vec4(light.color.ambient, 0.f);
+    cluster.diffuse = glm::vec4(light.color.diffuse, 0.f);
+    cluster.specular = glm::vec4(light.color.specular, 0.f);
+    cluster.attenuation = glm::vec4(light.attenuation.constant, light.attenuation.linear, light.attenuation.quadratic, 0.f);
+    lights.push_back(cluster);
+    ambient += light.color.ambient;
+}
+
+void LightClusters::buildClusters(const glm::mat4 &projection)
+{
+    if (projection == clusterProjection && !minX.empty())
+        return;
+    clusterProjection = projection;
+    for (auto *values : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ, &sphereX, &sphereY, &sphereZ, &sphereRadius})
+        values->resize(CLUSTER_COUNT);
+
+    glm::mat4 inverse = glm::inverse(projection);
+    for (uint32_t z = 0; z < CLUSTER_GRID_Z; z++)
+    {
+        float depths[2] = {sliceDepth(z), sliceDepth(z + 1)};
+        for (uint32_t y = 0; y < CLUSTER_GRID_Y; y++)
+            for (uint32_t x = 0; x < CLUSTER_GRID_X; x++)
+            {
+                // Rays through the tile corners on the near plane, cut at both depths of the slice
+                glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+                for (uint32_t corner = 0; corner < 4; corner++)
+                {
+                    float ndcX = -1.f + 2.f * (x + (corner & 1)) / CLUSTER_GRID_X;
+                    float ndcY = -1.f + 2.f * (y + (corner >> 1)) / CLUSTER_GRID_Y;
+                    glm::vec4 point = inverse * glm::vec4(ndcX, ndcY, -1.f, 1.f);
+                    glm::vec3 ray = glm::vec3(point) / point.w;
+                    for (float depth : depths)
+                    {
+                        glm::vec3 position = ray * (depth / -ray.z);
+                        low = glm::min(low, position);
+                        high = glm::max(high, position);
+                    }
+                }
+                uint32_t index = (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+                glm::vec3 center = (low + high) * 0.5f;
+                minX[index] = low.x;
+                minY[index] = low.y;
+                minZ[index] = low.z;
+                maxX[index] = high.x;
+                maxY[index] = high.y;
+                maxZ[index] = high.z;
+                sphereX[index] = center.x;
+                sphereY[index] = center.y;
+                sphereZ[index] = center.z;
+                sphereRadius[index] = glm::length(high - center);
+            }
+    }
+}
+
+void LightClusters::prepareVolumes(const glm::mat4 &view)
+{
+    for (auto &slice : slices)
+        slice.candidates.clear();
+    volumes.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const ClusterLight &light = lights[i];
+        LightVolume &volume = volumes[i];
+        volume.center = glm::vec3(view * glm::vec4(glm::vec3(light.position), 1.f));
+        // Unbounded lights reach everything in view
+        volume.radius = glm::min(light.position.w, 2.f * CAMERA_FAR_PLANE);
+        volume.cosine = light.direction.w;
+        volume.sine = 0.f;
+        if (volume.cosine > -2.f)
+        {
+            volume.direction = glm::normalize(glm::mat3(view) * glm::vec3(light.direction));
+            volume.sine = glm::sqrt(glm::max(1.f - volume.cosine * volume.cosine, 0.f));
+        }
+
+        float depth = -volume.center.z;
+        if (depth + volume.radius < CAMERA_NEAR_PLANE || depth - volume.radius > CAMERA_FAR_PLANE)
+        {
+            volume.firstSlice = 1;
+            volume.lastSlice = 0;
+            continue;
+        }
+        volume.firstSlice = sliceOf(glm::max(depth - volume.radius, CAMERA_NEAR_PLANE));
+        volume.lastSlice = sliceOf(glm::min(depth + volume.radius, CAMERA_FAR_PLANE));
+        for (uint32_t z = volume.firstSlice; z <= volume.lastSlice; z++)
+            slices[z].candidates.push_back((uint32_t)i);
+    }
+}
+
+void LightClusters::binSlice(uint32_t slice)
+{
+    SliceBins &bins = slices[slice];
+    bins.pairs.clear();
+    const uint32_t base = slice * CLUSTERS_PER_SLICE;
+
+    for (uint32_t light : bins.candidates)
+    {
+        const LightVolume &volume = volumes[light];
+        const bool isSpot = volume.cosine > -2.f;
+        uint32_t i = 0;
+
+#if LIGHT_CLUSTERS_SSE
+        const __m128 cx = _mm_set1_ps(volume.center.x), cy = _mm_set1_ps(volume.center.y), cz = _mm_set1_ps(volume.center.z);
+        const __m128 radius = _mm_set1_ps(volume.radius), zero = _mm_setzero_ps();
+        for (; i + 4 <= CLUSTERS_PER_SLICE; i += 4)
+        {
+            const uint32_t c = base + i;
+            // Sphere against box, distance from the light to the closest point of each box
+            __m128 dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[c]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&maxX[c]))));
+            __m128 dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[c]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&maxY[c]))));
+            __m128 dz = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[c]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&maxZ[c]))));
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 inside = _mm_cmple_ps(distance, _mm_mul_ps(radius, radius));
+            if (isSpot && _mm_movemask_ps(inside))
+            {
+                // Cone against each cluster's sphere: outside the angle, in front of the range or behind the apex
+                __m128 sr = _mm_loadu_ps(&sphereRadius[c]);
+                __m128 vx = _mm_sub_ps(_mm_loadu_ps(&sphereX[c]), cx);
+                __m128 vy = _mm_sub_ps(_mm_loadu_ps(&sphereY[c]), cy);
+                __m128 vz = _mm_sub_ps(_mm_loadu_ps(&sphereZ[c]), cz);
+                __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+                __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(volume.direction.x)), _mm_mul_ps(vy, _mm_set1_ps(volume.direction.y))),
+                                          _mm_mul_ps(vz, _mm_set1_ps(volume.direction.z)));
+                __m128 across = _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(lengthSquared, _mm_mul_ps(along, along))));
+                __m128 closest = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(volume.cosine), across), _mm_mul_ps(along, _mm_set1_ps(volume.sine)));
+                __m128 culled = _mm_or_ps(_mm_cmpgt_ps(closest, sr),
+                                          _mm_or_ps(_mm_cmpgt_ps(along, _mm_add_ps(sr, radius)), _mm_cmplt_ps(along, _mm_sub_ps(zero, sr))));
+                inside = _mm_andnot_ps(culled, inside);
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (uint32_t j = 0; j < 4; j++)
+                if ((mask >> j) & 1)
+                    bins.pairs.push_back((i + j) << 16 | light);
+        }
+#endif
+
+        for (; i < CLUSTERS_PER_SLICE; i++)
+        {
+            const uint32_t c = base + i;
+            glm::vec3 closest = glm::clamp(volume.center, glm::vec3(minX[c], minY[c], minZ[c]), glm::vec3(maxX[c], maxY[c], maxZ[c]));
+            glm::vec3 offset = closest - volume.center;
+            if (glm::dot(offset, offset) > volume.radius * volume.radius)
+                continue;
+            if (isSpot)
+            {
+                glm::vec3 v = glm::vec3(sphereX[c], sphereY[c], sphereZ[c]) - volume.center;
+                float along = glm::dot(v, volume.direction);
+                float across = glm::sqrt(glm::max(glm::dot(v, v) - along * along, 0.f));
+                float sr = sphereRadius[c];
+                if (volume.cosine * across - along * volume.sine > sr || along > sr + volume.radius || along < -sr)
+                    continue;
+            }
+            bins.pairs.push_back(i << 16 | light);
+        }
+    }
+
+    // Counting sort by cluster, the lights of a cluster stay in the order they were added
+    std::memset(bins.counts, 0, sizeof(bins.counts));
+    for (uint32_t pair : bins.pairs)
+        bins.counts[pair >> 16]++;
+    uint32_t offsets[CLUSTERS_PER_SLICE];
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < CLUSTERS_PER_SLICE; i++)
+    {
+        offsets[i] = offset;
+        offset += bins.counts[i];
+    }
+    bins.indices.resize(bins.pairs.size());
+    for (uint32_t pair : bins.pairs)
+        bins.indices[offsets[pair >> 16]++] = pair & 0xFFFF;
+}
+
+void LightClusters::binSlices(bool parallel)
+{
+    if (!parallel || workers.size() == 0)
+    {
+        for (uint32_t z = 0; z < CLUSTER_GRID_Z; z++)
+            binSlice(z);
+        return;
+    }
+
+    // Slices are taken one at a time off a counter, the calling thread works too until none are left
+    std::atomic<uint32_t> next(0);
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t running = workers.size();
+    auto work = [&]()
+    {
+        for (uint32_t z; (z = next++) < CLUSTER_GRID_Z;)
+            binSlice(z);
+    };
+    for (size_t i = 0; i < workers.size(); i++)
+        workers.enqueue([&]()
+                        {
+                            work();
+                            // Notified under the lock, so the waiting thread can't return and take these with it before
+                            std::unique_lock lock(mutex);
+                            running--;
+                            done.notify_one(); });
+    work();
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&]()
+              { return running == 0; });
+}
+
+void LightClusters::gather()
+{
+    ranges.resize(CLUSTER_COUNT);
+    indices.clear();
+    stats.maxPerCluster = stats.dropped = 0;
+    for (uint32_t z = 0; z < CLUSTER_GRID_Z; z++)
+    {
+        const SliceBins &bins = slices[z];
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < CLUSTERS_PER_SLICE; i++)
+        {
+            uint32_t count = bins.counts[i];
+            uint32_t kept = std::min<uint32_t>(count, MAX_CLUSTER_LIGHT_INDICES - (uint32_t)indices.size());
+            ranges[z * CLUSTERS_PER_SLICE + i] = glm::uvec2((uint32_t)indices.size(), kept);
+            indices.insert(indices.end(), bins.indices.begin() + offset, bins.indices.begin() + offset + kept);
+            offset += count;
+            stats.maxPerCluster = std::max<size_t>(stats.maxPerCluster, count);
+            stats.dropped += count - kept;
+        }
+    }
+    stats.lights = lights.size();
+    stats.indices = indices.size();
+}
+
+void LightClusters::upload(const glm::uvec2 &screenSize)
+{
+    if (!lightBuffer)
+    {
+        glGenBuffers(1, &lightBuffer);
+        GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_CLUSTERED_LIGHTS * sizeof(ClusterLight), nullptr, GL_DYNAMIC_DRAW);
+        glGenBuffers(1, &rangeBuffer);
+        GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, rangeBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ClusterHeader) + CLUSTER_COUNT * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_DRAW);
+        glGenBuffers(1, &indexBuffer);
+        GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_CLUSTER_LIGHT_INDICES * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    float logRatio = glm::log(CAMERA_FAR_PLANE / CAMERA_NEAR_PLANE);
+    ClusterHeader header;
+    header.scale = glm::vec4((float)CLUSTER_GRID_X / screenSize.x, (float)CLUSTER_GRID_Y / screenSize.y,
+                             CLUSTER_GRID_Z / logRatio, -(float)CLUSTER_GRID_Z * glm::log(CAMERA_NEAR_PLANE) / logRatio);
+    header.ambient = glm::vec4(ambient, 0.f);
+
+    if (!lights.empty())
+    {
+        GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lights.size() * sizeof(ClusterLight), lights.data());
+    }
+    GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, rangeBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ClusterHeader), &header);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(ClusterHeader), ranges.size() * sizeof(glm::uvec2), ranges.data());
+    if (!indices.empty())
+    {
+        GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(uint32_t), indices.data());
+    }
+
+    GLState::instance().bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHTS_BINDING, lightBuffer);
+    GLState::instance().bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_RANGES_BINDING, rangeBuffer);
+    GLState::instance().bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDICES_BINDING, indexBuffer);
+}
+
+void LightClusters::update(const glm::mat4 &view, const glm::mat4 &projection, const glm::uvec2 &screenSize)
+{
+    using Clock = std::chrono::high_resolution_clock;
+    auto start = Clock::now();
+    buildClusters(projection);
+    prepareVolumes(view);
+    binSlices(lights.size() >= LIGHT_CLUSTER_PARALLEL_THRESHOLD);
+    gather();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    upload(screenSize);
+}
+
+#ifdef DEBUG
+void LightClusters::DebugBenchmark(size_t lightCount, int iterations)
+{
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-CAMERA_FAR_PLANE / 2, CAMERA_FAR_PLANE / 2);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::uniform_real_distribution<float> brightness(0.2f, 1.f);
+
+    // A separate set of clusters so the frame's lights are left alone
+    LightClusters clusters;
+    for (size_t i = 0; i < lightCount; i++)
+    {
+        LightColor color = {glm::vec3(0.f), glm::vec3(brightness(random)), glm::vec3(0.5f)};
+        LightAttenuation attenuation = {1.f, 0.22f, 0.20f};
+        if (i % 4 == 3)
+        {
+            SpotLight light(color, attenuation, {12.5f, 17.5f});
+            light.position = glm::vec3(position(random), position(random) * 0.1f, position(random));
+            light.direction = glm::vec3(unit(random), unit(random) - 1.5f, unit(random));
+            clusters.addSpotLight(light);
+        }
+        else
+        {
+            PointLight light(color, attenuation);
+            light.position = glm::vec3(position(random), position(random) * 0.1f, position(random));
+            clusters.addPointLight(light);
+        }
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f, 2.f, CAMERA_FAR_PLANE / 2), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+    clusters.buildClusters(projection);
+
+    using Clock = std::chrono::high_resolution_clock;
+    auto run = [&](bool parallel)
+    {
+        auto start = Clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            clusters.prepareVolumes(view);
+            clusters.binSlices(parallel);
+            clusters.gather();
+        }
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+    };
+    double single = run(false);
+    size_t singleIndices = clusters.stats.indices;
+    double pooled = run(true);
+    printf("Light clusters over %zu lights (%u clusters): one thread %.3f ms, %zu threads %.3f ms, %zu indices (%zu), %zu max per cluster\n",
+           clusters.stats.lights, CLUSTER_COUNT, single, clusters.workers.size() + 1, pooled, clusters.stats.indices, singleIndices, clusters.stats.maxPerCluster);
+}
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <GLAD/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <ThreadPool.h>
+#include <Graphics/LightCaster.h>
+
+// View space cluster grid: tiles across the screen, slices spaced exponentially in depth between the camera's planes
+constexpr uint32_t CLUSTER_GRID_X = 16;
+constexpr uint32_t CLUSTER_GRID_Y = 9;
+constexpr uint32_t CLUSTER_GRID_Z = 24;
+constexpr uint32_t CLUSTERS_PER_SLICE = CLUSTER_GRID_X * CLUSTER_GRID_Y;
+constexpr uint32_t CLUSTER_COUNT = CLUSTERS_PER_SLICE * CLUSTER_GRID_Z;
+// Lights past this are dropped, the light buffer is allocated for this many
+constexpr uint32_t MAX_CLUSTERED_LIGHTS = 1024;
+// Light indices over all clusters, what doesn't fit is dropped from the clusters at the back
+constexpr uint32_t MAX_CLUSTER_LIGHT_INDICES = CLUSTER_COUNT * 64;
+// Fewer lights than this are binned on the calling thread, the pool isn't worth waking for them
+constexpr size_t LIGHT_CLUSTER_PARALLEL_THRESHOLD = 32;
+
+// Shader storage binding points, shaders declare the buffers with layout(std430, binding = n)
+constexpr GLuint CLUSTER_LIGHTS_BINDING = 2;
+constexpr GLuint CLUSTER_RANGES_BINDING = 3;
+constexpr GLuint CLUSTER_INDICES_BINDING = 4;
+
+// One light as the shader reads it, vec4s only so std430 lays it out like C++ does
+struct ClusterLight
+{
+    glm::vec4 position;    // w is the range
+    glm::vec4 direction;   // w is the cosine of the outer cutoff, -2 for point lights so every direction passes
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+    glm::vec4 attenuation; // constant, linear, quadratic
+};
+
+// Front of the cluster range buffer, the ranges follow it
+struct ClusterHeader
+{
+    // Cluster of a fragment: x and y are clusters per pixel, slice = log(depth) * z + w
+    glm::vec4 scale;
+    // Sum of every clustered light's ambient, lit everywhere as it was when each light added its own
+    glm::vec4 ambient;
+};
+
+struct LightClusterStats
+{
+    size_t lights;
+    size_t indices;
+    size_t maxPerCluster;
+    size_t dropped; // Light indices that didn't fit in MAX_CLUSTER_LIGHT_INDICES
+    double milliseconds;
+};
+
+// Clustered forward lighting. Every frame the lights are added, update bins them into the clusters their range
+// touches and uploads the light list, each cluster's offset and count into the index list, and the index list.
+// Slices are binned in parallel on a thread pool, with four clusters per sphere and cone test where there is SSE
+class LightClusters
+{
+public:
+    static LightClusters &instance()
+    {
+        static LightClusters instance;
+        return instance;
+    }
+
+    void clear();
+    void addPointLight(const PointLight &light);
+    void addSpotLight(const SpotLight &light);
+    // Bins the lights added since clear into the clusters of view and projection, uploads them and binds the buffers
+    void update(const glm::mat4 &view, const glm::mat4 &projection, const glm::uvec2 &screenSize);
+
+    size_t getLightCount() const { return lights.size(); }
+    const LightClusterStats &getStats() const { return stats; }
+
+#ifdef DEBUG
+    // Times binning lightCount random lights on one thread and on the pool, without uploading
+    static void DebugBenchmark(size_t lightCount = 500, int iterations = 100);
+#endif
+
+private:
+    LightClusters() = default;
+
+    // View space shape of a light, what the binning tests against
+    struct LightVolume
+    {
+        glm::vec3 center;
+        float radius;
+        glm::vec3 direction; // Spot lights only
+        float cosine, sine;  // Of the outer cutoff, cosine is -2 for point lights
+        uint32_t firstSlice, lastSlice;
+    };
+    // Light indices of each cluster in one slice, sorted by cluster
+    struct SliceBins
+    {
+        std::vector<uint32_t> candidates; // Lights whose depth range covers the slice
+        std::vector<uint32_t> pairs;      // Cluster in the high 16 bits, light in the low
+        uint32_t counts[CLUSTERS_PER_SLICE];
+        std::vector<uint32_t> indices;
+    };
+
+    std::vector<ClusterLight> lights;
+    std::vector<LightVolume> volumes;
+    glm::vec3 ambient = glm::vec3(0.f);
+
+    // Cluster boxes and bounding spheres in view space, one array per component so four clusters load at once
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+    glm::mat4 clusterProjection = glm::mat4(0.f);
+
+    SliceBins slices[CLUSTER_GRID_Z];
+    std::vector<glm::uvec2> ranges;
+    std::vector<uint32_t> indices;
+
+    ThreadPool workers;
+    GLuint lightBuffer = 0, rangeBuffer = 0, indexBuffer = 0;
+    LightClusterStats stats = {};
+
+    void buildClusters(const glm::mat4 &projection);
+    // View space volumes of the lights, and which slices' candidates each one goes in
+    void prepareVolumes(const glm::mat4 &view);
+    void binSlice(uint32_t slice);
+    // Spreads the slices over the pool, or bins them here when parallel is false
+    void binSlices(bool parallel);
+    void gather();
+    void upload(const glm::uvec2 &screenSize);
+};
@@ -1,4 +1,5 @@
 #include <Graphics/ParticleObject.h>
+#include <Graphics/GLState.h>
 #include <Graphics/GL.h>
 #include <Graphics/Renderer.h>
 
@@ -15,9 +16,9 @@ ParticleObject::ParticleObject(const std::string &texture_path, const std::vecto
 
 ParticleObject::~ParticleObject()
 {
-    glDeleteBuffers(1, &quadVBO);
-    glDeleteBuffers(1, &instanceVBO);
-    glDeleteVertexArrays(1, &quadVAO);
+    GLState::instance().deleteBuffer(quadVBO);
+    GLState::instance().deleteBuffer(instanceVBO);
+    GLState::instance().deleteVertexArray(quadVAO);
 }
 
 void ParticleObject::updateParticles()
@@ -44,7 +45,7 @@ void ParticleObject::updateInstanceBuffer()
 {
     if (particles.size() == deleted_particles)
         return;
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    GLState::instance().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * particles.size(), &particles[0], GL_DYNAMIC_DRAW);
 }
 
@@ -58,8 +59,8 @@ void ParticleObject::generateOpenGLBuffers()
 void ParticleObject::populateOpenGLBuffers()
 {
     // Quad Stuff
-    glBindVertexArray(quadVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    GLState::instance().bindVertexArray(quadVAO);
+    GLState::instance().bindBuffer(GL_ARRAY_BUFFER, quadVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(QuadVertices), QuadVertices, GL_STATIC_DRAW);
 
     // Position attribute (for the quad geometry)
@@ -87,19 +88,19 @@ void ParticleObject::populateOpenGLBuffers()
     glVertexAttribDivisor(6, 1);
 }
 
+static const Uniform<glm::mat4> ModelUniform("model");
+static const Uniform<int> ImageUniform("image");
+
 void ParticleObject::render(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation)
 {
     if (particles.size() == deleted_particles)
         return;
-    // Check for OpenGL errors
-    GLClearError();
 
     shader->use();
-    shader->setMat4("model", transformation);
-    Renderer::instance().slotTexture(GL_TEXTURE_2D, texture->getID(), shader, "image");
+    shader->set(ModelUniform, transformation);
+    Renderer::instance().slotTexture(GL_TEXTURE_2D, texture->getID(), shader, ImageUniform);
 
-    // Bind the VAO, draw instances then unbind
-    glBindVertexArray(quadVAO);
+    // Bind the VAO and draw instances
+    GLState::instance().bindVertexArray(quadVAO);
     GLCall(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, particles.size())); // For a quad, we render 4 vertices per instance
-    glBindVertexArray(0);
 }
\ No newline at end of file
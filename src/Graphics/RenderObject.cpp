@@ -1,6 +1,9 @@
 #include "RenderObject.h"
-#include <Engine/Camera.h>
+#include <Graphics/GLState.h>
 #include <Graphics/GL.h>
+#include <ResourceManager/TextureData.h>
+#include <chrono>
+#include <algorithm>
 
 RenderObject::RenderObject(const std::string &filepath)
     : RenderObject(ResourceManager::instance().getResource<MeshData>(filepath))
@@ -8,23 +11,33 @@ RenderObject::RenderObject(const std::string &filepath)
 }
 RenderObject::RenderObject(const std::shared_ptr<MeshData> &data)
 {
-    if (Meshes[data->filepath] != nullptr)
+    if (HasRenderObject(data->filepath))
         throw std::runtime_error("Mesh already loaded");
     extractGroups(data);
 }
 
 std::shared_ptr<RenderObject> RenderObject::GetRenderObject(const std::string &name)
 {
-    if (Meshes.count(name) != 0)
-        return Meshes[name];
-    Meshes[name] = std::make_shared<RenderObject>(name);
-    return Meshes[name];
+    return GetRenderObject(GetRenderObjectHandle(name));
+}
+
+RenderObjectHandle RenderObject::GetRenderObjectHandle(const std::string &name)
+{
+    auto it = Meshes.find(name);
+    if (it != Meshes.end())
+        return it->second;
+    auto handle = Objects.insert(std::make_shared<RenderObject>(name));
+    Meshes[name] = handle;
+    return handle;
 }
 
 std::shared_ptr<RenderObject> RenderObject::AddRenderObject(const std::string &name, std::shared_ptr<RenderObject> object)
 {
-    Meshes[name] = object;
-    return Meshes[name];
+    auto it = Meshes.find(name);
+    if (it != Meshes.end())
+        Objects.remove(it->second);
+    Meshes[name] = Objects.insert(object);
+    return object;
 }
 
 bool RenderObject::HasRenderObject(const std::string &name)
@@ -34,36 +47,73 @@ bool RenderObject::HasRenderObject(const std::string &name)
 
 void RenderObject::ReleaseAllMeshes()
 {
+    Objects.clear();
     Meshes.clear();
 }
 
 void RenderObject::Purge()
 {
-    std::vector<std::string> purgeList = {};
-    for (auto &kvp : Meshes)
+    for (auto it = Meshes.begin(); it != Meshes.end();)
     {
-        if (kvp.second.use_count() <= 1)
+        if (Objects.get(it->second).use_count() <= 1)
         {
-            purgeList.push_back(kvp.first);
+            printf("Purged render object %s\n", it->first.c_str());
+            Objects.remove(it->second);
+            it = Meshes.erase(it);
         }
+        else
+            it++;
     }
+}
 
-    for (auto &name : purgeList)
+void RenderObject::DebugUseCounts()
+{
+    for (auto &kvp : Meshes)
     {
-        Meshes.erase(name);
-        printf("Purged render object %s\n", name.c_str());
+        printf("Render object %s has %ld uses\n", kvp.first.c_str(), Objects.get(kvp.second).use_count());
     }
 }
 
-void RenderObject::DebugUseCounts()
+#ifdef DEBUG
+void RenderObject::DebugBenchmarkLookups(size_t iterations)
 {
+    if (Meshes.empty())
+        return;
+
+    // The previous storage, shared_ptrs by name and returned by value
+    std::unordered_map<std::string, std::shared_ptr<RenderObject>> byName;
+    std::vector<std::string> names;
+    std::vector<RenderObjectHandle> handles;
     for (auto &kvp : Meshes)
     {
-        printf("Render object %s has %ld uses\n", kvp.first.c_str(), kvp.second.use_count());
+        byName[kvp.first] = Objects.get(kvp.second);
+        names.push_back(kvp.first);
+        handles.push_back(kvp.second);
+    }
+
+    size_t groupCount = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        std::shared_ptr<RenderObject> object = byName[names[i % names.size()]];
+        groupCount += object->groups.size();
     }
+    auto middle = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        const auto &object = GetRenderObject(handles[i % handles.size()]);
+        groupCount += object->groups.size();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double byNameNs = std::chrono::duration<double, std::nano>(middle - start).count() / iterations;
+    double byHandleNs = std::chrono::duration<double, std::nano>(end - middle).count() / iterations;
+    printf("Render object lookup over %zu objects: name %.2f ns, handle %.2f ns (%zu groups)\n", names.size(), byNameNs, byHandleNs, groupCount);
 }
+#endif
 
-std::unordered_map<std::string, std::shared_ptr<RenderObject>> RenderObject::Meshes = {};
+SlotArray<RenderObject> RenderObject::Objects = {};
+std::unordered_map<std::string, RenderObjectHandle> RenderObject::Meshes = {};
 
 void pushVertexData(MeshGroup &group, std::vector<float> *vertexData, const std::array<VertexAttrib, INDEX_PER_VERTEX> &attribs)
 {
@@ -90,6 +140,9 @@ void RenderObject::extractGroups(const std::shared_ptr<MeshData> &data)
     {
         groups.push_back(RenderGroup(data, g.name));
     }
+    const auto &positions = data->getAttribs()[POSITION_OFFSET].values;
+    for (size_t i = 0; i + 2 < positions.size(); i += 3)
+        bounds.expand(glm::vec3(positions[i], positions[i + 1], positions[i + 2]));
 }
 
 void RenderObject::render(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation)
@@ -140,8 +193,8 @@ void RenderGroup::generateOpenGLBuffers()
 
 void RenderGroup::populateOpenGLBuffers()
 {
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLState::instance().bindVertexArray(VAO);
+    GLState::instance().bindBuffer(GL_ARRAY_BUFFER, VBO);
     // Flatten vertex data (positions, normals, and UVs)
     std::vector<float> vertexData;
     pushVertexData(data->getGroup(name), &vertexData, data->getAttribs());
@@ -158,99 +211,180 @@ void RenderGroup::populateOpenGLBuffers()
         defineVertexAttrib(i, ATTRIB_STRIDE[i], stride, offset);
 
     // Unbind the VAO and buffers
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GLState::instance().bindBuffer(GL_ARRAY_BUFFER, 0);
+    GLState::instance().bindVertexArray(0);
+
+    const auto &group = data->getGroup(name);
+    textureArray = std::make_shared<TextureArrayObject>(group.getUsedTextures());
 
-    textureArray = std::make_shared<TextureArrayObject>(data->getGroup(name).getUsedTextures());
+    material = group.material;
+    drawMode = getDrawMode();
+    vertexCount = data->getFaceCount(group) * data->getVertexPerFace(group);
+
+    diffuseIndex = specularIndex = normalIndex = displacementIndex = -1;
+    for (size_t i = 0; i < textureArray->getDatas().size(); i++)
+    {
+        const std::string &textureName = textureArray->getDatas()[i]->getName();
+        if (textureName == material->diffuseTexture)
+            diffuseIndex = i;
+        else if (textureName == material->specularTexture)
+            specularIndex = i;
+        else if (textureName == material->normalMap)
+            normalIndex = i;
+        else if (textureName == material->dispMap)
+            displacementIndex = i;
+    }
+    materialFeatures = (diffuseIndex != -1 ? SHADER_FEATURE_DIFFUSE_MAP : 0) |
+                       (specularIndex != -1 ? SHADER_FEATURE_SPECULAR_MAP : 0) |
+                       (normalIndex != -1 ? SHADER_FEATURE_NORMAL_MAP : 0) |
+                       (displacementIndex != -1 ? SHADER_FEATURE_DISPLACEMENT_MAP : 0);
 }
 
 void RenderGroup::reuploadToGLBuffers()
 {
-    glDeleteBuffers(1, &VBO);
-    glDeleteVertexArrays(1, &VAO);
+    GLState::instance().deleteBuffer(VBO);
+    GLState::instance().deleteVertexArray(VAO);
+    if (instanceVBO)
+        GLState::instance().deleteBuffer(instanceVBO);
+    instanceVBO = 0;
+    instanceTransformations.clear();
+    instanceCapacity = 0;
 
     generateOpenGLBuffers();
     populateOpenGLBuffers();
 }
 
-#include <ResourceManager/TextureData.h>
 #include <Engine/LightNode.h>
 #include "Renderer.h"
 
-void RenderGroup::render(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation)
+static const Uniform<glm::vec3> MaterialDiffuseUniform("material.diffuse");
+static const Uniform<glm::vec3> MaterialSpecularUniform("material.specular");
+static const Uniform<float> MaterialShininessUniform("material.shininess");
+static const Uniform<float> MaterialDissolveUniform("material.dissolve");
+static const Uniform<int> MaterialDiffuseIndexUniform("material.diffuseIndex");
+static const Uniform<int> MaterialSpecularIndexUniform("material.specularIndex");
+static const Uniform<int> MaterialNormalIndexUniform("material.normalIndex");
+static const Uniform<int> MaterialDisplacementIndexUniform("material.displacementIndex");
+static const Uniform<int> MaterialTexturesUniform("material.textures");
+static const Uniform<glm::mat4> ModelUniform("model");
+
+void RenderGroup::render(const std::shared_ptr<ShaderObject> &baseShader, const glm::mat4 &transformation)
 {
-    // Check for OpenGL errors
-    GLClearError();
-
-    // Bind the VAO for rendering
-    GLCall(glBindVertexArray(VAO));
-
-    shader->use();
+    // Only the code this material and the active lights need, falls back to baseShader if it has no variants
+    const auto &shader = Renderer::instance().getShaderVariant(baseShader, materialFeatures | LightNode::ActiveLightFeatures);
 
-    // Set material properties (e.g., diffuse color)
-    const auto &material = data->getGroup(name).material;
-    shader->setVec3("material.diffuse", material->diffuse);
-    shader->setVec3("material.specular", material->specular);
-    shader->setFloat("material.shininess", material->shininess);
-
-    shader->setInt("material.diffuseIndex", -1);
-    shader->setInt("material.specularIndex", -1);
-    shader->setInt("material.normalIndex", -1);
-    shader->setInt("material.displacementIndex", -1);
-
-    for (size_t i = 0; i < textureArray->getDatas().size(); i++)
-    {
-        if (textureArray->getDatas()[i]->getName() == material->diffuseTexture)
-        {
-            shader->setInt("material.diffuseIndex", i);
-        }
-        else if (textureArray->getDatas()[i]->getName() == material->specularTexture)
-        {
-            shader->setInt("material.specularIndex", i);
-        }
-        else if (textureArray->getDatas()[i]->getName() == material->normalMap)
-        {
-            shader->setInt("material.normalIndex", i);
-        }
-        else if (textureArray->getDatas()[i]->getName() == material->dispMap)
-        {
-            shader->setInt("material.displacementIndex", i);
-        }
-    }
+    bindShader(shader);
+    bindMaterial(shader);
+    draw(shader, transformation);
 
-    Renderer::instance().slotTexture(GL_TEXTURE_2D_ARRAY, textureArray->getID(), shader, "material.textures");
+    Renderer::instance().resetTextureSlots();
+}
 
-    shader->setMat4("model", transformation);
+void RenderGroup::bindShader(const std::shared_ptr<ShaderObject> &shader)
+{
+    shader->use();
+    Renderer::instance().resetTextureSlots(MATERIAL_TEXTURE_SLOT + 1);
 
     // shader->setVec3("dirLight.direction", glm::vec3(0.f, -1.f, 0.f));
     // shader->setVec3("dirLight.color.ambient", glm::vec3(0.0125f, 0.0125f, 0.0125f));
     // shader->setVec3("dirLight.color.diffuse", glm::vec3(0.5f, 0.5f, 0.5f));
     // shader->setVec3("dirLight.color.specular", glm::vec3(0.5f, 0.5f, 0.5f));
 
-    shader->setVec3("viewPos", mainCamera.position);
+    // Camera and lights come from the frame uniform blocks, only the model matrix and material are set per draw
+}
 
-    LightNode::SetActiveLightUniforms(shader);
+void RenderGroup::bindMaterial(const std::shared_ptr<ShaderObject> &shader) const
+{
+    // Set material properties (e.g., diffuse color)
+    shader->set(MaterialDiffuseUniform, material->diffuse);
+    shader->set(MaterialSpecularUniform, material->specular);
+    shader->set(MaterialShininessUniform, material->shininess);
+    shader->set(MaterialDissolveUniform, material->dissolve);
+
+    shader->set(MaterialDiffuseIndexUniform, diffuseIndex);
+    shader->set(MaterialSpecularIndexUniform, specularIndex);
+    shader->set(MaterialNormalIndexUniform, normalIndex);
+    shader->set(MaterialDisplacementIndexUniform, displacementIndex);
+
+    GLState::instance().bindTexture(MATERIAL_TEXTURE_SLOT, GL_TEXTURE_2D_ARRAY, textureArray->getID());
+    shader->set(MaterialTexturesUniform, MATERIAL_TEXTURE_SLOT);
+}
+
+void RenderGroup::draw(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation, GLsizei views) const
+{
+    // Bind the VAO for rendering, left bound for the next draw of the same mesh
+    GLState::instance().bindVertexArray(VAO);
+
+    shader->set(ModelUniform, transformation);
 
     // Draw the mesh
-    GLCall(glDrawArrays(getDrawMode(), 0, data->getFaceCount(name) * data->getVertexPerFace(name)));
+    if (views > 1)
+    {
+        GLCall(glDrawArraysInstanced(drawMode, 0, vertexCount, views));
+    }
+    else
+    {
+        GLCall(glDrawArrays(drawMode, 0, vertexCount));
+    }
+}
 
-    // Unbind the VAO
-    glBindVertexArray(0);
+void RenderGroup::drawInstanced(const std::vector<glm::mat4> &transformations) const
+{
+    auto &state = GLState::instance();
+    state.bindVertexArray(VAO);
+    if (!instanceVBO)
+    {
+        glGenBuffers(1, &instanceVBO);
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // A mat4 attribute is four vec4 columns, each advancing once per instance
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            GLuint location = INSTANCE_ATTRIB_LOCATION + i;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(i * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+    }
+    else
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
 
-    Renderer::instance().resetTextureSlots();
+    size_t count = transformations.size();
+    if (count > instanceCapacity)
+    {
+        // Grown in powers of two so a growing crowd doesn't reallocate every frame
+        instanceCapacity = std::max<size_t>(instanceCapacity * 2, 16);
+        while (instanceCapacity < count)
+            instanceCapacity *= 2;
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), transformations.data());
+        instanceTransformations = transformations;
+    }
+    else
+    {
+        // Static instances keep their matrices, upload from the first to the last one that moved
+        size_t first = 0, last = count;
+        size_t common = std::min(count, instanceTransformations.size());
+        while (first < common && transformations[first] == instanceTransformations[first])
+            first++;
+        if (count <= instanceTransformations.size())
+            while (last > first && transformations[last - 1] == instanceTransformations[last - 1])
+                last--;
+        instanceTransformations.resize(count);
+        if (first < last)
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::mat4), (last - first) * sizeof(glm::mat4), transformations.data() + first);
+            std::copy(transformations.begin() + first, transformations.begin() + last, instanceTransformations.begin() + first);
+        }
+    }
 
-    // Check for OpenGL errors
-    ASSERT(GLLogCall("glDrawElements", __FILE__, __LINE__));
+    GLCall(glDrawArraysInstanced(drawMode, 0, vertexCount, count));
 }
 
 void RenderGroup::renderRaw()
 {
     // Bind the VAO for rendering
-    glBindVertexArray(VAO);
+    GLState::instance().bindVertexArray(VAO);
 
     // Draw the mesh
-    GLCall(glDrawArrays(getDrawMode(), 0, data->getFaceCount(name) * data->getVertexPerFace(name)));
-
-    // Unbind the VAO
-    glBindVertexArray(0);
+    GLCall(glDrawArrays(drawMode, 0, vertexCount));
 }
\ No newline at end of file
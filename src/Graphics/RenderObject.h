@@ -10,15 +10,25 @@
 #include <Graphics/ShaderObject.h>
 #include <Graphics/TextureObject.h>
 #include "TextureArrayObject.h"
+#include <Graphics/Frustum.h>
+#include <SlotArray.h>
 
 class RenderObject;
 
+// Unit the group's texture array goes to, shadow maps and the rest are slotted after it
+constexpr int MATERIAL_TEXTURE_SLOT = 0;
+// First of the four attributes holding the per instance model matrix, right after the vertex attributes
+constexpr unsigned int INSTANCE_ATTRIB_LOCATION = INDEX_PER_VERTEX;
+
+using RenderObjectHandle = Handle<RenderObject>;
+
 class RenderGroup
 {
 public:
     GLenum getDrawMode() const;
 
     friend class RenderObject;
+    friend class RenderQueue;
 
     RenderGroup(const std::shared_ptr<MeshData> &data, const std::string &name);
 
@@ -30,6 +40,13 @@ private:
     std::string name;
     GLuint VAO, VBO;
 
+    // Resolved from the group by name once per upload, render doesn't touch strings
+    std::shared_ptr<Material> material;
+    GLenum drawMode;
+    GLsizei vertexCount;
+    int diffuseIndex, specularIndex, normalIndex, displacementIndex; // Layers in textureArray, -1 if unused
+    ShaderFeatures materialFeatures = 0; // Material half of the variant key, from the indices above
+
     void generateOpenGLBuffers();
     void populateOpenGLBuffers();
 
@@ -38,7 +55,21 @@ private:
     void render(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation);
     void renderRaw();
 
+    // render split by how often each part changes, the render queue only redoes what changed since the last draw.
+    // bindShader leaves texture unit 0 for bindMaterial's texture array
+    static void bindShader(const std::shared_ptr<ShaderObject> &shader);
+    void bindMaterial(const std::shared_ptr<ShaderObject> &shader) const;
+    // views above 1 repeats the draw as that many instances, for shaders that send each instance to its own layer
+    void draw(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation, GLsizei views = 1) const;
+    // One draw for every transformation, needs a SHADER_FEATURE_INSTANCED variant bound
+    void drawInstanced(const std::vector<glm::mat4> &transformations) const;
+
     std::shared_ptr<TextureArrayObject> textureArray;
+
+    // Model matrices of the last instanced draw, created with it. Only the range that changed since is uploaded
+    mutable GLuint instanceVBO = 0;
+    mutable std::vector<glm::mat4> instanceTransformations;
+    mutable size_t instanceCapacity = 0;
 };
 
 class RenderObject
@@ -52,7 +83,14 @@ public:
     void render(const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation);
     void renderRaw();
 
+    // Around every vertex position of the mesh, in model space
+    const AABB &getBounds() const { return bounds; }
+
     static std::shared_ptr<RenderObject> GetRenderObject(const std::string &name);
+    // Interns the name once, loading the mesh if needed. Hold on to the handle instead of the name
+    static RenderObjectHandle GetRenderObjectHandle(const std::string &name);
+    // Null if the object was purged or released since the handle was taken
+    static const std::shared_ptr<RenderObject> &GetRenderObject(RenderObjectHandle handle) { return Objects.get(handle); }
     static std::shared_ptr<RenderObject> AddRenderObject(const std::string &name, std::shared_ptr<RenderObject> object);
     static bool HasRenderObject(const std::string &name);
     static void ReleaseAllMeshes();
@@ -60,11 +98,18 @@ public:
     static void Purge();
 
     static void DebugUseCounts();
+#ifdef DEBUG
+    // Times name lookups in a string keyed map against handle lookups over the loaded objects
+    static void DebugBenchmarkLookups(size_t iterations = 1000000);
+#endif
 
 private:
+    AABB bounds;
+
     void extractGroups(const std::shared_ptr<MeshData> &data);
 
-    static std::unordered_map<std::string, std::shared_ptr<RenderObject>> Meshes;
+    static SlotArray<RenderObject> Objects;
+    static std::unordered_map<std::string, RenderObjectHandle> Meshes;
 };
 
 void pushVertexData(MeshGroup &group, std::vector<float> *vertexData, const std::array<VertexAttrib, INDEX_PER_VERTEX> &attribs);
\ No newline at end of file
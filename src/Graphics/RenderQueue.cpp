@@ -0,0 +1,342 @@
+#include <Graphics/RenderQueue.h>
+#include <Graphics/RenderObject.h>
+#include <Graphics/Renderer.h>
+#include <Graphics/GLState.h>
+#include <Engine/Camera.h>
+#include <Engine/LightNode.h>
+#include <Engine/SpatialIndex.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include <typeinfo>
+
+RenderQueueStats RenderQueue::FrameStats = {};
+RenderQueueStats RenderQueue::LastFrameStats = {};
+GLsizei RenderQueue::ViewInstances = 1;
+
+// Key layout, most significant first. Fields are truncated ids, a collision only costs ordering,
+// submit compares the real objects before skipping a change
+//   solid, skybox: pass 2 | shader 10 | texture array 12 | material 12 | VAO 12 | depth 16
+//   blended:       pass 2 | far to near depth 16 | shader 10 | texture array 12 | material 12 | VAO 12
+static uint64_t makeKey(RenderPass pass, uint32_t shader, uint32_t textures, uint32_t material, uint32_t vao, float depth)
+{
+    uint64_t quantized = (uint64_t)(glm::clamp(depth / RENDER_QUEUE_DEPTH_RANGE, 0.f, 1.f) * 0xFFFF);
+    uint64_t state = ((uint64_t)(shader & 0x3FF) << 36) | ((uint64_t)(textures & 0xFFF) << 24) |
+                     ((uint64_t)(material & 0xFFF) << 12) | (uint64_t)(vao & 0xFFF);
+    uint64_t key = (uint64_t)pass << 62;
+    if (pass == RenderPass::BLENDED)
+        return key | ((0xFFFF - quantized) << 46) | state;
+    return key | (state << 16) | quantized;
+}
+
+static float getViewDepth(const glm::mat4 &transformation)
+{
+    return glm::dot(glm::vec3(transformation[3]) - mainCamera.position, mainCamera.front);
+}
+
+// Materials have no id of their own, their address is stable while anything draws with them
+static uint32_t getMaterialId(const Material *material)
+{
+    return (uint32_t)((uintptr_t)material >> 4);
+}
+
+void RenderQueue::clear()
+{
+    packets.clear();
+    entries.clear();
+}
+
+size_t RenderQueue::collect(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum *frustum)
+{
+    candidates.clear();
+    candidateBounds.clear();
+    AABB bounds;
+    size_t unbounded = 0;
+    root->traverse([&](Node *node)
+                   {
+        auto *cast = dynamic_cast<Renderable *>(node);
+        if (!cast || (ignore_forced_shaders && cast->forced_shader != -1) || !cast->enabled || !cast->visible)
+            return;
+        if (frustum && cast->getWorldBounds(bounds))
+        {
+            candidates.push_back(cast);
+            candidateBounds.push(bounds);
+        }
+        else
+        {
+            cast->enqueue(*this, shader);
+            unbounded++;
+        } });
+
+    if (candidates.empty())
+    {
+        FrameStats.visible += unbounded;
+        return unbounded;
+    }
+    size_t visible = frustum->cull(candidateBounds, candidateVisible);
+    for (size_t i = 0; i < candidates.size(); i++)
+        if (candidateVisible[i])
+            candidates[i]->enqueue(*this, shader);
+    FrameStats.visible += unbounded + visible;
+    FrameStats.culled += candidates.size() - visible;
+    return unbounded + visible;
+}
+
+size_t RenderQueue::collect(const SpatialIndex &index, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum &frustum)
+{
+    size_t found = 0, enqueued = 0;
+    index.queryFrustum(frustum, [&](Renderable *node)
+                       {
+        found++;
+        if ((ignore_forced_shaders && node->forced_shader != -1) || !node->enabled || !node->visible)
+            return;
+        node->enqueue(*this, shader);
+        enqueued++; });
+    const auto &stats = index.getStats();
+    FrameStats.visible += enqueued;
+    FrameStats.culled += stats.staticNodes + stats.dynamicNodes + stats.unboundedNodes - found;
+    return enqueued;
+}
+
+void RenderQueue::push(uint64_t key, const Packet &packet)
+{
+    entries.push_back({key, (uint32_t)packets.size()});
+    packets.push_back(packet);
+}
+
+void RenderQueue::pushObject(const RenderObject &object, const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation)
+{
+    auto &renderer = Renderer::instance();
+    float depth = getViewDepth(transformation);
+    for (const auto &group : object.groups)
+    {
+        ShaderFeatures features = group.materialFeatures | LightNode::ActiveLightFeatures;
+        const auto &variant = renderer.getShaderVariant(shader, features);
+        RenderPass pass = group.material->isTransparent() ? RenderPass::BLENDED : RenderPass::SOLID;
+        uint64_t key = makeKey(pass, variant->getID(), group.textureArray->getID(), getMaterialId(group.material.get()), group.VAO, depth);
+        push(key, {&variant, &shader, features, &group, nullptr, &transformation});
+    }
+}
+
+void RenderQueue::pushNode(RenderPass pass, Renderable *node, const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<ShaderObject> &resolvedShader)
+{
+    uint64_t key = makeKey(pass, resolvedShader->getID(), 0, 0, 0, getViewDepth(node->transform.globalTransform));
+    push(key, {&shader, &shader, 0, nullptr, node, &node->transform.globalTransform});
+}
+
+size_t RenderQueue::getInstanceRun(size_t first) const
+{
+    const Packet &packet = packets[entries[first].packet];
+    if (!packet.group || !(*packet.baseShader)->hasInstancing() || ViewInstances > 1)
+        return 1;
+    size_t last = first + 1;
+    while (last < entries.size())
+    {
+        const Packet &next = packets[entries[last].packet];
+        if (next.group != packet.group || next.shader->get() != packet.shader->get())
+            break;
+        last++;
+    }
+    return last - first >= RENDER_QUEUE_MIN_INSTANCES ? last - first : 1;
+}
+
+void RenderQueue::sort()
+{
+    if (entries.size() < 2)
+        return;
+    // LSD radix sort, a byte per pass
+    scratch.resize(entries.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[256] = {};
+        for (const auto &entry : entries)
+            counts[(entry.key >> shift) & 0xFF]++;
+        // Every key has the same byte here, the pass wouldn't move anything
+        if (counts[(entries[0].key >> shift) & 0xFF] == entries.size())
+            continue;
+        size_t offset = 0;
+        for (auto &count : counts)
+        {
+            size_t bucket = count;
+            count = offset;
+            offset += bucket;
+        }
+        for (const auto &entry : entries)
+            scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+        entries.swap(scratch);
+    }
+}
+
+void RenderQueue::submit()
+{
+    auto &renderer = Renderer::instance();
+    auto &state = GLState::instance();
+    RenderQueueStats &stats = FrameStats;
+
+    const ShaderObject *lastShader = nullptr;
+    const Material *lastMaterial = nullptr;
+    GLuint lastTextures = 0, lastVertexArray = 0;
+    bool blending = false;
+    for (size_t i = 0; i < entries.size();)
+    {
+        const SortEntry &entry = entries[i];
+        const Packet &packet = packets[entry.packet];
+        bool blended = (RenderPass)(entry.key >> 62) == RenderPass::BLENDED;
+        if (blended != blending)
+        {
+            // Blended surfaces are tested against the depth buffer but don't write to it
+            state.setEnabled(GL_BLEND, blended);
+            state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            state.depthMask(blended ? GL_FALSE : GL_TRUE);
+            blending = blended;
+        }
+
+        if (!packet.group)
+        {
+            packet.node->render(*packet.shader);
+            // Nodes bind whatever they need, nothing carries over
+            lastShader = nullptr;
+            lastMaterial = nullptr;
+            lastVertexArray = 0;
+            stats.draws++;
+            stats.instances++;
+            stats.shaderChanges++;
+            i++;
+            continue;
+        }
+
+        size_t run = getInstanceRun(i);
+        const auto &shader = run > 1 ? renderer.getShaderVariant(*packet.baseShader, packet.features | SHADER_FEATURE_INSTANCED) : *packet.shader;
+        const RenderGroup &group = *packet.group;
+        if (shader.get() != lastShader)
+        {
+            RenderGroup::bindShader(shader);
+            lastShader = shader.get();
+            lastMaterial = nullptr;
+            stats.shaderChanges++;
+        }
+        if (group.material.get() != lastMaterial || group.textureArray->getID() != lastTextures)
+        {
+            group.bindMaterial(shader);
+            lastMaterial = group.material.get();
+            lastTextures = group.textureArray->getID();
+            stats.materialChanges++;
+        }
+        if (group.VAO != lastVertexArray)
+        {
+            lastVertexArray = group.VAO;
+            stats.vertexArrayChanges++;
+        }
+
+        if (run > 1)
+        {
+            // Traversal order instead of depth order, so instances that didn't move keep their place in the buffer
+            runPackets.clear();
+            for (size_t j = i; j < i + run; j++)
+                runPackets.push_back(entries[j].packet);
+            std::sort(runPackets.begin(), runPackets.end());
+            instanceTransformations.clear();
+            for (uint32_t index : runPackets)
+                instanceTransformations.push_back(*packets[index].transformation);
+            group.drawInstanced(instanceTransformations);
+        }
+        else
+            group.draw(shader, *packet.transformation, ViewInstances);
+        stats.draws++;
+        stats.instances += run;
+        i += run;
+    }
+
+    if (blending)
+    {
+        state.disable(GL_BLEND);
+        state.depthMask(GL_TRUE);
+    }
+    renderer.resetTextureSlots();
+}
+
+RenderQueueStats RenderQueue::countStateChanges() const
+{
+    RenderQueueStats stats = {};
+    const ShaderObject *lastShader = nullptr;
+    const Material *lastMaterial = nullptr;
+    GLuint lastVertexArray = 0;
+    for (size_t i = 0; i < entries.size();)
+    {
+        const Packet &packet = packets[entries[i].packet];
+        size_t run = getInstanceRun(i);
+        stats.draws++;
+        stats.instances += run;
+        i += run;
+        // Instanced variants are left out, they change along with the variant they come from
+        if (packet.shader->get() != lastShader)
+        {
+            lastShader = packet.shader->get();
+            lastMaterial = nullptr;
+            stats.shaderChanges++;
+        }
+        if (!packet.group)
+            continue;
+        if (packet.group->material.get() != lastMaterial)
+        {
+            lastMaterial = packet.group->material.get();
+            stats.materialChanges++;
+        }
+        if (packet.group->VAO != lastVertexArray)
+        {
+            lastVertexArray = packet.group->VAO;
+            stats.vertexArrayChanges++;
+        }
+    }
+    return stats;
+}
+
+void RenderQueue::EndFrame()
+{
+    LastFrameStats = FrameStats;
+    FrameStats = {};
+}
+
+#ifdef DEBUG
+void RenderQueue::DebugBenchmarkStateChanges(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, size_t nodeCount)
+{
+    // Plain meshes only, skyboxes and billboards bring their own state
+    std::set<std::string> meshSet;
+    root->traverse([&](Node *node)
+                   { if (typeid(*node) == typeid(Renderable)) meshSet.insert(static_cast<Renderable *>(node)->render_name); });
+    if (meshSet.empty())
+    {
+        printf("Render queue benchmark: no meshes in the scene\n");
+        return;
+    }
+    std::vector<std::string> meshes(meshSet.begin(), meshSet.end());
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-RENDER_QUEUE_DEPTH_RANGE / 2, RENDER_QUEUE_DEPTH_RANGE / 2);
+    NodePtr scene = makeNode<Transformable>("benchmark");
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        auto node = makeNode<Renderable>("benchmark" + std::to_string(i));
+        node->render_name = meshes[random() % meshes.size()];
+        node->transform.setLocalPosition(glm::vec3(position(random), position(random), position(random)));
+        scene->addChild(node);
+    }
+    updateSceneGraph(scene);
+
+    RenderQueue queue;
+    auto start = std::chrono::high_resolution_clock::now();
+    queue.collect(scene, shader, false);
+    auto collected = std::chrono::high_resolution_clock::now();
+    RenderQueueStats unsorted = queue.countStateChanges();
+    auto sortStart = std::chrono::high_resolution_clock::now();
+    queue.sort();
+    auto end = std::chrono::high_resolution_clock::now();
+    RenderQueueStats sorted = queue.countStateChanges();
+
+    printf("Render queue over %zu draws from %zu meshes: collect %.2f ms, sort %.2f ms\n", queue.size(), meshes.size(),
+           std::chrono::duration<double, std::milli>(collected - start).count(), std::chrono::duration<double, std::milli>(end - sortStart).count());
+    printf("  scene order: %zu draws, %zu shader, %zu material, %zu VAO changes\n", unsorted.draws, unsorted.shaderChanges, unsorted.materialChanges, unsorted.vertexArrayChanges);
+    printf("  sorted:      %zu draws, %zu shader, %zu material, %zu VAO changes\n", sorted.draws, sorted.shaderChanges, sorted.materialChanges, sorted.vertexArrayChanges);
+}
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include <Graphics/ShaderObject.h>
+#include <Graphics/Frustum.h>
+#include <Engine/SceneGraph.h>
+
+class RenderGroup;
+class SpatialIndex;
+
+// Runs of at least this many draws of the same group become one instanced draw
+constexpr size_t RENDER_QUEUE_MIN_INSTANCES = 2;
+
+// Depth is quantized over this distance from the camera, the far plane of the main projection
+constexpr float RENDER_QUEUE_DEPTH_RANGE = 100.f;
+
+// Highest bits of the sort key, passes are submitted in this order
+enum class RenderPass : uint8_t
+{
+    SOLID = 0,
+    SKYBOX = 1, // After solid geometry so it only fills what's left
+    BLENDED = 2,
+};
+
+struct RenderQueueStats
+{
+    size_t draws;     // Draw calls, an instanced run is one
+    size_t instances; // Packets drawn
+    size_t visible;   // Renderables that passed culling, or weren't culled at all
+    size_t culled;
+    size_t shaderChanges;
+    size_t materialChanges;
+    size_t vertexArrayChanges;
+};
+
+// Draws gathered from the scene graph, sorted so programs, texture arrays and VAOs change as rarely as possible.
+// Solid draws sort by state and then front to back, blended ones back to front first.
+// Packets of the same group next to each other after sorting are drawn instanced when the shader supports it
+class RenderQueue
+{
+public:
+    struct Packet
+    {
+        const std::shared_ptr<ShaderObject> *shader;     // Variant for groups, the shader passed to render for nodes
+        const std::shared_ptr<ShaderObject> *baseShader; // What the variant came from, for the instanced one
+        ShaderFeatures features;
+        const RenderGroup *group;                        // Null for nodes that draw themselves
+        Renderable *node;
+        const glm::mat4 *transformation;
+    };
+
+    void clear();
+    // Every Renderable under root enqueues itself, nodes with a forced shader are skipped if asked.
+    // With a frustum, nodes whose bounds lie outside it are dropped before anything is enqueued.
+    // Returns how many nodes were enqueued
+    size_t collect(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum *frustum = nullptr);
+    // Same, with the nodes the index finds in frustum instead of a walk over the graph
+    size_t collect(const SpatialIndex &index, const std::shared_ptr<ShaderObject> &shader, bool ignore_forced_shaders, const Frustum &frustum);
+    // A packet per group, with the shader variant the group needs
+    void pushObject(const RenderObject &object, const std::shared_ptr<ShaderObject> &shader, const glm::mat4 &transformation);
+    // For nodes with their own render, called back at their place in the order
+    void pushNode(RenderPass pass, Renderable *node, const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<ShaderObject> &resolvedShader);
+    void sort();
+    void submit();
+
+    size_t size() const { return entries.size(); }
+    // Changes the current order would cause, without drawing
+    RenderQueueStats countStateChanges() const;
+
+    // Summed over every queue submitted this frame, EndFrame moves them to LastFrameStats
+    static RenderQueueStats FrameStats;
+    static RenderQueueStats LastFrameStats;
+    static void EndFrame();
+
+    // Every group is drawn as this many instances, set while a layered shader writes gl_Layer from gl_InstanceID.
+    // Instanced runs are off while it is above 1
+    static GLsizei ViewInstances;
+
+#ifdef DEBUG
+    // Fills a scene with nodeCount copies of the meshes under root and compares state changes in scene order and sorted
+    static void DebugBenchmarkStateChanges(const NodePtr &root, const std::shared_ptr<ShaderObject> &shader, size_t nodeCount = 10000);
+#endif
+
+private:
+    struct SortEntry
+    {
+        uint64_t key;
+        uint32_t packet;
+    };
+
+    std::vector<Packet> packets;
+    std::vector<SortEntry> entries, scratch;
+
+    // Culling candidates of the current collect, tested in one batch
+    std::vector<Renderable *> candidates;
+    AABBList candidateBounds;
+    std::vector<uint8_t> candidateVisible;
+
+    std::vector<uint32_t> runPackets;
+    std::vector<glm::mat4> instanceTransformations;
+
+    void push(uint64_t key, const Packet &packet);
+    // Entries from first on that can go in one instanced draw, 1 if the packet draws alone
+    size_t getInstanceRun(size_t first) const;
+};
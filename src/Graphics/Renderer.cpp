@@ -1,4 +1,6 @@
 #include <Graphics/Renderer.h>
+#include <Graphics/GLState.h>
+#include <Graphics/RenderQueue.h>
 #include <Engine/Camera.h>
 #include "Renderer.h"
 
@@ -6,6 +8,10 @@
 #include <ResourceManager/ShaderData.h>
 #include "InputManager/InputManager.h"
 #include <Engine/LightNode.h>
+#include <Graphics/GLExtensions.h>
+#include <Graphics/GLDebug.h>
+#include <Graphics/UniformBufferObject.h>
+#include <chrono>
 
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 {
@@ -20,6 +26,8 @@ Renderer::Renderer()
 Renderer::~Renderer()
 {
     shaders.clear();
+    shaderKeys.clear();
+    cameraUniforms.reset();
     cleanup();
 }
 
@@ -59,17 +67,22 @@ glm::dvec2 Renderer::getDeltaMouse() const
     return deltaMouse;
 }
 
-std::shared_ptr<ShaderObject> Renderer::getShader(int key) const
+const std::shared_ptr<ShaderObject> &Renderer::getShader(int key) const
 {
-    assert(shaders.find(key) != shaders.end());
-    return shaders.at(key);
+    return shaders.get(getShaderHandle(key));
 }
 
-std::shared_ptr<ShaderObject> Renderer::getSkyboxShader() const
+const std::shared_ptr<ShaderObject> &Renderer::getSkyboxShader() const
 {
     return getShader(skyboxShader);
 }
 
+ShaderHandle Renderer::getShaderHandle(int key) const
+{
+    assert(shaderKeys.find(key) != shaderKeys.end());
+    return shaderKeys.at(key);
+}
+
 int Renderer::getSkyboxShaderIndex() const
 {
     std::shared_lock lock(mutex_);
@@ -79,9 +92,9 @@ int Renderer::getSkyboxShaderIndex() const
 int Renderer::slotTexture(GLuint target, GLuint id)
 {
     std::unique_lock lock(mutex_);
-    glActiveTexture(GL_TEXTURE0 + lastActiveTextureSlot);
+    GLState::instance().activeTexture(lastActiveTextureSlot);
     lastActiveTextureSlot++;
-    glBindTexture(target, id);
+    GLState::instance().bindTexture(target, id);
     return lastActiveTextureSlot - 1;
 }
 
@@ -91,20 +104,25 @@ void Renderer::slotTexture(GLuint target, GLuint id, const std::shared_ptr<Shade
     shader->setInt(name, lastActiveTextureSlot - 1);
 }
 
+void Renderer::slotTexture(GLuint target, GLuint id, const std::shared_ptr<ShaderObject> &shader, Uniform<int> uniform)
+{
+    shader->set(uniform, slotTexture(target, id));
+}
+
 void Renderer::unslotTextures()
 {
     std::unique_lock lock(mutex_);
     lastActiveTextureSlot = 0;
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    GLState::instance().activeTexture(0);
+    GLState::instance().bindTexture(GL_TEXTURE_2D, 0);
+    GLState::instance().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    GLState::instance().bindTexture(GL_TEXTURE_2D_ARRAY, 0);
 }
 
-void Renderer::resetTextureSlots()
+void Renderer::resetTextureSlots(int reserved)
 {
     std::unique_lock lock(mutex_);
-    lastActiveTextureSlot = 0;
+    lastActiveTextureSlot = reserved;
 }
 
 void Renderer::setClearColor(const glm::vec3 &color)
@@ -127,28 +145,50 @@ void Renderer::setScreenSize(const glm::uvec2 &size)
     std::unique_lock lock(mutex_);
     screenSize = size;
     glfwSetWindowSize(window, size.x, size.y);
-    glViewport(0, 0, size.x, size.y);
+    GLState::instance().viewport(0, 0, size.x, size.y);
 }
 
 void Renderer::loadShader(int key, const std::string &programPath)
 {
-    assert(shaders.find(key) == shaders.end());
+    assert(shaderKeys.find(key) == shaderKeys.end());
     std::unique_lock lock(mutex_);
     auto shader_program = ResourceManager::instance().loadResource<ShaderProgram>(programPath);
-    shaders[key] = std::make_shared<ShaderObject>(shader_program);
-    shaders[key]->use();
+    auto shader = std::make_shared<ShaderObject>(shader_program);
+    shaderKeys[key] = shaders.insert(shader);
+}
+
+size_t Renderer::finalizeReadyShaders()
+{
+    std::unique_lock lock(mutex_);
+    size_t finalized = 0;
+    shaders.forEach([&](ShaderHandle, const std::shared_ptr<ShaderObject> &shader)
+                    {
+        if (shader->isPending() && shader->isReady())
+        {
+            shader->finalize();
+            finalized++;
+        } });
+    return finalized;
+}
+
+void Renderer::finalizeShaders()
+{
+    std::unique_lock lock(mutex_);
+    shaders.forEach([](ShaderHandle, const std::shared_ptr<ShaderObject> &shader)
+                    { shader->finalize(); });
 }
 
 void Renderer::unloadShader(int key)
 {
-    assert(shaders.find(key) != shaders.end());
+    assert(shaderKeys.find(key) != shaderKeys.end());
     std::unique_lock lock(mutex_);
-    shaders.erase(key);
+    shaders.remove(shaderKeys[key]);
+    shaderKeys.erase(key);
 }
 
 void Renderer::assignSkyboxShader(int key)
 {
-    assert(shaders.count(key) != 0);
+    assert(shaderKeys.count(key) != 0);
     std::unique_lock lock(mutex_);
     skyboxShader = key;
 }
@@ -159,26 +199,25 @@ void Renderer::unassignSkyboxShader()
     skyboxShader = -1;
 }
 
-void Renderer::setViewProjectionUniforms() const
+void Renderer::updateFrameUniforms()
 {
     std::unique_lock lock(mutex_);
-    for (auto &kvp : shaders)
-    {
-        setViewProjectionUniforms(kvp.first);
-    }
+    CameraUniforms data = {view, projection, glm::vec4(mainCamera.position, 1.f)};
+    cameraUniforms->setData(&data);
+    cameraUniforms->bindBase();
 }
 
-void Renderer::setViewProjectionUniforms(int key) const
+const std::shared_ptr<ShaderObject> &Renderer::getShaderVariant(const std::shared_ptr<ShaderObject> &shader, ShaderFeatures features) const
 {
-    auto shader = getShader(key);
-    shader->use();
-    shader->setMat4("view", view);
-    shader->setMat4("projection", projection);
+    if (!shader->hasVariants())
+        return shader;
+    // Variants compiled mid-frame need nothing set, the camera is in a uniform block
+    return shader->getVariant(features);
 }
 
 void Renderer::resetViewport() const
 {
-    glViewport(0, 0, screenSize.x, screenSize.y);
+    GLState::instance().viewport(0, 0, screenSize.x, screenSize.y);
 }
 
 bool Renderer::shouldClose() const
@@ -200,10 +239,15 @@ void Renderer::update()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     InputManager::instance().update();
     InputManager::instance().getMouseDelta(deltaMouse.x, deltaMouse.y);
+    ShaderObject::LocationQueries = 0;
+
+    // GL side of resources that finished loading on the loader pool
+    ResourceManager::instance().processFinalizers();
     
     // Setup view and projection matrices
     view = mainCamera.getViewMatrix();
-    projection = glm::perspective(glm::radians(mainCamera.zoom), (float)screenSize.x / screenSize.y, 0.1f, 100.f);
+    projection = glm::perspective(glm::radians(mainCamera.zoom), (float)screenSize.x / screenSize.y, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+    frustum = Frustum(projection * view);
 }
 
 void Renderer::postUpdate()
@@ -211,6 +255,8 @@ void Renderer::postUpdate()
     glfwSwapBuffers(window);
     glfwPollEvents();
     lastActiveTextureSlot = 0;
+    GLState::instance().endFrame();
+    RenderQueue::EndFrame();
 }
 
 void Renderer::cleanup() const
@@ -219,6 +265,44 @@ void Renderer::cleanup() const
     glfwTerminate();
 }
 
+#ifdef DEBUG
+void Renderer::debugBenchmarkShaderLookups(size_t iterations) const
+{
+    if (shaderKeys.empty())
+        return;
+
+    // The previous storage, shared_ptrs by key and returned by value
+    std::map<int, std::shared_ptr<ShaderObject>> byKey;
+    std::vector<int> keys;
+    std::vector<ShaderHandle> handles;
+    for (auto &kvp : shaderKeys)
+    {
+        byKey[kvp.first] = shaders.get(kvp.second);
+        keys.push_back(kvp.first);
+        handles.push_back(kvp.second);
+    }
+
+    GLuint idSum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        std::shared_ptr<ShaderObject> shader = byKey.at(keys[i % keys.size()]);
+        idSum += shader->getID();
+    }
+    auto middle = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        const auto &shader = getShader(handles[i % handles.size()]);
+        idSum += shader->getID();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double byKeyNs = std::chrono::duration<double, std::nano>(middle - start).count() / iterations;
+    double byHandleNs = std::chrono::duration<double, std::nano>(end - middle).count() / iterations;
+    printf("Shader lookup over %zu shaders: key %.2f ns, handle %.2f ns (%u)\n", keys.size(), byKeyNs, byHandleNs, idSum);
+}
+#endif
+
 void Renderer::initialize()
 {
     std::unique_lock<std::shared_mutex> lock(mutex_);
@@ -228,6 +312,11 @@ void Renderer::initialize()
         return;
     }
 
+    // Hints only apply to windows created after them
+    glfwWindowHint(GLFW_SAMPLES, 4);
+#ifdef DEBUG
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
     window = glfwCreateWindow(screenSize.x, screenSize.y, windowTitle, nullptr, nullptr);
     if (!window)
     {
@@ -238,7 +327,6 @@ void Renderer::initialize()
 
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // Enable V-Sync
-    glfwWindowHint(GLFW_SAMPLES, 4);
     glfwSetScrollCallback(window, scroll_callback);
     glfwSetInputMode(window, GLFW_CURSOR, cursorState);
 
@@ -247,12 +335,26 @@ void Renderer::initialize()
         std::cerr << "Failed to initialize GLAD!" << std::endl;
         return;
     }
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
+    // Let the driver compile on as many threads as it wants, programs are only polled when needed
+    if (GLEXT_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+    // Debug builds stop on the call that caused an error, release builds only hear about the serious ones, whenever the driver gets to it
+#ifdef DEBUG
+    if (!enableGLDebugOutput(GL_DEBUG_SEVERITY_LOW, true))
+        printf("No KHR_debug, GL errors are polled with glGetError\n");
+#else
+    enableGLDebugOutput(GL_DEBUG_SEVERITY_HIGH, false);
+#endif
 
     glClearColor(clearColor.r, clearColor.g, clearColor.b, 1.f);
-    glViewport(0, 0, screenSize.x, screenSize.y);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(DEFAULT_DEPTH_FUNC);
-    glEnable(GL_MULTISAMPLE);
+    GLState::instance().viewport(0, 0, screenSize.x, screenSize.y);
+    GLState::instance().enable(GL_DEPTH_TEST);
+    GLState::instance().depthFunc(DEFAULT_DEPTH_FUNC);
+    GLState::instance().enable(GL_MULTISAMPLE);
+
+    cameraUniforms = std::make_unique<UniformBufferObject>("CameraUniforms", sizeof(CameraUniforms), CAMERA_UNIFORM_BINDING);
 
     InputManager::instance().setWindow(window);
 }
\ No newline at end of file
@@ -17,10 +17,34 @@
 #include <glm/glm.hpp>
 
 #include <Graphics/ShaderObject.h>
+#include <Graphics/Frustum.h>
+#include <Graphics/Std140.h>
+#include <SlotArray.h>
 
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 
 constexpr GLenum DEFAULT_DEPTH_FUNC = GL_LESS;
+// Depth range of the main camera's projection
+constexpr float CAMERA_NEAR_PLANE = 0.1f;
+constexpr float CAMERA_FAR_PLANE = 100.f;
+// Shaders declare the CameraUniforms block with layout(binding = 0)
+constexpr GLuint CAMERA_UNIFORM_BINDING = 0;
+
+// CPU side of the CameraUniforms block, uploaded as it is
+struct CameraUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos; // vec3 in the block, padded to 16 bytes either way
+};
+using CameraBlockLayout = Std140Struct<glm::mat4, glm::mat4, glm::vec3>;
+static_assert(offsetof(CameraUniforms, projection) == CameraBlockLayout::offset<1> && offsetof(CameraUniforms, viewPos) == CameraBlockLayout::offset<2> &&
+                  sizeof(CameraUniforms) == CameraBlockLayout::size,
+              "CameraUniforms has to match its std140 layout");
+
+class UniformBufferObject;
+
+using ShaderHandle = Handle<ShaderObject>;
 
 class Renderer
 {
@@ -37,14 +61,18 @@ private:
     float currentFrame = 0.f;
 
     glm::mat4 projection, view;
+    Frustum frustum;
 
     glm::dvec2 deltaMouse;
 
     mutable std::shared_mutex mutex_;
 
-    std::map<int, std::shared_ptr<ShaderObject>> shaders;
+    SlotArray<ShaderObject> shaders;
+    std::map<int, ShaderHandle> shaderKeys; // Interned by loadShader
     int skyboxShader = -1;
 
+    std::unique_ptr<UniformBufferObject> cameraUniforms;
+
     int lastActiveTextureSlot = 0;
 
 public:
@@ -65,28 +93,45 @@ public:
     int getCursorState() const;
     float getDeltaTime() const;
     glm::dvec2 getDeltaMouse() const;
-
-    std::shared_ptr<ShaderObject> getShader(int key) const;
-    std::shared_ptr<ShaderObject> getSkyboxShader() const;
+    // Of the main camera, from the view and projection set by update
+    const Frustum &getFrustum() const { return frustum; }
+    const glm::mat4 &getView() const { return view; }
+    const glm::mat4 &getProjection() const { return projection; }
+
+    const std::shared_ptr<ShaderObject> &getShader(int key) const;
+    const std::shared_ptr<ShaderObject> &getSkyboxShader() const;
+    ShaderHandle getShaderHandle(int key) const;
+    // Hot path lookup, null if the shader was unloaded since the handle was taken
+    inline const std::shared_ptr<ShaderObject> &getShader(ShaderHandle handle) const { return shaders.get(handle); }
+    inline bool hasShader(ShaderHandle handle) const { return shaders.contains(handle); }
+    // The variant of shader for features, or shader itself if it has none
+    const std::shared_ptr<ShaderObject> &getShaderVariant(const std::shared_ptr<ShaderObject> &shader, ShaderFeatures features) const;
     int getSkyboxShaderIndex() const;
 
     int slotTexture(GLuint target, GLuint id);
     void slotTexture(GLuint target, GLuint id, const std::shared_ptr<ShaderObject> &shader, const std::string &name);
+    void slotTexture(GLuint target, GLuint id, const std::shared_ptr<ShaderObject> &shader, Uniform<int> uniform);
     void unslotTextures();
-    void resetTextureSlots();
+    // The first reserved units are left for textures bound outside slotTexture
+    void resetTextureSlots(int reserved = 0);
 
     void setClearColor(const glm::vec3 &color);
     void setCursorState(int state);
     void setScreenSize(const glm::uvec2 &size);
 
+    // Submits the compile and link, the program finalizes on first use
     void loadShader(int key, const std::string &programPath);
+    // Finalizes the shaders the driver is done with without waiting on the rest, returns how many
+    size_t finalizeReadyShaders();
+    // Finalizes every pending shader, blocking on the driver
+    void finalizeShaders();
     void unloadShader(int key);
 
     void assignSkyboxShader(int key);
     void unassignSkyboxShader();
 
-    void setViewProjectionUniforms() const;
-    void setViewProjectionUniforms(int key) const;
+    // Writes the view, projection and camera position into the CameraUniforms block every shader reads them from
+    void updateFrameUniforms();
 
     void resetViewport() const;
 
@@ -98,4 +143,9 @@ public:
     void postUpdate();
 
     void cleanup() const;
+
+#ifdef DEBUG
+    // Times key lookups in an int keyed map against handle lookups over the loaded shaders
+    void debugBenchmarkShaderLookups(size_t iterations = 1000000) const;
+#endif
 };
\ No newline at end of file
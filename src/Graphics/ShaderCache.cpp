@@ -0,0 +1,136 @@
+#include <Graphics/ShaderCache.h>
+#include <Graphics/GLExtensions.h>
+#include <ResourceManager/ShaderProgram.h>
+#include <ResourceManager/AssetPack/AssetPack.h>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+constexpr uint32_t SHADER_CACHE_MAGIC = 0x43534249; // "IBSC"
+constexpr uint32_t SHADER_CACHE_VERSION = 1;
+
+struct ShaderCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    GLenum format;
+    GLsizei length;
+};
+
+bool ShaderCache::isSupported()
+{
+    if (supported < 0)
+    {
+        GLint formats = 0;
+        if (GLEXT_program_binary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        supported = formats > 0 ? 1 : 0;
+    }
+    return supported == 1;
+}
+
+void ShaderCache::setDirectory(const std::string &_directory)
+{
+    directory = _directory;
+}
+
+uint64_t ShaderCache::computeKey(const ShaderProgram &program, const std::string &defines)
+{
+    if (driver.empty())
+    {
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        {
+            const char *value = (const char *)glGetString(name);
+            driver += value ? value : "";
+            driver += '\n';
+        }
+    }
+
+    // Stages are separated by a null so moving text between them changes the key
+    std::string text = driver + defines;
+    for (const auto &stage : {program.getVertex(), program.getFragment(), program.getGeometry()})
+    {
+        text += '\0';
+        if (stage)
+            text += stage->getSource();
+    }
+    return hashAssetData(text.data(), text.size());
+}
+
+std::string ShaderCache::getPath(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+bool ShaderCache::load(uint64_t key, GLuint program)
+{
+    if (!isSupported())
+        return false;
+
+    std::string path = getPath(key);
+    std::ifstream file(path, std::ios::binary);
+    ShaderCacheHeader header;
+    if (!file || !file.read((char *)&header, sizeof(header)))
+    {
+        stats.misses++;
+        return false;
+    }
+
+    std::vector<char> binary;
+    if (header.magic == SHADER_CACHE_MAGIC && header.version == SHADER_CACHE_VERSION && header.key == key && header.length > 0)
+    {
+        binary.resize(header.length);
+        if (!file.read(binary.data(), binary.size()))
+            binary.clear();
+    }
+    file.close();
+
+    GLint status = GL_FALSE;
+    if (!binary.empty())
+    {
+        glProgramBinary(program, header.format, binary.data(), binary.size());
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+    }
+    if (status != GL_TRUE)
+    {
+        printf("Shader cache rejected %s, recompiling\n", path.c_str());
+        std::error_code error;
+        std::filesystem::remove(path, error);
+        stats.rejected++;
+        return false;
+    }
+    stats.hits++;
+    return true;
+}
+
+void ShaderCache::store(uint64_t key, GLuint program)
+{
+    if (!isSupported())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    ShaderCacheHeader header = {SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, 0, 0};
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, &header.length, &header.format, binary.data());
+    if (header.length <= 0)
+        return;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::ofstream file(getPath(key), std::ios::binary);
+    if (!file)
+    {
+        printf("Can't write shader cache to %s\n", directory.c_str());
+        return;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write(binary.data(), header.length);
+    stats.stored++;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <GLAD/glad.h>
+#include <string>
+#include <cstdint>
+
+class ShaderProgram;
+
+constexpr const char *DEFAULT_SHADER_CACHE_DIRECTORY = "cache/shaders";
+
+struct ShaderCacheStats
+{
+    size_t hits;
+    size_t misses;
+    size_t rejected; // Blobs the driver refused, usually after a driver update
+    size_t stored;
+};
+
+// Linked program binaries on disk, keyed by the stage sources, defines and driver strings
+class ShaderCache
+{
+public:
+    static ShaderCache &instance()
+    {
+        static ShaderCache instance;
+        return instance;
+    }
+
+    // Needs a current context, false if the driver has no binary formats
+    bool isSupported();
+
+    void setDirectory(const std::string &directory);
+    const std::string &getDirectory() const { return directory; }
+
+    uint64_t computeKey(const ShaderProgram &program, const std::string &defines = "");
+
+    // Loads the stored binary into program. False on a miss, or when the driver rejects the blob,
+    // which also removes it. The program is left unlinked then, create a fresh one to compile into
+    bool load(uint64_t key, GLuint program);
+    // Saves the binary of a linked program, it has to be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+    void store(uint64_t key, GLuint program);
+
+    const ShaderCacheStats &getStats() const { return stats; }
+
+private:
+    ShaderCache() = default;
+
+    std::string directory = DEFAULT_SHADER_CACHE_DIRECTORY;
+    std::string driver; // Vendor, renderer and version, read on first use
+    int supported = -1;
+    ShaderCacheStats stats = {};
+
+    std::string getPath(uint64_t key) const;
+
+    ShaderCache(const ShaderCache &) = delete;
+    ShaderCache &operator=(const ShaderCache &) = delete;
+};
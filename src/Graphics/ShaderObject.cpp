@@ -1,63 +1,287 @@
 #include "ShaderObject.h"
+#include <Graphics/GLState.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 
 #include <ResourceManager/ShaderProgram.h>
+#include <Graphics/ShaderCache.h>
+#include <Graphics/GLExtensions.h>
 
-ShaderObject::ShaderObject(const std::shared_ptr<ShaderProgram> &program)
-    : program(program)
+std::string getShaderDefines(ShaderFeatures features)
 {
-    // Step 2: Compile the shaders
-    GLuint vertexShader = compileShader(program->getVertex()->getSource(), GL_VERTEX_SHADER);
-    GLuint fragmentShader = compileShader(program->getFragment()->getSource(), GL_FRAGMENT_SHADER);
-    if (program->getGeometry())
-    {
-        GLuint geometryShader = compileShader(program->getGeometry()->getSource(), GL_GEOMETRY_SHADER);
+    auto flag = [&](const char *name, ShaderFeatures bit)
+    { return std::string("#define ") + name + ((features & bit) ? " true\n" : " false\n"); };
+    return "#define SHADER_VARIANT\n" +
+           flag("HAS_DIFFUSE_MAP", SHADER_FEATURE_DIFFUSE_MAP) +
+           flag("HAS_SPECULAR_MAP", SHADER_FEATURE_SPECULAR_MAP) +
+           flag("HAS_NORMAL_MAP", SHADER_FEATURE_NORMAL_MAP) +
+           flag("HAS_DISPLACEMENT_MAP", SHADER_FEATURE_DISPLACEMENT_MAP) +
+           flag("HAS_DIR_LIGHT", SHADER_FEATURE_DIR_LIGHT) +
+           flag("HAS_SHADOWS", SHADER_FEATURE_SHADOWS) +
+           flag("HAS_INSTANCING", SHADER_FEATURE_INSTANCED) +
+           flag("HAS_CLUSTERED_LIGHTS", SHADER_FEATURE_CLUSTERED_LIGHTS) +
+           "#define POINT_LIGHT_COUNT " + std::to_string((features >> SHADER_FEATURE_POINT_LIGHT_SHIFT) & 0xF) + "\n" +
+           "#define SPOT_LIGHT_COUNT " + std::to_string((features >> SHADER_FEATURE_SPOT_LIGHT_SHIFT) & 0xF) + "\n";
+}
+
+ShaderObject::ShaderObject(const std::shared_ptr<ShaderProgram> &program, const std::string &defines)
+    : program(program), defines(defines)
+{
+    // Variants of variants aren't a thing, only the generic build hands them out
+    if (defines.empty())
+        for (const auto &stage : {program->getVertex(), program->getFragment(), program->getGeometry()})
+            if (stage && stage->getSource().find("SHADER_VARIANT") != std::string::npos)
+                permutable = true;
+    instanceable = permutable && program->getVertex() && program->getVertex()->getSource().find("HAS_INSTANCING") != std::string::npos;
 
-        // Step 3: Link the shaders into a program
-        linkProgram(vertexShader, fragmentShader, geometryShader);
+    auto &cache = ShaderCache::instance();
+    cacheKey = cache.computeKey(*program, defines);
 
-        glDeleteShader(geometryShader);
+    // Step 1: Try the binary linked by an earlier run
+    programID = glCreateProgram();
+    if (cache.load(cacheKey, programID))
+    {
+        cached = true;
+        return;
     }
+    // A rejected binary leaves the program failed, start from a clean one
+    GLState::instance().deleteProgram(programID);
+    programID = glCreateProgram();
+
+    // Step 2: Submit the compiles, the status is only checked in finalize
+    compileShader(program->getVertex()->getSource(defines), GL_VERTEX_SHADER);
+    compileShader(program->getFragment()->getSource(defines), GL_FRAGMENT_SHADER);
+    if (program->getGeometry())
+        compileShader(program->getGeometry()->getSource(defines), GL_GEOMETRY_SHADER);
+
+    // Step 3: Submit the link
+    linkProgram();
+}
+
+void ShaderObject::use() const
+{
+    if (pending)
+        finalize();
+    GLState::instance().useProgram(programID);
+}
+
+bool ShaderObject::isReady() const
+{
+    if (!pending || cached)
+        return true;
+    if (!GLEXT_parallel_shader_compile)
+        return false;
+    GLint done = GL_FALSE;
+    glGetProgramiv(programID, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+void ShaderObject::finalize() const
+{
+    if (!pending)
+        return;
+    pending = false;
+
+    if (cached)
+        linked = true;
     else
     {
-        // Step 3: Link the shaders into a program
-        linkProgram(vertexShader, fragmentShader);
+        // Step 4: Compile errors are only worth reading when the link failed
+        linked = checkLinkErrors(programID);
+        for (const auto &[shader, type] : stages)
+        {
+            if (!linked)
+                checkCompileErrors(shader, type);
+            glDetachShader(programID, shader);
+            glDeleteShader(shader);
+        }
+        stages.clear();
+
+        if (linked)
+            ShaderCache::instance().store(cacheKey, programID);
     }
-    // Step 4: Delete shaders after linking
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    reflect();
 }
 
-void ShaderObject::use() const
+const std::shared_ptr<ShaderObject> &ShaderObject::getVariant(ShaderFeatures features) const
+{
+    if (lastVariant && lastFeatures == features)
+        return *lastVariant;
+
+    auto it = variants.find(features);
+    if (it == variants.end())
+        it = variants.emplace(features, std::make_shared<ShaderObject>(program, getShaderDefines(features))).first;
+    // Map nodes don't move, the pointer stays valid as variants are added
+    lastFeatures = features;
+    lastVariant = &it->second;
+    return it->second;
+}
+
+void ShaderObject::forEachVariant(const std::function<void(ShaderFeatures, const std::shared_ptr<ShaderObject> &)> &func) const
+{
+    for (const auto &[features, variant] : variants)
+        func(features, variant);
+}
+
+bool ShaderObject::hasUniform(const std::string &name) const
+{
+    if (pending)
+        finalize();
+    return uniformLocations.count(name) != 0;
+}
+
+const std::vector<UniformInfo> &ShaderObject::getUniforms() const
+{
+    if (pending)
+        finalize();
+    return uniforms;
+}
+
+const std::vector<UniformBlockInfo> &ShaderObject::getUniformBlocks() const
 {
-    glUseProgram(programID);
+    if (pending)
+        finalize();
+    return uniformBlocks;
 }
 
 void ShaderObject::setBool(const std::string &name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(programID, name.c_str()), (int)value);
+    glUniform1i(findLocation(name), (int)value);
 }
 
 void ShaderObject::setInt(const std::string &name, int value) const
 {
-    glUniform1i(glGetUniformLocation(programID, name.c_str()), value);
+    glUniform1i(findLocation(name), value);
 }
 
 void ShaderObject::setFloat(const std::string &name, float value) const
 {
-    glUniform1f(glGetUniformLocation(programID, name.c_str()), value);
+    glUniform1f(findLocation(name), value);
 }
 
 void ShaderObject::setVec3(const std::string &name, const glm::vec3 &value) const
 {
-    glUniform3fv(glGetUniformLocation(programID, name.c_str()), 1, &value[0]);
+    glUniform3fv(findLocation(name), 1, &value[0]);
 }
 
 void ShaderObject::setMat4(const std::string &name, const glm::mat4 &value) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(programID, name.c_str()), 1, GL_FALSE, &value[0][0]);
+    glUniformMatrix4fv(findLocation(name), 1, GL_FALSE, &value[0][0]);
+}
+
+const UniformBlockInfo *ShaderObject::findUniformBlock(const std::string &name) const
+{
+    if (pending)
+        finalize();
+    for (const auto &block : uniformBlocks)
+        if (block.name == name)
+            return &block;
+    return nullptr;
+}
+
+size_t ShaderObject::LocationQueries = 0;
+
+// Function statics so Uniform globals in other translation units can intern during static init
+static std::unordered_map<std::string, uint32_t> &UniformIds()
+{
+    static std::unordered_map<std::string, uint32_t> ids;
+    return ids;
+}
+static std::vector<std::string> &UniformNames()
+{
+    static std::vector<std::string> names;
+    return names;
+}
+
+uint32_t ShaderObject::InternUniform(const std::string &name)
+{
+    auto &ids = UniformIds();
+    auto it = ids.find(name);
+    if (it != ids.end())
+        return it->second;
+    uint32_t id = UniformNames().size();
+    UniformNames().push_back(name);
+    ids[name] = id;
+    return id;
+}
+
+GLint ShaderObject::findLocation(const std::string &name) const
+{
+    LocationQueries++;
+    if (pending)
+        finalize();
+    auto it = uniformLocations.find(name);
+    return it != uniformLocations.end() ? it->second : -1;
+}
+
+void ShaderObject::resolveLocations() const
+{
+    if (pending)
+        finalize();
+    const auto &names = UniformNames();
+    for (size_t id = locations.size(); id < names.size(); id++)
+    {
+        auto it = uniformLocations.find(names[id]);
+        locations.push_back(it != uniformLocations.end() ? it->second : -1);
+    }
+}
+
+void ShaderObject::reflect() const
+{
+    uniforms.clear();
+    uniformBlocks.clear();
+    uniformLocations.clear();
+    locations.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> buffer(std::max(maxLength, 1));
+    for (GLint i = 0; i < count; i++)
+    {
+        UniformInfo info;
+        GLsizei length = 0;
+        glGetActiveUniform(programID, i, buffer.size(), &length, &info.size, &info.type, buffer.data());
+        info.name = std::string(buffer.data(), length);
+        info.location = glGetUniformLocation(programID, info.name.c_str());
+        // Members of uniform blocks have no location, they're set through the block's buffer
+        if (info.location < 0)
+            continue;
+        uniforms.push_back(info);
+        uniformLocations[info.name] = info.location;
+
+        // "lights[0]" is also addressable as "lights" and the other elements by index
+        const std::string suffix = "[0]";
+        if (info.name.size() > suffix.size() && info.name.compare(info.name.size() - suffix.size(), suffix.size(), suffix) == 0)
+        {
+            std::string base = info.name.substr(0, info.name.size() - suffix.size());
+            uniformLocations[base] = info.location;
+            for (GLint element = 1; element < info.size; element++)
+            {
+                std::string elementName = base + "[" + std::to_string(element) + "]";
+                uniformLocations[elementName] = glGetUniformLocation(programID, elementName.c_str());
+            }
+        }
+    }
+
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+    buffer.resize(std::max(maxLength, 1));
+    for (GLint i = 0; i < count; i++)
+    {
+        UniformBlockInfo info;
+        GLsizei length = 0;
+        glGetActiveUniformBlockName(programID, i, buffer.size(), &length, buffer.data());
+        info.name = std::string(buffer.data(), length);
+        info.index = i;
+        glGetActiveUniformBlockiv(programID, i, GL_UNIFORM_BLOCK_DATA_SIZE, &info.dataSize);
+        glGetActiveUniformBlockiv(programID, i, GL_UNIFORM_BLOCK_BINDING, &info.binding);
+        uniformBlocks.push_back(info);
+    }
+
+    resolveLocations();
 }
 
 std::string ShaderObject::readFile(const std::string &filePath) const
@@ -68,48 +292,38 @@ std::string ShaderObject::readFile(const std::string &filePath) const
     return buffer.str();
 }
 
-GLuint ShaderObject::compileShader(const std::string &source, GLenum shaderType) const
+void ShaderObject::compileShader(const std::string &source, GLenum shaderType)
 {
     GLuint shader = glCreateShader(shaderType);
     const char *shaderCode = source.c_str();
     glShaderSource(shader, 1, &shaderCode, nullptr);
     glCompileShader(shader);
-    checkCompileErrors(shader, shaderType == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT");
-    return shader;
+    stages.emplace_back(shader, shaderType);
 }
 
-void ShaderObject::linkProgram(GLuint vertexShader, GLuint fragmentShader)
+void ShaderObject::linkProgram()
 {
-    programID = glCreateProgram();
-    glAttachShader(programID, vertexShader);
-    glAttachShader(programID, fragmentShader);
-    glLinkProgram(programID);
-    checkLinkErrors(programID);
-}
-
-void ShaderObject::linkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint geometryShader)
-{
-    programID = glCreateProgram();
-    glAttachShader(programID, vertexShader);
-    glAttachShader(programID, fragmentShader);
-    glAttachShader(programID, geometryShader);
+    for (const auto &stage : stages)
+        glAttachShader(programID, stage.first);
+    if (GLEXT_program_binary)
+        glProgramParameteri(programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(programID);
-    checkLinkErrors(programID);
 }
 
-void ShaderObject::checkCompileErrors(GLuint shader, const std::string &type) const
+void ShaderObject::checkCompileErrors(GLuint shader, GLenum shaderType) const
 {
     GLint success;
     GLchar infoLog[1024];
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success)
     {
+        const char *type = shaderType == GL_VERTEX_SHADER ? "VERTEX" : shaderType == GL_GEOMETRY_SHADER ? "GEOMETRY" : "FRAGMENT";
         glGetShaderInfoLog(shader, 1024, nullptr, infoLog);
         std::cerr << type << " SHADER COMPILATION ERROR: " << infoLog << std::endl;
     }
 }
 
-void ShaderObject::checkLinkErrors(GLuint program) const
+bool ShaderObject::checkLinkErrors(GLuint program) const
 {
     GLint success;
     GLchar infoLog[1024];
@@ -119,4 +333,5 @@ void ShaderObject::checkLinkErrors(GLuint program) const
         glGetProgramInfoLog(program, 1024, nullptr, infoLog);
         std::cerr << "PROGRAM LINKING ERROR: " << infoLog << std::endl;
     }
+    return success;
 }
@@ -4,43 +4,175 @@
 #define SHADER_H
 
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
 #include <GLAD/glad.h>
 #include <glm/glm.hpp>
 #include <memory>
+#include <functional>
 
 class ShaderProgram;
 
+// Feature key of a shader variant, each switch is compiled in as a #define instead of branched on per fragment
+using ShaderFeatures = uint32_t;
+constexpr ShaderFeatures SHADER_FEATURE_DIFFUSE_MAP = 1u << 0;
+constexpr ShaderFeatures SHADER_FEATURE_SPECULAR_MAP = 1u << 1;
+constexpr ShaderFeatures SHADER_FEATURE_NORMAL_MAP = 1u << 2;
+constexpr ShaderFeatures SHADER_FEATURE_DISPLACEMENT_MAP = 1u << 3;
+constexpr ShaderFeatures SHADER_FEATURE_DIR_LIGHT = 1u << 4;
+constexpr ShaderFeatures SHADER_FEATURE_SHADOWS = 1u << 5;
+// Model matrix comes from a per instance attribute instead of the model uniform
+constexpr ShaderFeatures SHADER_FEATURE_INSTANCED = 1u << 6;
+// Point and spot lights come from the LightClusters buffers instead of the lighting block, the counts are left at 0
+constexpr ShaderFeatures SHADER_FEATURE_CLUSTERED_LIGHTS = 1u << 7;
+// Light counts take 4 bits each
+constexpr uint32_t SHADER_FEATURE_POINT_LIGHT_SHIFT = 8;
+constexpr uint32_t SHADER_FEATURE_SPOT_LIGHT_SHIFT = 12;
+
+inline ShaderFeatures makeLightFeatures(bool dirLight, uint32_t pointLights, uint32_t spotLights, bool shadows)
+{
+    return (dirLight ? SHADER_FEATURE_DIR_LIGHT : 0) | (shadows ? SHADER_FEATURE_SHADOWS : 0) |
+           ((pointLights & 0xF) << SHADER_FEATURE_POINT_LIGHT_SHIFT) | ((spotLights & 0xF) << SHADER_FEATURE_SPOT_LIGHT_SHIFT);
+}
+// HAS_* as true/false and the light counts, with SHADER_VARIANT set so the generic fallbacks are skipped
+std::string getShaderDefines(ShaderFeatures features);
+
+// Interned uniform name, typed by the value it takes. Fetch once and reuse with any shader
+template <typename T>
+struct Uniform
+{
+    uint32_t id = UINT32_MAX;
+
+    Uniform() = default;
+    explicit Uniform(const std::string &name);
+};
+
+// Filled from the linked program
+struct UniformInfo
+{
+    std::string name; // Arrays are listed by their first element, "lights[0]"
+    GLint location;
+    GLenum type;
+    GLint size; // Element count for arrays
+};
+
+struct UniformBlockInfo
+{
+    std::string name;
+    GLuint index;
+    GLint dataSize;
+    GLint binding;
+};
+
 class ShaderObject
 {
 public:
-    // Constructor
-    ShaderObject(const std::shared_ptr<ShaderProgram> &program);
+    // Constructor. Only submits the compile and link, nothing waits on the driver until finalize.
+    // defines are inserted into every stage, used for variants
+    ShaderObject(const std::shared_ptr<ShaderProgram> &program, const std::string &defines = "");
 
-    // Use the shader program
+    // Use the shader program, finalizing it first if it's still pending
     void use() const;
 
+    // True once the driver is done compiling and linking, so finalize won't stall.
+    // Without KHR_parallel_shader_compile there's no way to ask, it only turns true after finalize
+    bool isReady() const;
+    // Checks the compile and link status, stores the binary and reflects. Blocks until the driver is done,
+    // called by use and the reflection getters the first time the program is needed
+    void finalize() const;
+    bool isPending() const { return pending; }
+    bool isLinked() const { return linked; }
+
+    // Shaders whose sources check SHADER_VARIANT can be specialized by feature key
+    bool hasVariants() const { return permutable; }
+    // Vertex stage reads the model matrix from an instance attribute in SHADER_FEATURE_INSTANCED variants
+    bool hasInstancing() const { return instanceable; }
+    // Compiled on first request and kept, the same key returns the same object
+    const std::shared_ptr<ShaderObject> &getVariant(ShaderFeatures features) const;
+    void forEachVariant(const std::function<void(ShaderFeatures, const std::shared_ptr<ShaderObject> &)> &func) const;
+    size_t getVariantCount() const { return variants.size(); }
+
     GLuint getID() const { return programID; }
 
-    // Set uniform variables
+    // Set uniform variables, by name. Each call is a lookup in the reflected uniforms
     void setBool(const std::string &name, bool value) const;
     void setInt(const std::string &name, int value) const;
     void setFloat(const std::string &name, float value) const;
     void setVec3(const std::string &name, const glm::vec3 &value) const;
     void setMat4(const std::string &name, const glm::mat4 &value) const;
 
+    // Set uniform variables through interned names, an index into this shader's locations
+    inline void set(Uniform<bool> uniform, bool value) const { glUniform1i(getLocation(uniform.id), (int)value); }
+    inline void set(Uniform<int> uniform, int value) const { glUniform1i(getLocation(uniform.id), value); }
+    inline void set(Uniform<float> uniform, float value) const { glUniform1f(getLocation(uniform.id), value); }
+    inline void set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const { glUniform3fv(getLocation(uniform.id), 1, &value[0]); }
+    inline void set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const { glUniform4fv(getLocation(uniform.id), 1, &value[0]); }
+    inline void set(Uniform<glm::mat4> uniform, const glm::mat4 &value) const { glUniformMatrix4fv(getLocation(uniform.id), 1, GL_FALSE, &value[0][0]); }
+
+    bool hasUniform(const std::string &name) const;
+    const std::vector<UniformInfo> &getUniforms() const;
+    const std::vector<UniformBlockInfo> &getUniformBlocks() const;
+    // Null if the program has no active block with that name
+    const UniformBlockInfo *findUniformBlock(const std::string &name) const;
+
+    static uint32_t InternUniform(const std::string &name);
+
+    // Uniform locations looked up by name since the last reset, Renderer::update resets it every frame
+    static size_t LocationQueries;
+
 private:
     // Shader program ID
     GLuint programID;
 
     std::shared_ptr<ShaderProgram> program;
+    std::string defines;
+
+    bool permutable = false;
+    bool instanceable = false;
+    mutable std::unordered_map<ShaderFeatures, std::shared_ptr<ShaderObject>> variants;
+    // Consecutive draws mostly ask for the same variant
+    mutable ShaderFeatures lastFeatures = 0;
+    mutable const std::shared_ptr<ShaderObject> *lastVariant = nullptr;
+
+    // Everything below is filled by finalize, which runs lazily from the const accessors
+    mutable bool pending = true;
+    mutable bool linked = false;
+    mutable bool cached = false; // Loaded from the shader cache, nothing to compile or store
+    uint64_t cacheKey = 0;
+    // Compiled stages waiting on the link, with their type for the error log
+    mutable std::vector<std::pair<GLuint, GLenum>> stages;
+
+    mutable std::vector<UniformInfo> uniforms;
+    mutable std::vector<UniformBlockInfo> uniformBlocks;
+    // Every addressable name, array elements included
+    mutable std::unordered_map<std::string, GLint> uniformLocations;
+    // By interned uniform id, grown when ids are added after this shader was linked
+    mutable std::vector<GLint> locations;
+
+    inline GLint getLocation(uint32_t id) const
+    {
+        if (id >= locations.size())
+            resolveLocations();
+        return id < locations.size() ? locations[id] : -1;
+    }
+    GLint findLocation(const std::string &name) const;
+    void resolveLocations() const;
+    void reflect() const;
 
     // Helper functions for shader compilation and program linking
     std::string readFile(const std::string &filePath) const;
-    GLuint compileShader(const std::string &source, GLenum shaderType) const;
-    void linkProgram(GLuint vertexShader, GLuint fragmentShader);
-    void linkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint geometryShader);
-    void checkCompileErrors(GLuint shader, const std::string &type) const;
-    void checkLinkErrors(GLuint program) const;
+    void compileShader(const std::string &source, GLenum shaderType);
+    void linkProgram();
+    void checkCompileErrors(GLuint shader, GLenum shaderType) const;
+    bool checkLinkErrors(GLuint program) const;
 };
 
-#endif // SHADER_H
\ No newline at end of file
+template <typename T>
+inline Uniform<T>::Uniform(const std::string &name)
+    : id(ShaderObject::InternUniform(name))
+{
+}
+
+#endif // SHADER_H
@@ -0,0 +1,203 @@
+#include <Graphics/ShadowAtlas.h>
+#include <Graphics/GLState.h>
+#include <Graphics/GLExtensions.h>
+#include <Graphics/LightCaster.h>
+#include <algorithm>
+
+void ShadowAtlas::setBudget(size_t bytes)
+{
+    budget = bytes;
+    destroy();
+}
+
+void ShadowAtlas::destroy()
+{
+    if (atlasTexture)
+        GLState::instance().deleteTexture(atlasTexture);
+    if (cubeTexture)
+        GLState::instance().deleteTexture(cubeTexture);
+    atlasTexture = cubeTexture = 0;
+    atlasSize = 0;
+    cubeLayers = 0;
+    tiles.clear();
+    cubes.clear();
+    stats.bytes = 0;
+    generation++;
+}
+
+int ShadowAtlas::getCubeLayerBudget() const
+{
+    if (!GLEXT_cube_map_array)
+        return 0;
+    // At most half the budget, so a scene full of point lights still leaves room for spot lights
+    return (int)std::min<size_t>(MAX_POINT_LIGHTS, budget / 2 / getCubeLayerBytes());
+}
+
+void ShadowAtlas::createAtlas()
+{
+    size_t available = budget - (size_t)getCubeLayerBudget() * getCubeLayerBytes();
+    atlasSize = SHADOW_ATLAS_MAX_SIZE;
+    while (atlasSize > SHADOW_TILE_MIN_SIZE && (size_t)atlasSize * atlasSize * SHADOW_TEXEL_BYTES > available)
+        atlasSize /= 2;
+
+    glGenTextures(1, &atlasTexture);
+    GLState::instance().bindTexture(GL_TEXTURE_2D, atlasTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = {1.0, 1.0, 1.0, 1.0};
+    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+    GLState::instance().bindTexture(GL_TEXTURE_2D, 0);
+    stats.bytes += (size_t)atlasSize * atlasSize * SHADOW_TEXEL_BYTES;
+}
+
+void ShadowAtlas::createCubes()
+{
+    cubeLayers = getCubeLayerBudget();
+    if (cubeLayers == 0)
+        return;
+    glGenTextures(1, &cubeTexture);
+    GLState::instance().bindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubeTexture);
+    // Depth counts faces, six per cube
+    glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT, SHADOW_CUBE_SIZE, SHADOW_CUBE_SIZE, cubeLayers * 6, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    GLState::instance().bindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+    stats.bytes += cubeLayers * getCubeLayerBytes();
+}
+
+void ShadowAtlas::beginFrame()
+{
+    tileRequests.clear();
+    cubeRequests.clear();
+}
+
+void ShadowAtlas::requestTile(const void *owner, unsigned int size, float importance)
+{
+    size = std::max(SHADOW_TILE_MIN_SIZE, std::min(size, SHADOW_TILE_MAX_SIZE));
+    tileRequests.push_back({owner, size, importance});
+}
+
+void ShadowAtlas::requestCube(const void *owner, float importance)
+{
+    cubeRequests.push_back({owner, 0, importance});
+}
+
+void ShadowAtlas::release(const void *owner)
+{
+    tiles.erase(owner);
+    cubes.erase(owner);
+}
+
+bool ShadowAtlas::isFree(const ShadowTile &tile) const
+{
+    unsigned int cellsPerSide = atlasSize / SHADOW_TILE_MIN_SIZE;
+    unsigned int x0 = tile.x / SHADOW_TILE_MIN_SIZE, y0 = tile.y / SHADOW_TILE_MIN_SIZE, span = tile.size / SHADOW_TILE_MIN_SIZE;
+    if (x0 + span > cellsPerSide || y0 + span > cellsPerSide)
+        return false;
+    for (unsigned int y = y0; y < y0 + span; y++)
+        for (unsigned int x = x0; x < x0 + span; x++)
+            if (cells[y * cellsPerSide + x])
+                return false;
+    return true;
+}
+
+void ShadowAtlas::mark(const ShadowTile &tile)
+{
+    unsigned int cellsPerSide = atlasSize / SHADOW_TILE_MIN_SIZE;
+    unsigned int x0 = tile.x / SHADOW_TILE_MIN_SIZE, y0 = tile.y / SHADOW_TILE_MIN_SIZE, span = tile.size / SHADOW_TILE_MIN_SIZE;
+    for (unsigned int y = y0; y < y0 + span; y++)
+        for (unsigned int x = x0; x < x0 + span; x++)
+            cells[y * cellsPerSide + x] = 1;
+}
+
+ShadowTile ShadowAtlas::findFree(unsigned int size) const
+{
+    // Aligned to their own size, like a quadtree, so small tiles don't break up the space big ones need
+    for (unsigned int y = 0; y + size <= atlasSize; y += size)
+        for (unsigned int x = 0; x + size <= atlasSize; x += size)
+        {
+            ShadowTile tile = {x, y, size};
+            if (isFree(tile))
+                return tile;
+        }
+    return {0, 0, 0};
+}
+
+void ShadowAtlas::allocate()
+{
+    stats.tiles = stats.cubes = stats.downsized = stats.denied = 0;
+    stats.budget = budget;
+    auto byImportance = [](const Request &a, const Request &b)
+    { return a.importance > b.importance; };
+
+    if (!tileRequests.empty() && !atlasTexture)
+        createAtlas();
+    std::sort(tileRequests.begin(), tileRequests.end(), byImportance);
+    cells.assign((atlasSize / SHADOW_TILE_MIN_SIZE) * (atlasSize / SHADOW_TILE_MIN_SIZE), 0);
+    std::unordered_map<const void *, ShadowTile> granted;
+    for (const auto &request : tileRequests)
+    {
+        // Largest size that still fits, at that size the place from last frame first since its contents may still be good
+        auto previous = tiles.find(request.owner);
+        ShadowTile tile = {0, 0, 0};
+        for (unsigned int size = std::min(request.size, atlasSize); tile.size == 0 && size >= SHADOW_TILE_MIN_SIZE; size /= 2)
+        {
+            if (previous != tiles.end() && previous->second.size == size && isFree(previous->second))
+                tile = previous->second;
+            else
+                tile = findFree(size);
+        }
+        if (tile.size == 0)
+        {
+            stats.denied++;
+            continue;
+        }
+        if (tile.size < request.size)
+            stats.downsized++;
+        mark(tile);
+        granted[request.owner] = tile;
+        stats.tiles++;
+    }
+    tiles = std::move(granted);
+
+    if (!cubeRequests.empty() && !cubeTexture)
+        createCubes();
+    std::sort(cubeRequests.begin(), cubeRequests.end(), byImportance);
+    std::vector<bool> used(cubeLayers, false);
+    std::unordered_map<const void *, int> grantedCubes;
+    for (const auto &request : cubeRequests)
+    {
+        auto previous = cubes.find(request.owner);
+        int layer = previous != cubes.end() && !used[previous->second] ? previous->second : -1;
+        for (int i = 0; layer == -1 && i < cubeLayers; i++)
+            if (!used[i])
+                layer = i;
+        if (layer == -1)
+        {
+            stats.denied++;
+            continue;
+        }
+        used[layer] = true;
+        grantedCubes[request.owner] = layer;
+        stats.cubes++;
+    }
+    cubes = std::move(grantedCubes);
+}
+
+ShadowTile ShadowAtlas::getTile(const void *owner) const
+{
+    auto it = tiles.find(owner);
+    return it != tiles.end() ? it->second : ShadowTile{0, 0, 0};
+}
+
+int ShadowAtlas::getCubeLayer(const void *owner) const
+{
+    auto it = cubes.find(owner);
+    return it != cubes.end() ? it->second : -1;
+}
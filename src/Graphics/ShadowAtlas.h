@@ -0,0 +1,107 @@
+#pragma once
+
+#include <GLAD/glad.h>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Default for ShadowAtlas::setBudget, covers the atlas and the cube pool together
+constexpr size_t SHADOW_MEMORY_BUDGET = 64 * 1024 * 1024;
+// Depth texels are counted at this size against the budget
+constexpr size_t SHADOW_TEXEL_BYTES = 4;
+// The atlas is the largest power of two up to this that fits what the cube pool leaves of the budget
+constexpr unsigned int SHADOW_ATLAS_MAX_SIZE = 4096;
+// Tiles are square powers of two in this range
+constexpr unsigned int SHADOW_TILE_MIN_SIZE = 128;
+constexpr unsigned int SHADOW_TILE_MAX_SIZE = 2048;
+// Face size of every cube in the pool, the layers of a cube map array share one size
+constexpr unsigned int SHADOW_CUBE_SIZE = 512;
+
+struct ShadowTile
+{
+    unsigned int x, y, size; // size is 0 when nothing was granted
+
+    bool operator==(const ShadowTile &other) const { return x == other.x && y == other.y && size == other.size; }
+};
+
+struct ShadowAtlasStats
+{
+    size_t bytes;  // Of the textures created so far
+    size_t budget;
+    size_t tiles;
+    size_t cubes;
+    size_t downsized; // Tiles granted smaller than asked for
+    size_t denied;    // Requests that got nothing
+};
+
+// Shadow storage shared by every light. 2D maps get a square tile of one depth texture, point lights a layer of a
+// cube map array. Nothing is created until a light asks for space. Each frame the lights that need a map request
+// space with an importance, and allocate hands it out from the most important down. A light keeps its place from
+// the frame before when it is still free, so maps that didn't change don't have to be rendered again
+class ShadowAtlas
+{
+public:
+    static ShadowAtlas &instance()
+    {
+        static ShadowAtlas instance;
+        return instance;
+    }
+
+    // Textures made for the old budget are dropped, everything is allocated again on the next allocate
+    void setBudget(size_t bytes);
+
+    // Forgets the requests of the last frame, the places they got are kept to be handed out again
+    void beginFrame();
+    // owner names the request from frame to frame, size is the tile side wanted
+    void requestTile(const void *owner, unsigned int size, float importance);
+    void requestCube(const void *owner, float importance);
+    void allocate();
+    // Owners that weren't requested in the current frame have no place
+    void release(const void *owner);
+
+    ShadowTile getTile(const void *owner) const;
+    // -1 without one
+    int getCubeLayer(const void *owner) const;
+
+    GLuint getAtlasTexture() const { return atlasTexture; }
+    unsigned int getAtlasSize() const { return atlasSize; }
+    GLuint getCubeTexture() const { return cubeTexture; }
+    const ShadowAtlasStats &getStats() const { return stats; }
+    // Counts the times the textures were dropped, GL can hand a new texture the old one's name
+    uint32_t getGeneration() const { return generation; }
+
+private:
+    ShadowAtlas() = default;
+
+    struct Request
+    {
+        const void *owner;
+        unsigned int size; // 0 for cubes
+        float importance;
+    };
+
+    size_t budget = SHADOW_MEMORY_BUDGET;
+    GLuint atlasTexture = 0, cubeTexture = 0;
+    unsigned int atlasSize = 0;
+    int cubeLayers = 0;
+    uint32_t generation = 0;
+
+    std::vector<Request> tileRequests, cubeRequests;
+    std::unordered_map<const void *, ShadowTile> tiles;
+    std::unordered_map<const void *, int> cubes;
+    // Atlas in SHADOW_TILE_MIN_SIZE cells, set where a tile of the current frame is
+    std::vector<uint8_t> cells;
+    ShadowAtlasStats stats = {};
+
+    void createAtlas();
+    void createCubes();
+    void destroy();
+    size_t getCubeLayerBytes() const { return (size_t)6 * SHADOW_CUBE_SIZE * SHADOW_CUBE_SIZE * SHADOW_TEXEL_BYTES; }
+    // Cube layers the budget allows, the atlas gets what is left
+    int getCubeLayerBudget() const;
+    bool isFree(const ShadowTile &tile) const;
+    void mark(const ShadowTile &tile);
+    // First free aligned square of size, size 0 if there is none
+    ShadowTile findFree(unsigned int size) const;
+};
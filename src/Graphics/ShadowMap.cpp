@@ -1,8 +1,18 @@
 #include <Graphics/ShadowMap.h>
+#include <Graphics/GLState.h>
+#include <Graphics/GL.h>
+#include <Graphics/GLExtensions.h>
+#include <Graphics/RenderQueue.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include "ShadowMap.h"
 #include "Renderer.h"
 
+static const Uniform<glm::mat4> LightSpaceMatrixUniform("lightSpaceMatrix");
+static const Uniform<glm::mat4> LightSpaceMatricesUniforms[6] = {
+    Uniform<glm::mat4>("lightSpaceMatrices[0]"), Uniform<glm::mat4>("lightSpaceMatrices[1]"), Uniform<glm::mat4>("lightSpaceMatrices[2]"),
+    Uniform<glm::mat4>("lightSpaceMatrices[3]"), Uniform<glm::mat4>("lightSpaceMatrices[4]"), Uniform<glm::mat4>("lightSpaceMatrices[5]")};
+static const Uniform<int> CubeLayerUniform("cubeLayer");
+
 ShadowMap::ShadowMap(unsigned int width, unsigned int height)
     : width(width), height(height)
 {
@@ -10,58 +20,139 @@ ShadowMap::ShadowMap(unsigned int width, unsigned int height)
 
 ShadowMap::~ShadowMap()
 {
-    glDeleteTextures(1, &id);
+    if (id)
+        GLState::instance().deleteTexture(id);
 }
 
 void ShadowMap::bind() const
 {
     fbo->bind();
-    glBindTexture(target, id);
+    GLState::instance().bindTexture(target, id);
 }
 
 void ShadowMap::unbind() const
 {
     fbo->unbind();
-    glBindTexture(target, 0);
+    GLState::instance().bindTexture(target, 0);
 }
 
 void ShadowMap::prepare(const std::shared_ptr<ShaderObject> &shader, glm::mat4 lightSpaceMatrix)
 {
     fbo->setTexture(id, target, GL_DEPTH_ATTACHMENT);
-    shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+    shader->set(LightSpaceMatrixUniform, lightSpaceMatrix);
+}
+
+Frustum ShadowMap::getShadowFrustum(const glm::mat4 &lightSpaceMatrix, const glm::vec3 &position, float range)
+{
+    Frustum frustum(lightSpaceMatrix);
+    frustum.clampFar(position, range);
+    return frustum;
+}
+
+void ShadowMap::beginRender(const std::shared_ptr<LightCaster> &light)
+{
+    renderedViews.clear();
+    renderedSignature = getSignature(light);
+    casterCount = 0;
+}
+
+uint64_t ShadowMap::getSignature(const std::shared_ptr<LightCaster> &light) const
+{
+    // A map moved to another tile or layer, or into a recreated texture, has to be rendered again
+    return light->getShadowSignature() ^ getPlacement() * 0x9E3779B97F4A7C15ull;
 }
 
-void ShadowMap::setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name)
+size_t ShadowMap::renderView(const std::shared_ptr<ShaderObject> &shader, const Frustum &view, const ShadowCasterFunc &renderFunc)
 {
-    // Renderer::instance().slotTexture(target, id, shader, name + ".shadowMap");
-    textureSlot = Renderer::instance().slotTexture(target, id);
-    shader->setInt(name + ".shadowMap", textureSlot);
-    // shader->setFloat(name + ".farPlane", 7.5f);
-    // shader->setFloat(name + ".nearPlane", 1.0f);
-    // shader->setFloat(name + ".shadowBias", 0.005f);
-    // shader->setFloat(name + ".shadowStrength", 0.5f);
-    // shader->setFloat(name + ".shadowMapWidth", static_cast<float>(width));
-    // shader->setFloat(name + ".shadowMapHeight", static_cast<float>(height));
+    renderedViews.push_back(view);
+    return renderFunc(shader, view);
+}
+
+bool ShadowMap::isUpToDate(const std::shared_ptr<LightCaster> &light, const std::vector<AABB> &changes) const
+{
+    if (renderedViews.empty() || getSignature(light) != renderedSignature)
+        return false;
+    for (const auto &box : changes)
+        for (const auto &view : renderedViews)
+            if (view.intersects(box))
+                return false;
+    return true;
 }
 
 FramebufferObject *ShadowMap2D::FBO = 0;
 
-void ShadowMap2D::generateTexture()
+ShadowMap2D::ShadowMap2D()
+    : ShadowMap(0, 0)
 {
     target = GL_TEXTURE_2D;
+    if (!FBO)
+    {
+        FBO = new FramebufferObject(SHADOW_TILE_MAX_SIZE, SHADOW_TILE_MAX_SIZE, true, GL_DEPTH_COMPONENT, GL_DEPTH_ATTACHMENT);
+    }
+    fbo = FBO;
+}
+
+ShadowMap2D::~ShadowMap2D()
+{
+    // The atlas texture isn't ours to delete
+    ShadowAtlas::instance().release(this);
+    id = 0;
+}
+
+bool ShadowMap2D::place()
+{
+    ShadowAtlas &atlas = ShadowAtlas::instance();
+    tile = atlas.getTile(this);
+    id = atlas.getAtlasTexture();
+    generation = atlas.getGeneration();
+    width = height = tile.size;
+    return tile.size != 0;
+}
+
+uint64_t ShadowMap2D::getPlacement() const
+{
+    return ((uint64_t)id << 48 ^ (uint64_t)tile.x << 32 ^ (uint64_t)tile.y << 16 ^ tile.size) + generation * 0xC2B2AE3D27D4EB4Full;
+}
+
+void ShadowMap2D::render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc)
+{
+    bool placed = place();
+    beginRender(light);
+    if (!placed)
+        return;
+
+    bind();
+    const auto &spot = static_cast<const SpotLight &>(*light);
+    const glm::mat4 &lightSpaceMatrix = spot.lightSpaceMatrix;
+    prepare(shader, lightSpaceMatrix);
+    GLState::instance().viewport(tile.x, tile.y, tile.size, tile.size);
+    // Only this tile is cleared, the rest of the atlas belongs to other lights
+    GLState::instance().enable(GL_SCISSOR_TEST);
+    glScissor(tile.x, tile.y, tile.size, tile.size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    GLState::instance().disable(GL_SCISSOR_TEST);
+    casterCount = renderView(shader, getShadowFrustum(lightSpaceMatrix, spot.position, spot.getRange()), renderFunc);
+    unbind();
+}
+
+FramebufferObject *ShadowMapCascaded::FBO = 0;
+
+void ShadowMapCascaded::generateTexture()
+{
+    target = GL_TEXTURE_2D_ARRAY;
     glGenTextures(1, &id);
-    glBindTexture(target, id);
-    glTexImage2D(target, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    GLState::instance().bindTexture(target, id);
+    glTexImage3D(target, 0, GL_DEPTH_COMPONENT, width, height, MAX_SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
     glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     float borderColor[] = {1.0, 1.0, 1.0, 1.0};
     glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glBindTexture(target, 0);
+    GLState::instance().bindTexture(target, 0);
 }
 
-ShadowMap2D::ShadowMap2D()
+ShadowMapCascaded::ShadowMapCascaded()
     : ShadowMap(SHADOW_WIDTH, SHADOW_HEIGHT)
 {
     if (!FBO)
@@ -69,60 +160,113 @@ ShadowMap2D::ShadowMap2D()
         FBO = new FramebufferObject(width, height, true, GL_DEPTH_COMPONENT, GL_DEPTH_ATTACHMENT);
     }
     fbo = FBO;
-    generateTexture();
 }
 
-void ShadowMap2D::render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const std::function<void()> &renderFunc)
+void ShadowMapCascaded::render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc)
 {
+    if (!id)
+        generateTexture();
     bind();
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, width, height);
-    prepare(shader, light->getLightSpaceMatrix());
-    renderFunc();
+    GLState::instance().viewport(0, 0, width, height);
+    auto directional = std::static_pointer_cast<DirectionalLight>(light);
+    beginRender(light);
+    for (int cascade = 0; cascade < directional->cascadeCount; cascade++)
+    {
+        GLCall(glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, id, 0, cascade));
+        glClear(GL_DEPTH_BUFFER_BIT);
+        shader->set(LightSpaceMatrixUniform, directional->cascadeMatrices[cascade]);
+        casterCount += renderView(shader, Frustum(directional->cascadeMatrices[cascade]), renderFunc);
+    }
     unbind();
 }
 
 FramebufferObject *ShadowMapCube::FBO = 0;
 
-void ShadowMapCube::generateTexture()
+ShadowMapCube::ShadowMapCube()
+    : ShadowMap(SHADOW_CUBE_SIZE, SHADOW_CUBE_SIZE)
 {
-    target = GL_TEXTURE_CUBE_MAP;
-    glGenTextures(1, &id);
-    glBindTexture(target, id);
-    for (unsigned int i = 0; i < 6; i++)
+    target = GL_TEXTURE_CUBE_MAP_ARRAY;
+    if (!FBO)
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        FBO = new FramebufferObject(width, height, true, GL_DEPTH_COMPONENT, GL_DEPTH_ATTACHMENT);
     }
-    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glBindTexture(target, 0);
+    fbo = FBO;
 }
 
-ShadowMapCube::ShadowMapCube()
-    : ShadowMap(SHADOW_WIDTH, SHADOW_HEIGHT)
+ShadowMapCube::~ShadowMapCube()
 {
-    generateTexture();
-    if (!FBO)
+    ShadowAtlas::instance().release(this);
+    id = 0;
+}
+
+uint64_t ShadowMapCube::getPlacement() const
+{
+    return ((uint64_t)id << 32 ^ (uint32_t)layer) + generation * 0xC2B2AE3D27D4EB4Full;
+}
+
+bool ShadowMapCube::place()
+{
+    ShadowAtlas &atlas = ShadowAtlas::instance();
+    layer = atlas.getCubeLayer(this);
+    id = atlas.getCubeTexture();
+    generation = atlas.getGeneration();
+    return layer != -1;
+}
+
+void ShadowMapCube::render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc)
+{
+    bool placed = place();
+    beginRender(light);
+    if (!placed)
+        return;
+    bind();
+    GLState::instance().viewport(0, 0, width, height);
+    const auto &point = static_cast<const PointLight &>(*light);
+    float range = point.getRange();
+    for (int face = 0; face < 6; face++)
     {
-        FBO = new FramebufferObject(width, height, true, GL_DEPTH_COMPONENT, GL_DEPTH_ATTACHMENT);
+        // Layers of a cube map array count faces, six per cube
+        GLCall(glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, id, 0, layer * 6 + face));
+        glClear(GL_DEPTH_BUFFER_BIT);
+        // Each face only gets the casters inside its own frustum and the light's range
+        const glm::mat4 &lightSpaceMatrix = point.lightSpaceMatrix[face];
+        shader->set(LightSpaceMatrixUniform, lightSpaceMatrix);
+        casterCount += renderView(shader, getShadowFrustum(lightSpaceMatrix, point.position, range), renderFunc);
     }
-    fbo = FBO;
+    unbind();
 }
 
-void ShadowMapCube::render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const std::function<void()> &renderFunc)
+void ShadowMapCube::renderLayered(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc)
 {
+    bool placed = place();
+    beginRender(light);
+    if (!placed)
+        return;
     bind();
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, width, height);
-    auto point = std::dynamic_pointer_cast<PointLight>(light);
-    for (target = GL_TEXTURE_CUBE_MAP_POSITIVE_X; target < GL_TEXTURE_CUBE_MAP_POSITIVE_X + 6; target++)
+    // A layered clear would wipe every cube in the array, so this cube's faces are cleared one at a time first
+    for (int face = 0; face < 6; face++)
     {
-        prepare(shader, point->lightSpaceMatrix[target - GL_TEXTURE_CUBE_MAP_POSITIVE_X]);
-        renderFunc();
+        GLCall(glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, id, 0, layer * 6 + face));
+        glClear(GL_DEPTH_BUFFER_BIT);
     }
-    target = GL_TEXTURE_CUBE_MAP;
+    // Attaching the whole array makes the target layered, the shader sends each face to cubeLayer * 6 + face
+    GLCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, id, 0));
+    GLState::instance().viewport(0, 0, width, height);
+    auto point = std::static_pointer_cast<PointLight>(light);
+    for (int face = 0; face < 6; face++)
+        shader->set(LightSpaceMatricesUniforms[face], point->lightSpaceMatrix[face]);
+    shader->set(CubeLayerUniform, layer);
+
+    // Casters are culled against the box the six faces cover, cut down to the light's range
+    float range = glm::min(point->getRange(), POINT_SHADOW_FAR_PLANE);
+    Frustum bounds(glm::ortho(-range, range, -range, range, -range, range) * glm::translate(glm::mat4(1.f), -point->position));
+    RenderQueue::ViewInstances = GLEXT_vertex_layer ? 6 : 1;
+    casterCount = renderView(shader, bounds, renderFunc);
+    RenderQueue::ViewInstances = 1;
     unbind();
-}
\ No newline at end of file
+}
+
+const char *ShadowMapCube::GetLayeredShaderPath()
+{
+    return GLEXT_vertex_layer ? "res/Shaders/Shader_DepthLayer" : "res/Shaders/Shader_DepthCube";
+}
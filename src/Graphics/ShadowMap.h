@@ -3,67 +3,123 @@
 #include <Graphics/FramebufferObject.h>
 #include <Graphics/ShaderObject.h>
 #include <Graphics/LightCaster.h>
+#include <Graphics/Frustum.h>
+#include <Graphics/ShadowAtlas.h>
 
 #include <functional>
 
+// Draws the shadow casters inside the view of one shadow map render with shader, returns how many it drew
+using ShadowCasterFunc = std::function<size_t(const std::shared_ptr<ShaderObject> &, const Frustum &)>;
+
 class ShadowMap
 {
 protected:
-    GLuint id, target;
-    int textureSlot;
+    GLuint id = 0, target;
     FramebufferObject *fbo;
     unsigned int width, height;
+    size_t casterCount = 0;
+
+    // What the last render covered and the light state it was for, see isUpToDate
+    std::vector<Frustum> renderedViews;
+    uint64_t renderedSignature = 0;
 
-    virtual void generateTexture() = 0;
+    void beginRender(const std::shared_ptr<LightCaster> &light);
+    // The light's signature mixed with getPlacement
+    uint64_t getSignature(const std::shared_ptr<LightCaster> &light) const;
+    // Draws the casters in view through renderFunc and remembers the view
+    size_t renderView(const std::shared_ptr<ShaderObject> &shader, const Frustum &view, const ShadowCasterFunc &renderFunc);
+    // Frustum of lightSpaceMatrix, its far plane pulled in to range around position
+    static Frustum getShadowFrustum(const glm::mat4 &lightSpaceMatrix, const glm::vec3 &position, float range);
 
 public:
     ShadowMap(unsigned int width, unsigned int height);
-    ~ShadowMap();
+    virtual ~ShadowMap();
 
     void bind() const;
     void unbind() const;
 
     GLuint getID() const { return id; }
-    int getTextureSlot() const { return textureSlot; }
     const FramebufferObject *getFBO() const { return fbo; }
 
     unsigned int getWidth() const { return width; }
     unsigned int getHeight() const { return height; }
+    // Casters drawn by the last render, summed over every view it rendered
+    size_t getCasterCount() const { return casterCount; }
+    // True if the last render still holds: the light's signature is the same and none of changes touches a view it drew
+    bool isUpToDate(const std::shared_ptr<LightCaster> &light, const std::vector<AABB> &changes) const;
 
     void prepare(const std::shared_ptr<ShaderObject> &shader, glm::mat4 lightSpaceMatrix);
-    void setUniforms(const std::shared_ptr<ShaderObject> &shader, const std::string &name);
+    // Takes the place the ShadowAtlas handed out this frame, so isUpToDate and getPlacement see it. False if the
+    // map got none, nothing is rendered or kept then
+    virtual bool place() { return true; }
+    // Where in its texture the map lives, a render only stays valid while this is the same
+    virtual uint64_t getPlacement() const { return id; }
 
-    virtual void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const std::function<void()> &renderFunc) = 0;
+    virtual void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc) = 0;
 };
 
+// A tile of the ShadowAtlas, renders nothing in a frame the atlas gave it no tile. Spot lights only, LightNode
+// picks the map by the light's type so render can static_cast
 class ShadowMap2D : public ShadowMap
 {
 protected:
     static FramebufferObject *FBO;
-    void generateTexture() override;
+    ShadowTile tile = {0, 0, 0};
+    uint32_t generation = 0; // Of the atlas at the last place
 
 public:
-    static const unsigned int SHADOW_WIDTH = 1024;
-    static const unsigned int SHADOW_HEIGHT = 1024;
-
     ShadowMap2D();
-    ~ShadowMap2D() = default;
+    ~ShadowMap2D();
 
-    void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const std::function<void()> &renderFunc) override;
+    // Tile of the last place, size 0 if it had none
+    const ShadowTile &getTile() const { return tile; }
+    bool place() override;
+    uint64_t getPlacement() const override;
+    void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc) override;
 };
 
-class ShadowMapCube : public ShadowMap
+// Directional light cascades, one layer of a depth texture array each. Directional lights only
+class ShadowMapCascaded : public ShadowMap
 {
 protected:
     static FramebufferObject *FBO;
-    void generateTexture() override;
+    void generateTexture();
 
 public:
-    static const unsigned int SHADOW_WIDTH = 1024;
-    static const unsigned int SHADOW_HEIGHT = 1024;
+    static const unsigned int SHADOW_WIDTH = SHADOW_CASCADE_RESOLUTION;
+    static const unsigned int SHADOW_HEIGHT = SHADOW_CASCADE_RESOLUTION;
 
-    ShadowMapCube();
-    ~ShadowMapCube() = default;
+    ShadowMapCascaded();
+    ~ShadowMapCascaded() = default;
+
+    // A pass per cascade in use, each with only the casters inside that cascade's box. The texture is made on the first one
+    void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc) override;
+};
 
-    void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const std::function<void()> &renderFunc) override;
+// A cube of the ShadowAtlas cube map array, renders nothing in a frame the atlas gave it no cube. Point lights only
+class ShadowMapCube : public ShadowMap
+{
+protected:
+    static FramebufferObject *FBO;
+    int layer = -1;
+    uint32_t generation = 0; // Of the atlas at the last place
+
+public:
+    ShadowMapCube();
+    ~ShadowMapCube();
+
+    // Cube of the last place, -1 if it had none
+    int getLayer() const { return layer; }
+    bool place() override;
+    uint64_t getPlacement() const override;
+
+    // Face by face, renderFunc is called six times
+    void render(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc) override;
+    // All six faces in one pass with the whole cube array attached as a layered target, renderFunc is called once.
+    // shader has to be the one at GetLayeredShaderPath
+    void renderLayered(const std::shared_ptr<ShaderObject> &shader, const std::shared_ptr<LightCaster> &light, const ShadowCasterFunc &renderFunc);
+
+    // Shader for renderLayered. Where vertex shaders can write gl_Layer each caster is drawn as six instances,
+    // otherwise a geometry shader sends every triangle to all six faces
+    static const char *GetLayeredShaderPath();
 };
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
+
+// std140 layouts worked out at compile time. A GLSL struct or block is written down as Std140Struct of its member
+// types in declaration order, the offsets and size come out as constants that can be static_asserted and used to
+// fill a Std140Buffer, which is then uploaded in one call
+
+constexpr size_t std140RoundUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+// Base alignment and size of a type in std140. Scalars and vectors are listed here, structs and arrays have their own
+template <typename T, typename = void>
+struct Std140Traits;
+
+template <> struct Std140Traits<float> { static constexpr size_t alignment = 4, size = 4; };
+template <> struct Std140Traits<int> { static constexpr size_t alignment = 4, size = 4; };
+template <> struct Std140Traits<uint32_t> { static constexpr size_t alignment = 4, size = 4; };
+template <> struct Std140Traits<glm::vec2> { static constexpr size_t alignment = 8, size = 8; };
+template <> struct Std140Traits<glm::vec3> { static constexpr size_t alignment = 16, size = 12; };
+template <> struct Std140Traits<glm::vec4> { static constexpr size_t alignment = 16, size = 16; };
+template <> struct Std140Traits<glm::ivec4> { static constexpr size_t alignment = 16, size = 16; };
+// Four vec4 columns, which is how glm stores it too
+template <> struct Std140Traits<glm::mat4> { static constexpr size_t alignment = 16, size = 64; };
+
+// Elements are padded out to a multiple of 16 bytes, so int[4] takes 64
+template <typename T, size_t N>
+struct Std140Array
+{
+    static constexpr size_t count = N;
+    static constexpr size_t stride = std140RoundUp(Std140Traits<T>::size, std140RoundUp(Std140Traits<T>::alignment, 16));
+    static constexpr size_t alignment = std140RoundUp(Std140Traits<T>::alignment, 16);
+    static constexpr size_t size = stride * N;
+
+    static constexpr size_t offset(size_t index) { return stride * index; }
+};
+
+// Members before index laid out one after another, each starting at its own alignment
+template <size_t N>
+constexpr size_t std140Offset(const size_t (&alignments)[N], const size_t (&sizes)[N], size_t index)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < index; i++)
+        offset = std140RoundUp(offset, alignments[i]) + sizes[i];
+    return std140RoundUp(offset, alignments[index]);
+}
+
+// Structs are aligned like a vec4 at least
+template <size_t N>
+constexpr size_t std140StructAlignment(const size_t (&alignments)[N])
+{
+    size_t alignment = 16;
+    for (size_t value : alignments)
+        alignment = value > alignment ? value : alignment;
+    return alignment;
+}
+
+template <typename... Members>
+struct Std140Struct
+{
+    static constexpr size_t memberCount = sizeof...(Members);
+    static constexpr size_t alignments[] = {Std140Traits<Members>::alignment...};
+    static constexpr size_t sizes[] = {Std140Traits<Members>::size...};
+
+    static constexpr size_t alignment = std140StructAlignment(alignments);
+    // Padded out to the alignment, so the next member or array element starts after it
+    static constexpr size_t size = std140RoundUp(std140Offset(alignments, sizes, memberCount - 1) + sizes[memberCount - 1], alignment);
+
+    template <size_t I>
+    static constexpr size_t offset = std140Offset(alignments, sizes, I);
+};
+
+template <typename... Members>
+struct Std140Traits<Std140Struct<Members...>>
+{
+    static constexpr size_t alignment = Std140Struct<Members...>::alignment, size = Std140Struct<Members...>::size;
+};
+template <typename T, size_t N>
+struct Std140Traits<Std140Array<T, N>>
+{
+    static constexpr size_t alignment = Std140Array<T, N>::alignment, size = Std140Array<T, N>::size;
+};
+
+// CPU copy of a block laid out by Layout, written member by member at offsets from the layout
+template <typename Layout>
+class Std140Buffer
+{
+public:
+    static constexpr size_t size = Layout::size;
+
+    Std140Buffer() { clear(); }
+
+    void clear() { std::memset(bytes, 0, size); }
+
+    // value has to be one of the types Std140Traits lists, offset is where the member starts in the block
+    template <typename T>
+    void set(size_t offset, const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "std140 members are plain values");
+        assert(offset + Std140Traits<T>::size <= size);
+        std::memcpy(bytes + offset, &value, Std140Traits<T>::size);
+    }
+
+    const void *data() const { return bytes; }
+
+private:
+    alignas(16) uint8_t bytes[size];
+};
@@ -1,4 +1,5 @@
 #include "TextureArrayObject.h"
+#include <Graphics/GLState.h>
 #include <vendor/stb/stb_image.h>
 #include <iostream>
 #include "ResourceManager/TextureData.h"
@@ -12,7 +13,7 @@ TextureArrayObject::TextureArrayObject(const std::vector<std::string> &filePaths
 
 TextureArrayObject::~TextureArrayObject()
 {
-    glDeleteTextures(1, &textureArrayID);
+    GLState::instance().deleteTexture(textureArrayID);
 }
 
 const std::vector<std::shared_ptr<TextureData>> &TextureArrayObject::getDatas() const { return datas; }
@@ -51,7 +52,7 @@ void TextureArrayObject::generateTextureArray(const std::vector<unsigned char *>
 {
     // Generate a new texture array
     glGenTextures(1, &textureArrayID);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayID);
+    GLState::instance().bindTexture(GL_TEXTURE_2D_ARRAY, textureArrayID);
 
     // Set the texture parameters
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -72,7 +73,7 @@ void TextureArrayObject::generateTextureArray(const std::vector<unsigned char *>
     }
 
     // Unbind the texture array
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    GLState::instance().bindTexture(GL_TEXTURE_2D_ARRAY, 0);
 }
 
 void TextureArrayObject::flipVertically(unsigned char *data, int width, int height, int channels)
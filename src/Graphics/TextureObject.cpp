@@ -1,4 +1,5 @@
 #include "TextureObject.h"
+#include <Graphics/GLState.h>
 #include <iostream>
 #include "ResourceManager/TextureData.h"
 #include "ResourceManager/ResourceManager.h"
@@ -33,7 +34,7 @@ TextureObject::TextureObject(const std::shared_ptr<TextureData> &_data)
 TextureObject::~TextureObject()
 {
     if (textureID != 0) {
-        glDeleteTextures(1, &textureID);
+        GLState::instance().deleteTexture(textureID);
     }
     Textures.erase(data->getName());
 }
@@ -51,7 +52,7 @@ void TextureObject::loadTexture()
 void TextureObject::generateTexture(unsigned char *data, int width, int height, int channels)
 {
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    GLState::instance().bindTexture(GL_TEXTURE_2D, textureID);
 
     // Set texture parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
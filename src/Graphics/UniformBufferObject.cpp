@@ -1,4 +1,6 @@
 #include <Graphics/UniformBufferObject.h>
+#include <Graphics/GLState.h>
+#include <cstdio>
 #include "UniformBufferObject.h"
 
 UniformBufferObject::UniformBufferObject(const std::string &name, size_t size, GLuint bindingPoint)
@@ -12,27 +14,45 @@ UniformBufferObject::UniformBufferObject(const std::string &name, size_t size, G
 
 UniformBufferObject::~UniformBufferObject()
 {
-    glDeleteBuffers(1, &ubo);
+    GLState::instance().deleteBuffer(ubo);
 }
 
 void UniformBufferObject::bind()
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    GLState::instance().bindBuffer(GL_UNIFORM_BUFFER, ubo);
 }
 
 void UniformBufferObject::unbind() const
 {
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    GLState::instance().bindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void UniformBufferObject::use(GLuint program)
 {
     bind();
-    glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ubo);
+    GLState::instance().bindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ubo);
     index = glGetUniformBlockIndex(program, name.c_str());
     glUniformBlockBinding(program, index, bindingPoint);
 }
 
+void UniformBufferObject::use(const ShaderObject &shader)
+{
+    bind();
+    GLState::instance().bindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ubo);
+    const UniformBlockInfo *block = shader.findUniformBlock(name);
+    if (!block)
+        return;
+    index = block->index;
+    // Blocks declared with layout(binding = n) already point at it
+    if ((GLuint)block->binding != bindingPoint)
+        glUniformBlockBinding(shader.getID(), index, bindingPoint);
+}
+
+void UniformBufferObject::bindBase()
+{
+    GLState::instance().bindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ubo);
+}
+
 void UniformBufferObject::setData(const void *data)
 {
     bind();
@@ -45,16 +65,15 @@ void UniformBufferObject::setSubData(const void *data, size_t offset, size_t len
     glBufferSubData(GL_UNIFORM_BUFFER, offset, length, data);
 }
 
-void UniformBufferObject::pushData(const void *data, size_t size, size_t &offset)
+bool UniformBufferObject::checkBlockSize(const ShaderObject &shader) const
 {
-    setSubData(data, offset, size);
-    size_t padding = 0;
-    if (size > 16)
-        padding = size % 16;
-    else
-        padding = 16 - size;
-    offset += size + padding;
+    const UniformBlockInfo *block = shader.findUniformBlock(name);
+    if (!block || (size_t)block->dataSize == size)
+        return true;
+    printf("Uniform block %s is %d bytes in the shader but %zu in its buffer\n", name.c_str(), block->dataSize, size);
+    return false;
 }
+
 GLuint UniformBufferObject::getBindingPoint() const
 {
     return bindingPoint;
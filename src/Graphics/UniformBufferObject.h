@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <string>
 #include <cstring>
+#include <Graphics/ShaderObject.h>
 
 class UniformBufferObject
 {
@@ -21,9 +22,14 @@ public:
     void bind();
     void unbind() const;
     void use(GLuint program);
+    // Uses the shader's reflected block instead of querying it by name
+    void use(const ShaderObject &shader);
+    // Only binds the buffer to bindingPoint, for shaders that declare the block with layout(binding = n)
+    void bindBase();
     void setData(const void *data);
     void setSubData(const void *data, size_t offset, size_t length);
-    void pushData(const void *data, size_t size, size_t &offset);
+    // False if shader declares the block with a size other than this buffer's, which means the CPU layout is out of date
+    bool checkBlockSize(const ShaderObject &shader) const;
     GLuint getBindingPoint() const;
     size_t getSize() const;
     const std::string &getName() const;
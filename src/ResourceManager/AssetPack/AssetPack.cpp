@@ -3,24 +3,114 @@
 #include <fstream>
 #include <stdexcept>
 #include <cassert>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 
 #include <zlib.h>
 #include <stb/stb_image.h>
 
+uint64_t hashAssetData(const char *data, size_t size)
+{
+    // FNV-1a, 64 bit
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 size_t AssetPack::size() const
 {
-    return sizeof(version) + sizeof(asset_count) + asset_count * ASSET_IDENTIFIER_SIZE + std::accumulate(identifiers.begin(), identifiers.end(), 0, [](size_t sum, const AssetIdentifier &identifier)
-                                                                                                         { return sum + identifier.size; });
+    return sizeof(version) + sizeof(asset_count) + asset_count * ASSET_IDENTIFIER_SIZE + data_size;
 }
 
 void AssetPack::clear()
 {
     identifiers.clear();
-    for (auto &asset : assets)
+    assets.clear();
+    asset_count = 0;
+    data_size = 0;
+    blobs_by_hash.clear();
+}
+
+int AssetPack::findAsset(const std::string &name) const
+{
+    for (size_t i = 0; i < asset_count; i++)
     {
-        delete[] asset;
+        if (strncmp(identifiers[i].name, name.c_str(), sizeof(identifiers[i].name)) == 0)
+            return i;
     }
-    assets.clear();
+    return -1;
+}
+
+int AssetPack::findBlob(uint64_t hash, const char *data, size_t size) const
+{
+    auto range = blobs_by_hash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        size_t i = it->second;
+        if (!assets[i] || identifiers[i].size != size)
+            continue;
+        // Hash collisions are unlikely, but aliasing wrong content would be silent corruption
+        if (memcmp(assets[i].get(), data, size) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void AssetPack::indexBlob(size_t index)
+{
+    if (identifiers[index].size > 0)
+        blobs_by_hash.emplace(identifiers[index].hash, index);
+}
+
+void AssetPack::unindexBlob(size_t index)
+{
+    auto range = blobs_by_hash.equal_range(identifiers[index].hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == index)
+        {
+            blobs_by_hash.erase(it);
+            return;
+        }
+    }
+}
+
+void AssetPack::rebuildBlobIndex()
+{
+    blobs_by_hash.clear();
+    for (size_t i = 0; i < asset_count; i++)
+        indexBlob(i);
+}
+
+void AssetPack::placeBlob(AssetIdentifier &identifier, std::shared_ptr<char[]> &asset, const char *data, size_t size)
+{
+    uint64_t hash = hashAssetData(data, size);
+    identifier.size = size;
+    identifier.hash = hash;
+    if (size == 0)
+    {
+        // Empty assets own no bytes of the data section, the buffer only marks the entry as present
+        identifier.offset = 0;
+        asset = std::shared_ptr<char[]>(new char[1]);
+        return;
+    }
+    int duplicate = findBlob(hash, data, size);
+    if (duplicate >= 0)
+    {
+        identifier.offset = identifiers[duplicate].offset;
+        asset = assets[duplicate];
+        return;
+    }
+
+    identifier.offset = data_size;
+    data_size += size;
+    asset = std::shared_ptr<char[]>(new char[size]);
+    memcpy(asset.get(), data, size);
 }
 
 void AssetPack::addAsset(const std::string &name, const char *data, size_t size, AssetType type, char _metadata[32])
@@ -28,54 +118,119 @@ void AssetPack::addAsset(const std::string &name, const char *data, size_t size,
     assert(type != AssetType::MAX_TYPE);
     AssetIdentifier identifier;
     strncpy(identifier.name, name.c_str(), sizeof(identifier.name));
-    if (identifiers.size() == 0)
-        identifier.offset = 0;
-    else
-        identifier.offset = identifiers[identifiers.size() - 1].offset + identifiers[identifiers.size() - 1].size;
-    identifier.size = size;
     identifier.type = type;
     memcpy(identifier.metadata, _metadata, sizeof(identifier.metadata));
-    identifiers.push_back(identifier);
 
-    char *asset = new char[size];
-    memcpy(asset, data, size);
+    std::shared_ptr<char[]> asset;
+    placeBlob(identifier, asset, data, size);
+
+    identifiers.push_back(identifier);
     assets.push_back(asset);
     asset_count++;
+    indexBlob(asset_count - 1);
+}
+
+bool AssetPack::replaceAsset(const std::string &name, const char *data, size_t size, AssetType type, char _metadata[32])
+{
+    int index = findAsset(name);
+    if (index < 0)
+    {
+        addAsset(name, data, size, type, _metadata);
+        return true;
+    }
+
+    AssetIdentifier &identifier = identifiers[index];
+    if (identifier.size == size && identifier.hash == hashAssetData(data, size) && memcmp(assets[index].get(), data, size) == 0)
+        return false;
+
+    // Drop our reference first so the entry can't alias its own stale blob
+    unindexBlob(index);
+    assets[index].reset();
+    identifier.type = type;
+    memcpy(identifier.metadata, _metadata, sizeof(identifier.metadata));
+    placeBlob(identifier, assets[index], data, size);
+    indexBlob(index);
+    return true;
 }
 
 void AssetPack::removeAsset(const std::string &name)
 {
+    int index = findAsset(name);
+    if (index < 0)
+        return;
+    assets.erase(assets.begin() + index);
+    identifiers.erase(identifiers.begin() + index);
+    asset_count--;
+    // Every entry after it moved down one
+    rebuildBlobIndex();
+}
+
+std::pair<AssetIdentifier, char *> AssetPack::getAsset(const std::string &name) const
+{
+    int index = findAsset(name);
+    if (index < 0)
+        return {AssetIdentifier(), nullptr};
+    return {identifiers[index], assets[index].get()};
+}
+
+bool AssetPack::hasAsset(const std::string &name) const
+{
+    return findAsset(name) >= 0;
+}
+
+AssetPackStats AssetPack::stats() const
+{
+    AssetPackStats result = {0, 0, 0, 0};
+    // Blobs are told apart by their buffer, an empty entry's offset can equal the next blob's
+    std::unordered_set<const char *> blobs;
     for (size_t i = 0; i < asset_count; i++)
     {
-        if (identifiers[i].name == name)
-        {
-            delete[] assets[i];
-            assets.erase(assets.begin() + i);
-            identifiers.erase(identifiers.begin() + i);
-            asset_count--;
-            return;
-        }
+        result.logical_size += identifiers[i].size;
+        if (identifiers[i].size > 0 && blobs.insert(assets[i].get()).second)
+            result.stored_size += identifiers[i].size;
     }
+    result.deduplicated_size = result.logical_size - result.stored_size;
+    result.wasted_size = data_size - result.stored_size;
+    return result;
 }
 
-std::pair<AssetIdentifier, char *> AssetPack::getAsset(const std::string &name) const
+float AssetPack::wasteRatio() const
 {
+    if (data_size == 0)
+        return 0.f;
+    return (float)stats().wasted_size / data_size;
+}
+
+void AssetPack::compact()
+{
+    std::unordered_map<const char *, size_t> remap; // Blob, new offset
+    size_t end = 0;
     for (size_t i = 0; i < asset_count; i++)
     {
-        if (identifiers[i].name == name)
+        if (identifiers[i].size == 0)
+        {
+            identifiers[i].offset = 0;
+            continue;
+        }
+        auto it = remap.find(assets[i].get());
+        if (it == remap.end())
         {
-            return {identifiers[i], assets[i]};
+            it = remap.emplace(assets[i].get(), end).first;
+            end += identifiers[i].size;
         }
+        identifiers[i].offset = it->second;
     }
-    return {AssetIdentifier(), nullptr};
+    printf("Compacted asset pack, reclaimed %zu bytes\n", data_size - end);
+    data_size = end;
 }
 
 char *AssetPack::serializeAssetPack() const
 {
     char *buffer = new char[size()];
     char *ptr = buffer;
-    memcpy(ptr, &version, sizeof(version));
-    ptr += sizeof(version);
+    int current_version = ASSET_PACK_VERSION;
+    memcpy(ptr, &current_version, sizeof(current_version));
+    ptr += sizeof(current_version);
     memcpy(ptr, &asset_count, sizeof(asset_count));
     ptr += sizeof(asset_count);
     for (size_t i = 0; i < asset_count; i++)
@@ -91,17 +246,23 @@ char *AssetPack::serializeAssetPack() const
         ptr += sizeof(id.type);
         memcpy(ptr, id.metadata, sizeof(id.metadata));
         ptr += sizeof(id.metadata);
+        memcpy(ptr, &id.hash, sizeof(id.hash));
+        ptr += sizeof(id.hash);
     }
+    // Stale regions are zeroed, they compress to almost nothing
+    memset(ptr, 0, data_size);
+    std::unordered_set<const char *> written;
     for (size_t i = 0; i < asset_count; i++)
     {
-        memcpy(ptr, assets[i], identifiers[i].size);
-        ptr += identifiers[i].size;
+        if (identifiers[i].size > 0 && written.insert(assets[i].get()).second)
+            memcpy(ptr + identifiers[i].offset, assets[i].get(), identifiers[i].size);
     }
     return buffer;
 }
 
 void AssetPack::deserializeAssetPack(const char *buffer)
 {
+    clear();
     const char *ptr = buffer;
     memcpy(&version, ptr, sizeof(version));
     ptr += sizeof(version);
@@ -120,52 +281,101 @@ void AssetPack::deserializeAssetPack(const char *buffer)
         ptr += sizeof(id.type);
         memcpy(id.metadata, ptr, sizeof(id.metadata));
         ptr += sizeof(id.metadata);
+        id.hash = 0;
+        if (version >= 3)
+        {
+            memcpy(&id.hash, ptr, sizeof(id.hash));
+            ptr += sizeof(id.hash);
+        }
         identifiers.push_back(id);
     }
+    // Identifiers that point at the same offset share their blob in memory too. Empty entries get their own buffer,
+    // older packs gave them the offset of the blob after them
+    std::unordered_map<size_t, std::shared_ptr<char[]>> blobs;
     for (size_t i = 0; i < asset_count; i++)
     {
-        char *asset = new char[identifiers[i].size];
-        memcpy(asset, ptr, identifiers[i].size);
-        ptr += identifiers[i].size;
-        assets.push_back(asset);
+        AssetIdentifier &id = identifiers[i];
+        if (id.size == 0)
+        {
+            id.offset = 0;
+            id.hash = hashAssetData(nullptr, 0);
+            assets.push_back(std::shared_ptr<char[]>(new char[1]));
+            continue;
+        }
+        auto it = blobs.find(id.offset);
+        if (it == blobs.end())
+        {
+            std::shared_ptr<char[]> asset(new char[id.size]);
+            memcpy(asset.get(), ptr + id.offset, id.size);
+            it = blobs.emplace(id.offset, asset).first;
+        }
+        if (version < 3)
+            id.hash = hashAssetData(it->second.get(), id.size);
+        assets.push_back(it->second);
+        data_size = std::max(data_size, id.offset + id.size);
     }
+    version = ASSET_PACK_VERSION;
+    rebuildBlobIndex();
+}
+
+static char *readAssetFile(const std::string &path, size_t &size)
+{
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        throw std::runtime_error("Failed to open file: " + path);
+    size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    char *data = new char[size];
+
+    if (!file.read(data, size))
+        throw std::runtime_error("Failed to read file: " + path);
+
+    file.close();
+    return data;
+}
+
+static void readTextureMetadata(const char *texture_data, size_t texture_data_size, char metadata[32])
+{
+    int x = 0, y = 0, bpp = 0;
+    stbi_info_from_memory((const stbi_uc *)texture_data, texture_data_size, &x, &y, &bpp);
+    memset(metadata, 0, 32);
+    char *ptr = metadata;
+    memcpy(ptr, &x, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, &y, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, &bpp, sizeof(int));
+    ptr += sizeof(int);
 }
 
 void addTextureToPack(const std::string &path, AssetPack &pack, const std::string &name)
 {
     size_t texture_data_size = 0;
-    char *texture_data = 0;
-    {
-        std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
-        if (!file.is_open())
-            throw std::runtime_error("Failed to open file: " + path);
-        texture_data_size = file.tellg();
-        file.seekg(0, std::ios::beg);
+    char *texture_data = readAssetFile(path, texture_data_size);
 
-        texture_data = new char[texture_data_size];
+    char metadata[32];
+    readTextureMetadata(texture_data, texture_data_size, metadata);
 
-        if (!file.read(texture_data, texture_data_size))
-            throw std::runtime_error("Failed to read file: " + path);
+    pack.addAsset(name, texture_data, texture_data_size, AssetType::TEXTURE, metadata);
+    delete[] texture_data;
+}
 
-        file.close();
-    }
+bool updateTextureInPack(const std::string &path, AssetPack &pack, const std::string &name)
+{
+    size_t texture_data_size = 0;
+    char *texture_data = readAssetFile(path, texture_data_size);
 
     char metadata[32];
-    {
-        int x = 0, y = 0, bpp = 0;
-        auto *inprt_texture = stbi_load_from_memory((const stbi_uc *)texture_data, texture_data_size, &x, &y, &bpp, 4);
-        stbi_image_free(inprt_texture);
-        char *ptr = metadata;
-        memcpy(ptr, &x, sizeof(int));
-        ptr += sizeof(int);
-        memcpy(ptr, &y, sizeof(int));
-        ptr += sizeof(int);
-        memcpy(ptr, &bpp, sizeof(int));
-        ptr += sizeof(int);
-    }
+    auto existing = pack.getAsset(name);
+    if (existing.second && existing.first.size == texture_data_size && existing.first.hash == hashAssetData(texture_data, texture_data_size))
+        memcpy(metadata, existing.first.metadata, sizeof(metadata)); // Unchanged, skip decoding the header again
+    else
+        readTextureMetadata(texture_data, texture_data_size, metadata);
 
-    pack.addAsset(name, texture_data, texture_data_size, AssetType::TEXTURE, metadata);
+    bool changed = pack.replaceAsset(name, texture_data, texture_data_size, AssetType::TEXTURE, metadata);
     delete[] texture_data;
+    return changed;
 }
 
 char *compressPack(const AssetPack &pack, size_t &new_size)
@@ -176,7 +386,9 @@ char *compressPack(const AssetPack &pack, size_t &new_size)
     size_t pack_size = pack.size();
     memcpy(ptr, &pack_size, sizeof(size_t));
     ptr += sizeof(size_t);
-    int result = compress((Bytef *)ptr, (uLongf *)&new_size, (const Bytef *)pack.serializeAssetPack(), (uLong)pack.size());
+    char *serialized = pack.serializeAssetPack();
+    int result = compress((Bytef *)ptr, (uLongf *)&new_size, (const Bytef *)serialized, (uLong)pack_size);
+    delete[] serialized;
     new_size += sizeof(size_t);
 
     if (result == Z_OK)
@@ -250,4 +462,93 @@ void saveAssetPack(const std::string &path, const AssetPack &pack)
     file.write(compressedPack, compressedPackSize);
 
     file.close();
+    delete[] compressedPack;
+
+    AssetPackStats stats = pack.stats();
+    printf("Saved asset pack %s: %zu assets, %zu bytes stored, %zu bytes saved by deduplication, %zu bytes stale\n",
+           path.c_str(), pack.asset_count, stats.stored_size, stats.deduplicated_size, stats.wasted_size);
+}
+
+size_t updateAssetPack(const std::string &path, const std::vector<std::pair<std::string, std::string>> &textures, float compactThreshold)
+{
+    AssetPack pack;
+    if (std::ifstream(path.c_str(), std::ios::binary).good())
+        loadAssetPack(path, pack);
+
+    size_t changed = 0;
+    for (const auto &texture : textures)
+    {
+        if (updateTextureInPack(texture.first, pack, texture.second))
+            changed++;
+    }
+
+    if (changed == 0)
+    {
+        printf("Asset pack %s is up to date\n", path.c_str());
+        return 0;
+    }
+
+    if (pack.wasteRatio() > compactThreshold)
+        pack.compact();
+
+    saveAssetPack(path, pack);
+    printf("Updated %zu of %zu assets in %s\n", changed, textures.size(), path.c_str());
+    return changed;
+}
+
+bool debugCheckAssetPackRoundTrip()
+{
+    // An empty entry first, then content, an alias of it and a replaced entry that leaves a stale blob
+    AssetPack pack;
+    char metadata[32] = {};
+    const char first[] = "first blob", second[] = "second blob", changed[] = "changed";
+    pack.addAsset("empty", first, 0, AssetType::SCRIPT, metadata);
+    pack.addAsset("first", first, sizeof(first), AssetType::SCRIPT, metadata);
+    pack.addAsset("alias", first, sizeof(first), AssetType::SCRIPT, metadata);
+    pack.addAsset("second", second, sizeof(second), AssetType::SCRIPT, metadata);
+    pack.addAsset("empty2", second, 0, AssetType::SCRIPT, metadata);
+    pack.replaceAsset("second", changed, sizeof(changed), AssetType::SCRIPT, metadata);
+
+    struct Expected
+    {
+        const char *name, *data;
+        size_t size;
+    };
+    const Expected expected[] = {{"empty", first, 0}, {"first", first, sizeof(first)}, {"alias", first, sizeof(first)}, {"second", changed, sizeof(changed)}, {"empty2", second, 0}};
+    bool ok = true;
+    auto check = [&](const AssetPack &checked, const char *stage)
+    {
+        for (const auto &entry : expected)
+        {
+            auto asset = checked.getAsset(entry.name);
+            if (!asset.second || asset.first.size != entry.size || memcmp(asset.second, entry.data, entry.size) != 0)
+            {
+                printf("Asset pack round trip: %s wrong after %s\n", entry.name, stage);
+                ok = false;
+            }
+        }
+    };
+    auto roundTrip = [](const AssetPack &source, AssetPack &target)
+    {
+        char *buffer = source.serializeAssetPack();
+        target.deserializeAssetPack(buffer);
+        delete[] buffer;
+    };
+
+    check(pack, "building");
+    AssetPack loaded;
+    roundTrip(pack, loaded);
+    check(loaded, "serializing");
+    loaded.compact();
+    check(loaded, "compacting");
+    AssetPack compacted;
+    roundTrip(loaded, compacted);
+    check(compacted, "serializing the compacted pack");
+    if (compacted.stats().stored_size != sizeof(first) + sizeof(changed) || compacted.stats().wasted_size != 0)
+    {
+        printf("Asset pack round trip: compacted pack stores %zu bytes, %zu stale\n", compacted.stats().stored_size, compacted.stats().wasted_size);
+        ok = false;
+    }
+    printf("Asset pack round trip: %s\n", ok ? "ok" : "FAILED");
+    return ok;
 }
@@ -4,6 +4,9 @@
 #include <string>
 #include <utility>
 #include <numeric>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
 
 enum class AssetType : unsigned char
 {
@@ -27,40 +30,80 @@ struct AssetIdentifier
     size_t size;
     AssetType type;
     char metadata[32];
+    uint64_t hash; // Content hash, identifiers with equal content share one blob
 };
-constexpr size_t ASSET_IDENTIFIER_SIZE = sizeof(AssetIdentifier::name) + sizeof(AssetIdentifier::offset) + sizeof(AssetIdentifier::size) + sizeof(AssetIdentifier::type) + sizeof(AssetIdentifier::metadata);
+constexpr size_t ASSET_IDENTIFIER_SIZE_V2 = sizeof(AssetIdentifier::name) + sizeof(AssetIdentifier::offset) + sizeof(AssetIdentifier::size) + sizeof(AssetIdentifier::type) + sizeof(AssetIdentifier::metadata);
+constexpr size_t ASSET_IDENTIFIER_SIZE = ASSET_IDENTIFIER_SIZE_V2 + sizeof(AssetIdentifier::hash);
+
+constexpr int ASSET_PACK_VERSION = 3;
+
+// Fraction of the data section that may be stale before updateAssetPack compacts it
+constexpr float DEFAULT_COMPACT_THRESHOLD = 0.25f;
+
+struct AssetPackStats
+{
+    size_t logical_size;      // Sum of every entry's size, aliases included
+    size_t stored_size;       // Bytes of unique blobs in the data section
+    size_t deduplicated_size; // Bytes saved by aliasing identical content
+    size_t wasted_size;       // Bytes of stale blobs left behind by replace/remove
+};
+
+uint64_t hashAssetData(const char *data, size_t size);
 
 struct AssetPack
 {
     int version;
     size_t asset_count;
+    size_t data_size; // End of the data section, including stale blobs
     std::vector<AssetIdentifier> identifiers;
-    std::vector<char *> assets;
+    std::vector<std::shared_ptr<char[]>> assets; // Aliased identifiers share the same blob, empty entries own a buffer of their own
 
-    AssetPack() : version(2), asset_count(0), identifiers(), assets() {}
-    ~AssetPack()
-    {
-        for (auto &asset : assets)
-        {
-            delete[] asset;
-        }
-    }
+    AssetPack() : version(ASSET_PACK_VERSION), asset_count(0), data_size(0), identifiers(), assets(), blobs_by_hash() {}
 
     size_t size() const;
     void clear();
 
     void addAsset(const std::string &name, const char *data, size_t size, AssetType type, char _metadata[32]);
+    // Returns false when the stored content already matches, nothing is touched then
+    bool replaceAsset(const std::string &name, const char *data, size_t size, AssetType type, char _metadata[32]);
     void removeAsset(const std::string &name);
     std::pair<AssetIdentifier, char *> getAsset(const std::string &name) const;
+    bool hasAsset(const std::string &name) const;
+
+    AssetPackStats stats() const;
+    float wasteRatio() const;
+    void compact();
 
     char *serializeAssetPack() const;
     void deserializeAssetPack(const char *buffer);
+
+private:
+    // Content hash to the identifiers with that content, empty entries aren't in it
+    std::unordered_multimap<uint64_t, size_t> blobs_by_hash;
+
+    int findAsset(const std::string &name) const;
+    int findBlob(uint64_t hash, const char *data, size_t size) const;
+    void indexBlob(size_t index);
+    void unindexBlob(size_t index);
+    void rebuildBlobIndex();
+    void placeBlob(AssetIdentifier &identifier, std::shared_ptr<char[]> &asset, const char *data, size_t size);
 };
 
 void addTextureToPack(const std::string &path, AssetPack &pack, const std::string &name);
+// Re-reads the file and only replaces the entry if its bytes changed, returns whether it did
+bool updateTextureInPack(const std::string &path, AssetPack &pack, const std::string &name);
 
 char *compressPack(const AssetPack &pack, size_t &new_size);
 void uncompressPack(AssetPack &pack, const char *compressed, size_t compressed_size, size_t &new_size);
 
 void loadAssetPack(const std::string &path, AssetPack &pack);
-void saveAssetPack(const std::string &path, const AssetPack &pack);
\ No newline at end of file
+void saveAssetPack(const std::string &path, const AssetPack &pack);
+
+// Builds a pack in memory with empty, aliased and replaced entries, serializes, compacts and reads it back, and
+// prints whether every entry came out with its content. IbexPack --check runs it
+bool debugCheckAssetPackRoundTrip();
+
+// Loads the pack at path (if any), updates the given textures (path, name) and saves it back.
+// Compacts first when the stale part of the data section exceeds compactThreshold.
+// Returns the number of entries that were added or replaced.
+size_t updateAssetPack(const std::string &path, const std::vector<std::pair<std::string, std::string>> &textures, float compactThreshold = DEFAULT_COMPACT_THRESHOLD);
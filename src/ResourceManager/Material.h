@@ -14,6 +14,7 @@ public:
     glm::vec3 specular;
     glm::vec3 ambient;
     float shininess;
+    float dissolve; // Opacity, d in the MTL file. Anything below 1 is drawn in the blended pass
     int illum;
 
     // Texture maps (can be extended to support more textures)
@@ -23,7 +24,9 @@ public:
     std::string dispMap; // Filepath for displacement map
 
     Material(const glm::vec3 &diff = glm::vec3(0.0f), const glm::vec3 &spec = glm::vec3(0.0f), const glm::vec3 &amb = glm::vec3(0.0f), float shin = 32.0f)
-        : diffuse(diff), specular(spec), ambient(amb), shininess(shin), illum(-1), diffuseTexture(""), specularTexture(""), normalMap(""), dispMap("") {}
+        : diffuse(diff), specular(spec), ambient(amb), shininess(shin), dissolve(1.0f), illum(-1), diffuseTexture(""), specularTexture(""), normalMap(""), dispMap("") {}
+
+    bool isTransparent() const { return dissolve < 1.0f; }
 
     inline std::vector<std::string> getTextures() const
     {
@@ -54,6 +54,18 @@ std::string MaterialLibrary::findMaterialName(const std::shared_ptr<Material> &m
     throw std::runtime_error("Can't find name from given material");
 }
 
+size_t MaterialLibrary::getMemoryUsage() const
+{
+    size_t size = 0;
+    for (const auto &kvp : materials)
+    {
+        size += kvp.first.capacity() + sizeof(Material);
+        for (const auto &texture : kvp.second->getTextures())
+            size += texture.capacity();
+    }
+    return size;
+}
+
 void MaterialLibrary::parseMTLLine(const std::string &line, std::shared_ptr<Material> &currentMaterial, std::string &currentName)
 {
     if (line.empty())
@@ -92,6 +104,14 @@ void MaterialLibrary::parseMTLLine(const std::string &line, std::shared_ptr<Mate
     { // Shininess
         currentMaterial->shininess = std::stof(tokens[1]);
     }
+    else if (tokens[0] == "d")
+    { // Dissolve
+        currentMaterial->dissolve = std::stof(tokens[1]);
+    }
+    else if (tokens[0] == "Tr")
+    { // Transparency, the inverse of dissolve
+        currentMaterial->dissolve = 1.0f - std::stof(tokens[1]);
+    }
     else if (tokens[0] == "map_Kd")
     { // Diffuse texture map
         currentMaterial->diffuseTexture = tokens[1];
@@ -25,6 +25,8 @@ public:
 
     std::string findMaterialName(const std::shared_ptr<Material> &mat) const;
 
+    size_t getMemoryUsage() const;
+
 private:
     std::unordered_map<std::string, std::shared_ptr<Material>> materials;
 
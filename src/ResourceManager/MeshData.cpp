@@ -30,9 +30,6 @@ std::vector<std::string> MeshData::getUsedTextures() const
     }
     return textures;
 }
-std::string currentGroupName;
-std::string queuedMaterialLibrary;
-
 bool MeshData::loadFromOBJ(const std::string &filepath, bool calculate_tangents)
 {
     this->filepath = filepath;
@@ -536,6 +533,16 @@ void MeshData::exportObject(const std::string &filepath) const
     outFile.close();
 }
 
+size_t MeshData::getMemoryUsage() const
+{
+    size_t size = 0;
+    for (const auto &attrib : vertexAttributes)
+        size += attrib.values.capacity() * sizeof(float);
+    for (const auto &group : groups)
+        size += group.indices.capacity() * sizeof(VertexIndex);
+    return size;
+}
+
 std::array<VertexAttrib, INDEX_PER_VERTEX> &MeshData::getAttribs()
 {
     return vertexAttributes;
@@ -185,6 +185,9 @@ public:
 
     std::array<VertexAttrib, INDEX_PER_VERTEX> &getAttribs();
 
+    // Bytes held by vertex attributes and group indices
+    size_t getMemoryUsage() const;
+
     [[deprecated("Combine 'em yourself")]]
     static std::shared_ptr<MeshData> CombineMeshes(const MeshData &a, const glm::mat4 &a_tr, const MeshData &b, const glm::mat4 &b_tr);
     [[deprecated("Combine 'em yourself")]]
@@ -201,6 +204,10 @@ private:
     std::array<VertexAttrib, INDEX_PER_VERTEX> vertexAttributes;
     std::vector<MeshGroup> groups;
 
+    // OBJ parser state, kept per mesh so meshes can be parsed concurrently
+    std::string currentGroupName;
+    std::string queuedMaterialLibrary;
+
     void initializeVertexAttributes();
 
     void parseOBJLine(const std::string &line);
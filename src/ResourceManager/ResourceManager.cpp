@@ -4,74 +4,125 @@
 #include "MeshData.h"
 #include "MaterialLibrary.h"
 #include <stb/stb_image.h>
+#include <thread>
+#include <set>
 
 template <>
-std::shared_ptr<TextureData> ResourceManager::loadResource<TextureData>(const std::string &filename)
+std::map<std::string, CacheEntry<TextureData>> &ResourceManager::getCache()
 {
-    // Check if resource is already loaded
-    if (textureCache.find(filename) != textureCache.end())
-    {
-        return textureCache[filename];
-    }
-
-    // Load new texture
-    auto texture = std::make_shared<TextureData>(filename);
-    textureCache[filename] = texture;
-    return texture;
+    return textureCache;
 }
 template <>
-std::shared_ptr<TextureData> ResourceManager::getResource<TextureData>(const std::string &filename)
+std::map<std::string, CacheEntry<ShaderProgram>> &ResourceManager::getCache()
 {
-    // Check if the resource is in cache
-    auto it = textureCache.find(filename);
-    if (it != textureCache.end())
-    {
-        return it->second;
-    }
-
-    // If not in cache, load it
-    return loadResource<TextureData>(filename);
+    return shaderCache;
 }
-
 template <>
-std::shared_ptr<ShaderProgram> ResourceManager::loadResource<ShaderProgram>(const std::string &filename)
+std::map<std::string, CacheEntry<MeshData>> &ResourceManager::getCache()
 {
-    // Check if resource is already loaded
-    if (shaderCache.find(filename) != shaderCache.end())
-    {
-        return shaderCache[filename];
-    }
-
-    // Load new shader program
-    auto shader = std::make_shared<ShaderProgram>(filename);
-    shaderCache[filename] = shader;
-    return shader;
+    return meshCache;
 }
 template <>
-std::shared_ptr<ShaderProgram> ResourceManager::getResource<ShaderProgram>(const std::string &filename)
+std::map<std::string, CacheEntry<MaterialLibrary>> &ResourceManager::getCache()
 {
-    // Check if the resource is in cache
-    auto it = shaderCache.find(filename);
-    if (it != shaderCache.end())
-    {
-        return it->second;
-    }
+    return mtlCache;
+}
+template <>
+std::map<std::string, ResourceRequest<TextureData>> &ResourceManager::getRequests()
+{
+    return textureRequests;
+}
+template <>
+std::map<std::string, ResourceRequest<ShaderProgram>> &ResourceManager::getRequests()
+{
+    return shaderRequests;
+}
+template <>
+std::map<std::string, ResourceRequest<MeshData>> &ResourceManager::getRequests()
+{
+    return meshRequests;
+}
+template <>
+std::map<std::string, ResourceRequest<MaterialLibrary>> &ResourceManager::getRequests()
+{
+    return mtlRequests;
+}
+template <>
+SlotArray<TextureData, CacheEntry<TextureData> *> &ResourceManager::getSlots()
+{
+    return textureSlots;
+}
+template <>
+SlotArray<ShaderProgram, CacheEntry<ShaderProgram> *> &ResourceManager::getSlots()
+{
+    return shaderSlots;
+}
+template <>
+SlotArray<MeshData, CacheEntry<MeshData> *> &ResourceManager::getSlots()
+{
+    return meshSlots;
+}
+template <>
+SlotArray<MaterialLibrary, CacheEntry<MaterialLibrary> *> &ResourceManager::getSlots()
+{
+    return mtlSlots;
+}
+template <>
+ResourceKind ResourceManager::getKind<TextureData>()
+{
+    return ResourceKind::TEXTURE;
+}
+template <>
+ResourceKind ResourceManager::getKind<ShaderProgram>()
+{
+    return ResourceKind::SHADER;
+}
+template <>
+ResourceKind ResourceManager::getKind<MeshData>()
+{
+    return ResourceKind::MESH;
+}
+template <>
+ResourceKind ResourceManager::getKind<MaterialLibrary>()
+{
+    return ResourceKind::MATERIAL;
+}
+template <>
+size_t ResourceManager::measure<TextureData>(const TextureData &resource)
+{
+    return resource.getMemoryUsage();
+}
+template <>
+size_t ResourceManager::measure<ShaderProgram>(const ShaderProgram &resource)
+{
+    return resource.getMemoryUsage();
+}
+template <>
+size_t ResourceManager::measure<MeshData>(const MeshData &resource)
+{
+    return resource.getMemoryUsage();
+}
+template <>
+size_t ResourceManager::measure<MaterialLibrary>(const MaterialLibrary &resource)
+{
+    return resource.getMemoryUsage();
+}
 
-    // If not in cache, load it
-    return loadResource<ShaderProgram>(filename);
+template <>
+std::shared_ptr<TextureData> ResourceManager::createResource<TextureData>(const std::string &filename)
+{
+    return std::make_shared<TextureData>(filename);
 }
 
 template <>
-std::shared_ptr<MeshData> ResourceManager::loadResource<MeshData>(const std::string &filename)
+std::shared_ptr<ShaderProgram> ResourceManager::createResource<ShaderProgram>(const std::string &filename)
 {
-    // Check if resource is already loaded
-    auto it = meshCache.find(filename);
-    if (it != meshCache.end())
-    {
-        return it->second;
-    }
+    return std::make_shared<ShaderProgram>(filename);
+}
 
-    // Load new mesh
+template <>
+std::shared_ptr<MeshData> ResourceManager::createResource<MeshData>(const std::string &filename)
+{
     auto mesh = std::make_shared<MeshData>();
     try
     {
@@ -79,9 +130,6 @@ std::shared_ptr<MeshData> ResourceManager::loadResource<MeshData>(const std::str
         {
             throw std::runtime_error("Failed to load mesh from " + filename);
         }
-
-        // Cache the loaded mesh
-        meshCache[filename] = mesh;
         return mesh;
     }
     catch (const std::exception &e)
@@ -90,105 +138,254 @@ std::shared_ptr<MeshData> ResourceManager::loadResource<MeshData>(const std::str
         throw std::runtime_error("Exception while loading mesh from " + filename + ": " + e.what());
     }
 }
+
 template <>
-std::shared_ptr<MeshData> ResourceManager::getResource<MeshData>(const std::string &filename)
+std::shared_ptr<MaterialLibrary> ResourceManager::createResource<MaterialLibrary>(const std::string &filename)
 {
-    // Check if the resource is in cache
-    auto it = meshCache.find(filename);
-    if (it != meshCache.end())
+    auto mtl = std::make_shared<MaterialLibrary>();
+    if (!mtl->loadMaterialsFromMTL(filename))
     {
-        return it->second;
+        throw std::runtime_error("Failed to load material library from " + filename);
     }
+    return mtl;
+}
 
-    // If not in cache, load it
-    return loadResource<MeshData>(filename);
+void ResourceManager::purgeAll()
+{
+    purge<TextureData>();
+    purge<ShaderProgram>();
+    purge<MeshData>();
+    purge<MaterialLibrary>();
 }
 
-template <>
-std::shared_ptr<MaterialLibrary> ResourceManager::loadResource<MaterialLibrary>(const std::string &filename)
+void ResourceManager::update(size_t maxVisits)
 {
-    // Check if resource is already loaded
-    if (mtlCache.find(filename) != mtlCache.end())
+    std::unique_lock lock(mutex_);
+    for (size_t visits = 0; totalBytes > memoryBudget && visits < maxVisits && !lru.empty(); visits++)
     {
-        return mtlCache[filename];
+        auto node = lru.begin();
+        bool evicted = false;
+        switch (node->kind)
+        {
+        case ResourceKind::TEXTURE:
+            evicted = evict<TextureData>(node->name);
+            break;
+        case ResourceKind::SHADER:
+            evicted = evict<ShaderProgram>(node->name);
+            break;
+        case ResourceKind::MESH:
+            evicted = evict<MeshData>(node->name);
+            break;
+        case ResourceKind::MATERIAL:
+            evicted = evict<MaterialLibrary>(node->name);
+            break;
+        default:
+            break;
+        }
+        // Still referenced somewhere, so it is in use and counts as recently used
+        if (!evicted)
+            lru.splice(lru.end(), lru, node);
     }
+}
 
-    // Load new material library
-    auto mtl = std::make_shared<MaterialLibrary>();
-    if (!mtl->loadMaterialsFromMTL(filename))
+void ResourceManager::setMemoryBudget(size_t bytes)
+{
+    std::unique_lock lock(mutex_);
+    memoryBudget = bytes;
+}
+
+size_t ResourceManager::getMemoryBudget() const
+{
+    std::unique_lock lock(mutex_);
+    return memoryBudget;
+}
+
+ResourceStats ResourceManager::getStats() const
+{
+    std::unique_lock lock(mutex_);
+    ResourceStats stats;
+    for (size_t i = 0; i < RESOURCE_KIND_COUNT; i++)
     {
-        throw std::runtime_error("Failed to load material library from " + filename);
+        stats.bytes[i] = kindBytes[i];
+        stats.loads[i] = kindLoads[i];
     }
-    mtlCache[filename] = mtl;
-    return mtl;
+    stats.counts[(size_t)ResourceKind::TEXTURE] = textureCache.size();
+    stats.counts[(size_t)ResourceKind::SHADER] = shaderCache.size();
+    stats.counts[(size_t)ResourceKind::MESH] = meshCache.size();
+    stats.counts[(size_t)ResourceKind::MATERIAL] = mtlCache.size();
+    stats.totalBytes = totalBytes;
+    stats.budget = memoryBudget;
+    stats.evictions = evictions;
+    return stats;
 }
-template <>
-std::shared_ptr<MaterialLibrary> ResourceManager::getResource<MaterialLibrary>(const std::string &filename)
+
+size_t ResourceManager::processFinalizers()
 {
-    // Check if the resource is in cache
-    auto it = mtlCache.find(filename);
-    if (it != mtlCache.end())
+    std::vector<std::function<bool(void)>> pending;
     {
-        return it->second;
+        std::unique_lock lock(finalizerMutex);
+        pending.swap(finalizers);
     }
 
-    // If not in cache, load it
-    return loadResource<MaterialLibrary>(filename);
-}
+    size_t ran = 0;
+    std::vector<std::function<bool(void)>> waiting;
+    for (auto &finalizer : pending)
+    {
+        try
+        {
+            if (finalizer())
+                ran++;
+            else
+                waiting.push_back(std::move(finalizer));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Async resource load failed: " << e.what() << std::endl;
+        }
+    }
 
-void ResourceManager::purgeAll()
-{
-    purge<TextureData>();
-    purge<ShaderProgram>();
-    purge<MeshData>();
-    purge<MaterialLibrary>();
+    std::unique_lock lock(finalizerMutex);
+    finalizers.insert(finalizers.end(), waiting.begin(), waiting.end());
+    return ran;
 }
 
 void ResourceManager::debugUseCounts()
 {
+    std::unique_lock lock(mutex_);
     for (auto &kvp : textureCache)
     {
-        printf("Texture %s has %ld uses\n", kvp.first.c_str(), kvp.second.use_count());
+        printf("Texture %s has %ld uses\n", kvp.first.c_str(), kvp.second.resource.use_count());
     }
     for (auto &kvp : shaderCache)
     {
-        printf("Shader %s has %ld uses\n", kvp.first.c_str(), kvp.second.use_count());
+        printf("Shader %s has %ld uses\n", kvp.first.c_str(), kvp.second.resource.use_count());
     }
     for (auto &kvp : meshCache)
     {
-        printf("Mesh %s has %ld uses\n", kvp.first.c_str(), kvp.second.use_count());
+        printf("Mesh %s has %ld uses\n", kvp.first.c_str(), kvp.second.resource.use_count());
     }
     for (auto &kvp : mtlCache)
     {
-        printf("Material Library %s has %ld uses\n", kvp.first.c_str(), kvp.second.use_count());
+        printf("Material Library %s has %ld uses\n", kvp.first.c_str(), kvp.second.resource.use_count());
     }
 }
 
-template <>
-std::map<std::string, std::shared_ptr<TextureData>> &ResourceManager::getCache()
-{
-    return textureCache;
-}
-template <>
-std::map<std::string, std::shared_ptr<ShaderProgram>> &ResourceManager::getCache()
-{
-    return shaderCache;
-}
-template <>
-std::map<std::string, std::shared_ptr<MeshData>> &ResourceManager::getCache()
-{
-    return meshCache;
-}
-template <>
-std::map<std::string, std::shared_ptr<MaterialLibrary>> &ResourceManager::getCache()
+bool ResourceManager::debugStressLoads(const std::vector<std::string> &meshes, const std::vector<std::string> &materials, size_t threadCount, size_t rounds)
 {
-    return mtlCache;
+    // Files still cached after the purge are in use and never decoded by the run, everything else exactly once since
+    // what the threads loaded stays alive until all of them are done and purge leaves referenced entries alone
+    purge<MeshData>();
+    purge<MaterialLibrary>();
+    size_t expectedMeshes = 0, expectedMaterials = 0;
+    for (const auto &name : std::set<std::string>(meshes.begin(), meshes.end()))
+        expectedMeshes += peekResource<MeshData>(name) ? 0 : 1;
+    for (const auto &name : std::set<std::string>(materials.begin(), materials.end()))
+        expectedMaterials += peekResource<MaterialLibrary>(name) ? 0 : 1;
+    ResourceStats before = getStats();
+
+    struct Held
+    {
+        std::vector<ResourceFuture<MeshData>> meshFutures;
+        std::vector<ResourceFuture<MaterialLibrary>> materialFutures;
+        std::vector<std::shared_ptr<MeshData>> meshes;
+        std::vector<std::shared_ptr<MaterialLibrary>> materials;
+    };
+    std::vector<Held> held(threadCount);
+    std::atomic<size_t> failures(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t]()
+                             {
+            Held &mine = held[t];
+            for (size_t round = 0; round < rounds; round++)
+            {
+                for (size_t i = 0; i < meshes.size() + materials.size(); i++)
+                {
+                    size_t key = (i + t * 7) % (meshes.size() + materials.size());
+                    bool isMesh = key < meshes.size();
+                    try
+                    {
+                        switch ((t + round + i) % 3)
+                        {
+                        case 0:
+                            if (isMesh)
+                                mine.meshFutures.push_back(loadResourceAsync<MeshData>(meshes[key]));
+                            else
+                                mine.materialFutures.push_back(loadResourceAsync<MaterialLibrary>(materials[key - meshes.size()]));
+                            break;
+                        case 1:
+                            if (isMesh)
+                                mine.meshes.push_back(loadResource<MeshData>(meshes[key]));
+                            else
+                                mine.materials.push_back(loadResource<MaterialLibrary>(materials[key - meshes.size()]));
+                            break;
+                        default:
+                            if (isMesh)
+                                purge<MeshData>();
+                            else
+                                purge<MaterialLibrary>();
+                            break;
+                        }
+                    }
+                    catch (const std::exception &e)
+                    {
+                        printf("Resource stress: %s\n", e.what());
+                        failures++;
+                    }
+                }
+            }
+            for (auto &future : mine.meshFutures)
+            {
+                try
+                {
+                    future.get();
+                }
+                catch (const std::exception &)
+                {
+                    failures++;
+                }
+            }
+            for (auto &future : mine.materialFutures)
+            {
+                try
+                {
+                    future.get();
+                }
+                catch (const std::exception &)
+                {
+                    failures++;
+                }
+            } });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+
+    ResourceStats after = getStats();
+    size_t meshLoads = after.loads[(size_t)ResourceKind::MESH] - before.loads[(size_t)ResourceKind::MESH];
+    size_t materialLoads = after.loads[(size_t)ResourceKind::MATERIAL] - before.loads[(size_t)ResourceKind::MATERIAL];
+    bool ok = failures == 0 && meshLoads == expectedMeshes && materialLoads == expectedMaterials;
+    printf("Resource stress over %zu threads: %.2f ms, %zu/%zu mesh and %zu/%zu material decodes, %zu failures: %s\n", threadCount,
+           std::chrono::duration<double, std::milli>(end - start).count(), meshLoads, expectedMeshes, materialLoads, expectedMaterials,
+           failures.load(), ok ? "ok" : "FAILED");
+    return ok;
 }
 
 void ResourceManager::clear()
 {
+    std::unique_lock lock(mutex_);
+    lru.clear();
+    for (auto &bytes : kindBytes)
+        bytes = 0;
+    totalBytes = 0;
     textureCache.clear();
     shaderCache.clear();
     meshCache.clear();
     mtlCache.clear();
+    textureSlots.clear();
+    shaderSlots.clear();
+    meshSlots.clear();
+    mtlSlots.clear();
 }
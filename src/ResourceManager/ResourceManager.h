@@ -6,6 +6,15 @@
 #include <memory>
 #include <stdexcept>
 #include <iostream>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <list>
+#include <atomic>
+
+#include <ThreadPool.h>
+#include <SlotArray.h>
 
 // Forward declaration for resource types
 class TextureData;
@@ -13,6 +22,60 @@ class ShaderProgram;
 class MeshData;
 class MaterialLibrary;
 
+template <typename ResourceType>
+using ResourceFuture = std::shared_future<std::shared_ptr<ResourceType>>;
+
+template <typename ResourceType>
+using ResourceHandle = Handle<ResourceType>;
+
+enum class ResourceKind : unsigned char
+{
+    TEXTURE = 0,
+    SHADER,
+    MESH,
+    MATERIAL,
+    MAX_KIND
+};
+constexpr size_t RESOURCE_KIND_COUNT = (size_t)ResourceKind::MAX_KIND;
+
+constexpr size_t DEFAULT_MEMORY_BUDGET = 512ull * 1024 * 1024;
+constexpr size_t DEFAULT_EVICTION_VISITS = 4; // LRU entries looked at per update
+
+struct ResourceStats
+{
+    size_t bytes[RESOURCE_KIND_COUNT];
+    size_t counts[RESOURCE_KIND_COUNT];
+    size_t totalBytes;
+    size_t budget;
+    size_t evictions; // Since startup
+    size_t loads[RESOURCE_KIND_COUNT]; // Files decoded since startup, failed ones included
+};
+
+// Position in the global least recently used order
+struct LruNode
+{
+    ResourceKind kind;
+    std::string name;
+};
+
+// A load that hasn't finished yet
+template <typename ResourceType>
+struct ResourceRequest
+{
+    ResourceFuture<ResourceType> future;
+    // Does the load on the calling thread, or nothing if a worker already started it
+    std::function<void(void)> run;
+};
+
+template <typename ResourceType>
+struct CacheEntry
+{
+    std::shared_ptr<ResourceType> resource;
+    size_t size;
+    std::list<LruNode>::iterator lru;
+    ResourceHandle<ResourceType> handle;
+};
+
 class ResourceManager
 {
 public:
@@ -31,6 +94,26 @@ public:
     template <typename ResourceType>
     std::shared_ptr<ResourceType> getResource(const std::string &filename);
 
+    // Cached resource or null, never starts a load and doesn't count as a use
+    template <typename ResourceType>
+    std::shared_ptr<ResourceType> peekResource(const std::string &filename);
+
+    // Loads if needed and interns filename, the handle resolves until the entry is unloaded or evicted
+    template <typename ResourceType>
+    ResourceHandle<ResourceType> getHandle(const std::string &filename);
+
+    // Null for stale handles, skips the filename lookup
+    template <typename ResourceType>
+    std::shared_ptr<ResourceType> getResource(ResourceHandle<ResourceType> handle);
+
+    // Loads on the loader pool and returns immediately, requests for a key that is already
+    // loading share its future. onReady is run on the render thread by processFinalizers
+    template <typename ResourceType>
+    ResourceFuture<ResourceType> loadResourceAsync(const std::string &filename, std::function<void(const std::shared_ptr<ResourceType> &)> onReady = nullptr);
+
+    // Runs the onReady callbacks of finished async loads, call from the thread owning the GL context
+    size_t processFinalizers();
+
     template <typename ResourceType>
     void unloadResource(const std::string &filename);
 
@@ -39,7 +122,18 @@ public:
 
     void purgeAll();
 
+    // Evicts unused resources in LRU order while over budget, visits at most maxVisits entries
+    void update(size_t maxVisits = DEFAULT_EVICTION_VISITS);
+
+    void setMemoryBudget(size_t bytes);
+    size_t getMemoryBudget() const;
+    ResourceStats getStats() const;
+
     void debugUseCounts();
+    // threadCount threads mix async loads, blocking loads and purges over the same meshes and material libraries
+    // while holding on to what they got, then checks every file was decoded once. materials should cover every
+    // library the meshes reference. Returns whether it held, IbexResourceCheck runs it
+    bool debugStressLoads(const std::vector<std::string> &meshes, const std::vector<std::string> &materials, size_t threadCount = 8, size_t rounds = 16);
 
     // Cleanup
     void clear();
@@ -48,46 +142,262 @@ private:
     ResourceManager() = default;
     ~ResourceManager() = default;
 
+    // Guards the caches and the in-flight request maps
+    mutable std::mutex mutex_;
+
     // Map for storing resources by filename
-    std::map<std::string, std::shared_ptr<TextureData>> textureCache;
-    std::map<std::string, std::shared_ptr<ShaderProgram>> shaderCache;
-    std::map<std::string, std::shared_ptr<MeshData>> meshCache;
-    std::map<std::string, std::shared_ptr<MaterialLibrary>> mtlCache;
+    std::map<std::string, CacheEntry<TextureData>> textureCache;
+    std::map<std::string, CacheEntry<ShaderProgram>> shaderCache;
+    std::map<std::string, CacheEntry<MeshData>> meshCache;
+    std::map<std::string, CacheEntry<MaterialLibrary>> mtlCache;
+
+    // Handle slots point at the cache entries, map nodes don't move until erased
+    SlotArray<TextureData, CacheEntry<TextureData> *> textureSlots;
+    SlotArray<ShaderProgram, CacheEntry<ShaderProgram> *> shaderSlots;
+    SlotArray<MeshData, CacheEntry<MeshData> *> meshSlots;
+    SlotArray<MaterialLibrary, CacheEntry<MaterialLibrary> *> mtlSlots;
+
+    // Front is the least recently used entry over all caches
+    std::list<LruNode> lru;
+    size_t kindBytes[RESOURCE_KIND_COUNT] = {};
+    size_t totalBytes = 0;
+    size_t memoryBudget = DEFAULT_MEMORY_BUDGET;
+    size_t evictions = 0;
+    size_t kindLoads[RESOURCE_KIND_COUNT] = {};
+
+    // Loads that are still running, by filename
+    std::map<std::string, ResourceRequest<TextureData>> textureRequests;
+    std::map<std::string, ResourceRequest<ShaderProgram>> shaderRequests;
+    std::map<std::string, ResourceRequest<MeshData>> meshRequests;
+    std::map<std::string, ResourceRequest<MaterialLibrary>> mtlRequests;
+
+    std::mutex finalizerMutex;
+    std::vector<std::function<bool(void)>> finalizers; // Return true once they ran
+
+    // Declared last so the workers are joined before the caches go away
+    ThreadPool loaders;
+
+    template <typename ResourceType>
+    std::map<std::string, CacheEntry<ResourceType>> &getCache();
+    template <typename ResourceType>
+    SlotArray<ResourceType, CacheEntry<ResourceType> *> &getSlots();
+    template <typename ResourceType>
+    static ResourceKind getKind();
+    // Bytes of CPU memory held by the resource
+    template <typename ResourceType>
+    static size_t measure(const ResourceType &resource);
+
+    // These expect mutex_ to be held
+    template <typename ResourceType>
+    void insertEntry(const std::string &filename, const std::shared_ptr<ResourceType> &resource);
+    template <typename ResourceType>
+    typename std::map<std::string, CacheEntry<ResourceType>>::iterator eraseEntry(typename std::map<std::string, CacheEntry<ResourceType>>::iterator it);
+    template <typename ResourceType>
+    bool evict(const std::string &filename);
+    template <typename ResourceType>
+    std::map<std::string, ResourceRequest<ResourceType>> &getRequests();
 
+    // Does the actual loading, runs without holding mutex_
     template <typename ResourceType>
-    std::map<std::string, std::shared_ptr<ResourceType>> &getCache();
+    std::shared_ptr<ResourceType> createResource(const std::string &filename);
+
+    template <typename ResourceType>
+    ResourceFuture<ResourceType> request(const std::string &filename, bool async);
 
     // Disable copy/move operations for the singleton
     ResourceManager(const ResourceManager &) = delete;
     ResourceManager &operator=(const ResourceManager &) = delete;
 };
 
+template <typename ResourceType>
+inline ResourceFuture<ResourceType> ResourceManager::request(const std::string &filename, bool async)
+{
+    std::unique_lock lock(mutex_);
+    auto &cache = getCache<ResourceType>();
+    auto it = cache.find(filename);
+    if (it != cache.end())
+    {
+        lru.splice(lru.end(), lru, it->second.lru);
+        std::promise<std::shared_ptr<ResourceType>> ready;
+        ready.set_value(it->second.resource);
+        return ready.get_future().share();
+    }
+
+    // Someone is already loading it, wait for the same result instead of decoding twice
+    auto &requests = getRequests<ResourceType>();
+    auto request_it = requests.find(filename);
+    if (request_it != requests.end())
+    {
+        ResourceRequest<ResourceType> pending = request_it->second;
+        lock.unlock();
+        // A blocking load (a mesh's material library, from a loader) takes over a load still queued on the pool,
+        // otherwise every loader could end up waiting on work queued behind them
+        if (!async)
+            pending.run();
+        return pending.future;
+    }
+
+    auto task = std::make_shared<std::packaged_task<std::shared_ptr<ResourceType>()>>([this, filename]()
+                                                                                       { return createResource<ResourceType>(filename); });
+    ResourceFuture<ResourceType> future = task->get_future().share();
+    auto started = std::make_shared<std::atomic<bool>>(false);
+    auto run = [this, task, future, started, filename]()
+    {
+        if (started->exchange(true))
+            return;
+        (*task)();
+        std::unique_lock run_lock(mutex_);
+        kindLoads[(size_t)getKind<ResourceType>()]++;
+        getRequests<ResourceType>().erase(filename);
+        try
+        {
+            insertEntry<ResourceType>(filename, future.get());
+        }
+        catch (const std::exception &)
+        {
+            // Not cached, the error stays in the future for whoever waits on it
+        }
+    };
+    requests[filename] = ResourceRequest<ResourceType>{future, run};
+    lock.unlock();
+
+    if (async)
+        loaders.enqueue(run);
+    else
+        run();
+    return future;
+}
+
+template <typename ResourceType>
+inline std::shared_ptr<ResourceType> ResourceManager::loadResource(const std::string &filename)
+{
+    return request<ResourceType>(filename, false).get();
+}
+
+template <typename ResourceType>
+inline std::shared_ptr<ResourceType> ResourceManager::getResource(const std::string &filename)
+{
+    return loadResource<ResourceType>(filename);
+}
+
+template <typename ResourceType>
+inline std::shared_ptr<ResourceType> ResourceManager::peekResource(const std::string &filename)
+{
+    std::unique_lock lock(mutex_);
+    auto &cache = getCache<ResourceType>();
+    auto it = cache.find(filename);
+    if (it == cache.end())
+        return nullptr;
+    return it->second.resource;
+}
+
+template <typename ResourceType>
+inline ResourceHandle<ResourceType> ResourceManager::getHandle(const std::string &filename)
+{
+    auto resource = loadResource<ResourceType>(filename);
+    std::unique_lock lock(mutex_);
+    auto &cache = getCache<ResourceType>();
+    auto it = cache.find(filename);
+    if (it == cache.end())
+        return ResourceHandle<ResourceType>();
+    return it->second.handle;
+}
+
+template <typename ResourceType>
+inline std::shared_ptr<ResourceType> ResourceManager::getResource(ResourceHandle<ResourceType> handle)
+{
+    std::unique_lock lock(mutex_);
+    CacheEntry<ResourceType> *entry = getSlots<ResourceType>().get(handle);
+    if (!entry)
+        return nullptr;
+    lru.splice(lru.end(), lru, entry->lru);
+    return entry->resource;
+}
+
+template <typename ResourceType>
+inline ResourceFuture<ResourceType> ResourceManager::loadResourceAsync(const std::string &filename, std::function<void(const std::shared_ptr<ResourceType> &)> onReady)
+{
+    auto future = request<ResourceType>(filename, true);
+    if (onReady)
+    {
+        std::unique_lock lock(finalizerMutex);
+        finalizers.push_back([future, onReady]()
+                             {
+            if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+            onReady(future.get());
+            return true; });
+    }
+    return future;
+}
+
+template <typename ResourceType>
+inline void ResourceManager::insertEntry(const std::string &filename, const std::shared_ptr<ResourceType> &resource)
+{
+    auto &cache = getCache<ResourceType>();
+    auto it = cache.find(filename);
+    if (it != cache.end())
+        eraseEntry<ResourceType>(it);
+
+    ResourceKind kind = getKind<ResourceType>();
+    size_t size = measure<ResourceType>(*resource);
+    auto node = lru.insert(lru.end(), LruNode{kind, filename});
+    auto &entry = cache[filename];
+    entry = CacheEntry<ResourceType>{resource, size, node, ResourceHandle<ResourceType>()};
+    entry.handle = getSlots<ResourceType>().insert(&entry);
+    kindBytes[(size_t)kind] += size;
+    totalBytes += size;
+}
+
+template <typename ResourceType>
+inline typename std::map<std::string, CacheEntry<ResourceType>>::iterator ResourceManager::eraseEntry(typename std::map<std::string, CacheEntry<ResourceType>>::iterator it)
+{
+    kindBytes[(size_t)getKind<ResourceType>()] -= it->second.size;
+    totalBytes -= it->second.size;
+    lru.erase(it->second.lru);
+    getSlots<ResourceType>().remove(it->second.handle);
+    return getCache<ResourceType>().erase(it);
+}
+
+template <typename ResourceType>
+inline bool ResourceManager::evict(const std::string &filename)
+{
+    auto &cache = getCache<ResourceType>();
+    auto it = cache.find(filename);
+    if (it == cache.end() || it->second.resource.use_count() > 1)
+        return false;
+    printf("Evicted resource %s (%zu bytes)\n", filename.c_str(), it->second.size);
+    eraseEntry<ResourceType>(it);
+    evictions++;
+    return true;
+}
+
 template <typename ResourceType>
 inline void ResourceManager::unloadResource(const std::string &filename)
 {
+    std::unique_lock lock(mutex_);
     auto &cache = getCache<ResourceType>();
     auto it = cache.find(filename);
     if (it != cache.end())
     {
         printf("Unloaded resource %s\n", filename.c_str());
-        cache.erase(it);
+        eraseEntry<ResourceType>(it);
     }
 }
 
 template <typename ResourceType>
 inline void ResourceManager::purge()
 {
+    std::unique_lock lock(mutex_);
     auto &cache = getCache<ResourceType>();
-    std::vector<std::string> purgeList = {};
-    for (auto &kvp : cache)
+    for (auto it = cache.begin(); it != cache.end();)
     {
-        if (kvp.second.use_count() <= 1)
+        if (it->second.resource.use_count() <= 1)
         {
-            purgeList.push_back(kvp.first);
+            printf("Unloaded resource %s\n", it->first.c_str());
+            it = eraseEntry<ResourceType>(it);
         }
-    }
-    for (auto &name : purgeList)
-    {
-        unloadResource<ResourceType>(name);
+        else
+            it++;
     }
 }
\ No newline at end of file
@@ -18,6 +18,20 @@ ShaderData::ShaderData(const std::string &path)
     std::cout << "Loaded shader: " << path << std::endl;
 }
 
+std::string ShaderData::getSource(const std::string &defines) const
+{
+    if (defines.empty())
+        return source;
+    size_t insertAt = 0;
+    if (source.compare(0, 8, "#version") == 0)
+    {
+        insertAt = source.find('\n');
+        insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
+    }
+    // #line keeps error messages pointing at the lines in the file
+    return source.substr(0, insertAt) + defines + (insertAt ? "#line 2\n" : "#line 1\n") + source.substr(insertAt);
+}
+
 ShaderData::~ShaderData()
 {
 }
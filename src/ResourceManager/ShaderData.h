@@ -13,4 +13,7 @@ public:
     ~ShaderData();
 
     std::string getSource() const { return source; }
+    // The source with defines inserted after the #version line, which has to stay first
+    std::string getSource(const std::string &defines) const;
+    size_t getMemoryUsage() const { return source.capacity(); }
 };
\ No newline at end of file
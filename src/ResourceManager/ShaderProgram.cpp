@@ -29,3 +29,14 @@ ShaderProgram::ShaderProgram(const std::string &folder)
     if (geometry_file == 0)
         geometry = std::make_shared<ShaderData>(folder + "/geometry.glsl");
 }
+
+size_t ShaderProgram::getMemoryUsage() const
+{
+    size_t size = 0;
+    for (const auto &stage : {vertex, fragment, geometry})
+    {
+        if (stage)
+            size += stage->getMemoryUsage();
+    }
+    return size;
+}
@@ -18,4 +18,6 @@ public:
     std::shared_ptr<ShaderData> getVertex() const { return vertex; };
     std::shared_ptr<ShaderData> getFragment() const { return fragment; };
     std::shared_ptr<ShaderData> getGeometry() const { return geometry; };
+
+    size_t getMemoryUsage() const;
 };
\ No newline at end of file
@@ -14,6 +14,7 @@ public:
     unsigned char *getData() const { return data; }
     int getChannels() const { return channels; }
     std::string getName() const { return filename; }
+    size_t getMemoryUsage() const { return (size_t)width * height * channels; }
 
     void createData(int width, int height, int channels);
     void uploadData(unsigned char *data, int size, int offset);
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+// Index into a SlotArray plus the generation of the slot when it was handed out.
+// Once the slot is removed the generation moves on and old handles stop resolving
+template <typename T>
+struct Handle
+{
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+    uint32_t index = INVALID_INDEX;
+    uint32_t generation = 0;
+
+    inline bool isValid() const { return index != INVALID_INDEX; }
+
+    inline bool operator==(const Handle &other) const { return index == other.index && generation == other.generation; }
+    inline bool operator!=(const Handle &other) const { return !(*this == other); }
+};
+
+// Resolving a handle is a bounds check, a generation compare and an index, no hashing or refcounting.
+// Slots live in a deque so references returned by get stay valid when others are inserted,
+// freed slots are reused. Not synchronized, callers own the locking
+template <typename T, typename Value = std::shared_ptr<T>>
+class SlotArray
+{
+private:
+    struct Slot
+    {
+        Value value;
+        uint32_t generation;
+        bool occupied;
+    };
+
+    std::deque<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    size_t count = 0;
+
+    inline static const Value Empty = Value();
+
+public:
+    inline Handle<T> insert(Value value)
+    {
+        uint32_t index;
+        if (!freeSlots.empty())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            index = (uint32_t)slots.size();
+            slots.push_back(Slot{Value(), 0, false});
+        }
+        Slot &slot = slots[index];
+        slot.value = std::move(value);
+        slot.occupied = true;
+        count++;
+        return Handle<T>{index, slot.generation};
+    }
+
+    inline bool remove(Handle<T> handle)
+    {
+        if (!contains(handle))
+            return false;
+        Slot &slot = slots[handle.index];
+        slot.value = Value();
+        slot.occupied = false;
+        slot.generation++;
+        freeSlots.push_back(handle.index);
+        count--;
+        return true;
+    }
+
+    inline bool contains(Handle<T> handle) const
+    {
+        return handle.index < slots.size() && slots[handle.index].occupied && slots[handle.index].generation == handle.generation;
+    }
+
+    // Returns an empty value for stale or invalid handles
+    inline const Value &get(Handle<T> handle) const
+    {
+        return contains(handle) ? slots[handle.index].value : Empty;
+    }
+
+    // func(Handle<T>, const Value &) for every occupied slot
+    template <typename Func>
+    inline void forEach(Func func) const
+    {
+        for (uint32_t i = 0; i < slots.size(); i++)
+            if (slots[i].occupied)
+                func(Handle<T>{i, slots[i].generation}, slots[i].value);
+    }
+
+    // Removes everything, handles issued before stay stale
+    inline void clear()
+    {
+        for (uint32_t i = 0; i < slots.size(); i++)
+            if (slots[i].occupied)
+                remove(Handle<T>{i, slots[i].generation});
+    }
+
+    inline size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void(void)>> tasks;
+    std::mutex mutex_;
+    std::condition_variable condition;
+    bool stopping;
+
+    inline void work()
+    {
+        while (true)
+        {
+            std::function<void(void)> task;
+            {
+                std::unique_lock lock(mutex_);
+                condition.wait(lock, [this]()
+                               { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    ThreadPool(size_t threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1)
+        : stopping(false)
+    {
+        for (size_t i = 0; i < threadCount; i++)
+            workers.emplace_back([this]()
+                                 { work(); });
+    }
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock lock(mutex_);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    inline void enqueue(std::function<void(void)> task)
+    {
+        {
+            std::unique_lock lock(mutex_);
+            tasks.push(std::move(task));
+        }
+        condition.notify_one();
+    }
+
+    inline size_t size() const { return workers.size(); }
+};
@@ -0,0 +1,34 @@
+#include <ResourceManager/AssetPack/AssetPack.h>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Builds texture asset packs outside the game.
+//   IbexPack <pack> <texture>...  adds or replaces the textures whose files changed, named by their path
+//   IbexPack --check              runs the asset pack round trip check
+int main(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "--check") == 0)
+        return debugCheckAssetPackRoundTrip() ? 0 : 1;
+    if (argc < 3)
+    {
+        printf("Usage: %s <pack> <texture>...\n       %s --check\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, std::string>> textures;
+    for (int i = 2; i < argc; i++)
+        textures.push_back({argv[i], argv[i]});
+    try
+    {
+        updateAssetPack(argv[1], textures);
+    }
+    catch (const std::exception &e)
+    {
+        printf("Failed to update %s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#include <ResourceManager/ResourceManager.h>
+#include <cstdlib>
+
+// Runs ResourceManager::debugStressLoads over the models in res, from the repository root.
+//   IbexResourceCheck [threads] [rounds]
+int main(int argc, char **argv)
+{
+    size_t threads = argc > 1 ? (size_t)atoi(argv[1]) : 8;
+    size_t rounds = argc > 2 ? (size_t)atoi(argv[2]) : 16;
+    // The materials cover every library these meshes reference, see debugStressLoads
+    bool ok = ResourceManager::instance().debugStressLoads({"res/Models/box.obj", "res/Models/box-slice.obj", "res/Models/Pebbles.obj", "res/Models/Pebble_Sphere.obj", "res/Models/TBNtest.obj"},
+                                                           {"res/Materials/cube.mtl", "res/Materials/Pebble_Sphere.mtl"}, threads, rounds);
+    return ok ? 0 : 1;
+}